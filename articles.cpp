@@ -1,8 +1,11 @@
 #include "articles.hpp"
 #include "fetcher.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "probes.hpp"
 #include "include/sqlite3.h"
 #include "nlohmann/json.hpp"
-#include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <chrono>
@@ -11,49 +14,62 @@ using json = nlohmann::json;
 
 namespace Articles
 {
-    ArticleManager::ArticleManager(sqlite3* db) : db_(db) {}
+    namespace
+    {
+        auto& ingested_articles = Metrics::registry().counter(
+            "ocu_ingest_rows_total", "Rows stored by ingest, by source", "source=\"articles\"");
+        auto& article_ingest_duration = Metrics::registry().histogram(
+            "ocu_ingest_duration_seconds", "Duration of ingest batches, by source", "source=\"articles\"");
+    }
+
+    ArticleManager::ArticleManager(Database& db) : db_(db) {}
 
     bool ArticleManager::fetch_and_store(std::string_view endpoint)
     {
-        std::cout << "Fetching articles from " << endpoint << std::endl;
+        LOG_INFO("Fetching articles from {}", endpoint);
 
         auto json_content = Fetcher::fetch_json(endpoint);
         if(!json_content)
         {
-            std::cerr << "Failed to fetch articles from " << endpoint << std::endl;
+            LOG_ERROR("Failed to fetch articles from {}", endpoint);
             return false;
         }
 
         int inserted = parse_and_insert(*json_content);
         if(!inserted)
         {
-            std::cerr << "Failed to parse and insert articles\n";
+            LOG_ERROR("Failed to parse and insert articles");
             return false;
         }
 
-        std::cout << "Successfully inserted " << inserted << " articles\n";
+        LOG_INFO("Successfully inserted {} articles", inserted);
         return inserted > 0;
     }
 
     int ArticleManager::parse_and_insert(std::string_view json_content)
     {
+        Tracing::Trace trace("article_ingest");
+        OCU_PROBE(ingest__start, "articles");
         try
         {
             auto insert_start = std::chrono::steady_clock::now();
 
 
+            Tracing::Span parse_span("parse");
             auto json_array = json::parse(json_content);
+            parse_span.end();
             if(!json_array.is_array())
             {
-                std::cerr << "Failed to parse article json content\n";
+                LOG_ERROR("Failed to parse article json content");
                 return -1;
             }
 
             int inserted = 0;
 
-            std::cout << "Parsed " << json_array.size() << "artices\n";
+            LOG_INFO("Parsed {}artices", json_array.size());
 
 
+            Tracing::Span insert_span("insert");
             for(const auto& item : json_array)
             {
                 Article article;
@@ -65,17 +81,22 @@ namespace Articles
                 if(insert_article(article))
                     inserted++;
             }
+            insert_span.end();
+            OCU_PROBE(ingest__done, "articles", inserted);
 
             auto insert_end = std::chrono::steady_clock::now();
             auto total = std::chrono::duration_cast<std::chrono::microseconds>(insert_end - insert_start).count();
-            std::cout << "Total time to inesert in microseconds: " << total << std::endl;
-            std::cout << "Inserted " << inserted << " articles\n";
+            LOG_INFO("Total time to inesert in microseconds: {}", total);
+            LOG_INFO("Inserted {} articles", inserted);
+
+            ingested_articles.inc(static_cast<std::uint64_t>(inserted));
+            article_ingest_duration.observe(insert_end - insert_start);
             return inserted;
 
         }
         catch(const json::exception e)
         {
-            std::cerr << "JSON parse error: " << e.what() << '\n';
+            LOG_ERROR("JSON parse error: {}", e.what());
             return -1;
         }
     }
@@ -83,15 +104,18 @@ namespace Articles
 
     bool ArticleManager::insert_article(const Article& article)
     {
+        // An upsert, not INSERT OR REPLACE; see Database::lookup.
         const char* sql = 
                 "INSERT INTO articles (article_id, article_name, article_price) "
-                "VALUES (?, ?, ?);";    
-
-        sqlite3_stmt* stmt;
+                "VALUES (?, ?, ?) "
+                "ON CONFLICT(article_id) DO UPDATE SET "
+                "article_name = excluded.article_name, article_price = excluded.article_price;";    
 
-        if(sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        auto statement = db_.prepare(sql);
+        sqlite3_stmt* stmt = statement.get();
+        if(!stmt)
         {
-            std::cerr << "Failed to prepare articles: " << sqlite3_errmsg(db_) << std::endl;
+            LOG_ERROR("Failed to prepare articles: {}", sqlite3_errmsg(db_.get()));
             return false;
         }
 
@@ -103,10 +127,9 @@ namespace Articles
 
         if(!success)
         {
-            std::cerr << "Failed to bind stmt articles\n";
+            LOG_ERROR("Failed to bind stmt articles");
             return false;
         }
-        sqlite3_finalize(stmt);
         return success;
     }
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include <string_view>
 #include <string>
 #include <memory>
-#include "include/sqlite3.h"
+#include "database.hpp"
 
 namespace Articles
 {
@@ -18,12 +18,12 @@ namespace Articles
     class ArticleManager
     {
     public:
-        explicit ArticleManager(sqlite3* db);
+        explicit ArticleManager(Database& db);
 
         [[nodiscard]] bool fetch_and_store(std::string_view endpoint);
         [[nodiscard]] int parse_and_insert(std::string_view json_content);
     private:
-        sqlite3* db_;
+        Database& db_;
         [[nodiscard]] bool insert_article(const Article& article);
     };
 
@@ -0,0 +1,465 @@
+#include "audit_partitions.hpp"
+#include "datetime.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace
+{
+    auto& partitions_open = Metrics::registry().gauge(
+        "ocu_audit_partitions_open", "Daily audit partition files attached to the writer connection");
+    auto& partitions_compressed = Metrics::registry().counter(
+        "ocu_audit_partitions_compressed_total", "Closed audit partition files gzipped");
+    auto& partitions_deleted = Metrics::registry().counter(
+        "ocu_audit_partitions_deleted_total", "Audit partition files deleted after the retention period");
+
+    constexpr std::string_view prefix = "audit-";
+    constexpr std::string_view suffix = ".db";
+    constexpr std::string_view compressed_suffix = ".db.gz";
+
+    // SQLite attaches at most 10 files to a connection unless built for more.
+    constexpr std::size_t report_batch = 8;
+
+    // The same columns as the main file's audit tables, plus the journal
+    // segments compacted into this file.
+    constexpr std::array<std::string_view, 4> tables =
+    {
+        "card_validated(id INTEGER PRIMARY KEY AUTOINCREMENT, datetime TEXT DEFAULT(datetime('now','localtime')), "
+        "card_id INTEGER, valid INTEGER);",
+        "qr_validated(id INTEGER PRIMARY KEY AUTOINCREMENT, datetime TEXT DEFAULT(datetime('now','localtime')), "
+        "qr_code TEXT, validator_id INTEGER, valid INTEGER);",
+        "purchases(id INTEGER PRIMARY KEY AUTOINCREMENT, article_id INTEGER, card_number TEXT, quantity INTEGER, "
+        "success INTEGER, timestamp TEXT);",
+        "journal_segments(sequence INTEGER PRIMARY KEY, rows INTEGER, compacted_at TEXT DEFAULT(datetime('now','localtime')));",
+    };
+
+    std::int64_t unix_now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // YYYY-MM-DD in local time; such days also sort as text.
+    std::string day_of(std::int64_t epoch)
+    {
+        return DateTime::format_local(epoch).substr(0, 10);
+    }
+
+    std::string schema_of(std::string_view day)
+    {
+        std::string schema = "audit_";
+        for (char c : day)
+            if (c != '-')
+                schema += c;
+        return schema;
+    }
+
+    struct PartitionFile
+    {
+        std::string day;
+        std::filesystem::path path;
+        bool compressed;
+    };
+
+    std::optional<PartitionFile> parse_name(const std::filesystem::path& path)
+    {
+        std::string name = path.filename().string();
+        bool compressed = name.ends_with(compressed_suffix);
+        if (!name.starts_with(prefix) || !(compressed || name.ends_with(suffix)))
+            return std::nullopt;
+
+        std::string day = name.substr(prefix.size(), name.size() - prefix.size()
+                                      - (compressed ? compressed_suffix.size() : suffix.size()));
+        bool well_formed = day.size() == 10 && day[4] == '-' && day[7] == '-'
+            && std::all_of(day.begin(), day.end(), [](char c) { return c == '-' || (c >= '0' && c <= '9'); });
+        if (!well_formed)
+            return std::nullopt;
+        return PartitionFile{std::move(day), path, compressed};
+    }
+
+    std::vector<PartitionFile> list_partitions(const std::filesystem::path& directory)
+    {
+        std::vector<PartitionFile> found;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec))
+        {
+            if (!entry.is_regular_file())
+                continue;
+            if (auto file = parse_name(entry.path()))
+                found.push_back(std::move(*file));
+        }
+        if (ec)
+            LOG_WARN("[Partitions] Cannot read {}: {}", directory.string(), ec.message());
+        std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.path < b.path; });
+        return found;
+    }
+
+    // Written beside `to` and renamed once on disk, so a crash never
+    // leaves a truncated archive under the final name.
+    bool gzip_file(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+        std::FILE* in = std::fopen(from.c_str(), "rb");
+        if (!in)
+            return false;
+
+        auto partial = to;
+        partial += ".part";
+        int fd = ::open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        gzFile out = fd >= 0 ? gzdopen(fd, "wb") : nullptr;
+        bool ok = out != nullptr;
+        if (!out && fd >= 0)
+            ::close(fd);
+
+        std::vector<char> buffer(1 << 16);
+        while (ok)
+        {
+            std::size_t read = std::fread(buffer.data(), 1, buffer.size(), in);
+            if (read == 0)
+            {
+                ok = !std::ferror(in);
+                break;
+            }
+            ok = gzwrite(out, buffer.data(), static_cast<unsigned>(read)) == static_cast<int>(read);
+        }
+        std::fclose(in);
+
+        if (out)
+        {
+            ok = ok && gzflush(out, Z_FINISH) == Z_OK && fsync(fd) == 0;
+            ok = gzclose(out) == Z_OK && ok;
+        }
+
+        std::error_code ec;
+        if (ok)
+            std::filesystem::rename(partial, to, ec);
+        if (!ok || ec)
+        {
+            std::filesystem::remove(partial, ec);
+            return false;
+        }
+        return true;
+    }
+
+    bool gunzip_file(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+        gzFile in = gzopen(from.c_str(), "rb");
+        if (!in)
+            return false;
+        std::FILE* out = std::fopen(to.c_str(), "wb");
+        bool ok = out != nullptr;
+
+        std::vector<char> buffer(1 << 16);
+        while (ok)
+        {
+            int read = gzread(in, buffer.data(), static_cast<unsigned>(buffer.size()));
+            if (read <= 0)
+            {
+                ok = read == 0;
+                break;
+            }
+            ok = std::fwrite(buffer.data(), 1, static_cast<std::size_t>(read), out) == static_cast<std::size_t>(read);
+        }
+        gzclose(in);
+        if (out)
+            ok = std::fclose(out) == 0 && ok;
+        return ok;
+    }
+
+    struct DayTotals
+    {
+        std::int64_t cards = 0;
+        std::int64_t cards_valid = 0;
+        std::int64_t qrs = 0;
+        std::int64_t qrs_valid = 0;
+        std::int64_t purchases = 0;
+        std::int64_t purchases_done = 0;
+    };
+
+    // One query over the audit tables of every schema in `schemas`.
+    bool add_totals(Database& db, const std::vector<std::string>& schemas, std::string_view from, std::string_view to,
+                    std::map<std::string, DayTotals>& days)
+    {
+        std::string rows;
+        for (const auto& schema : schemas)
+        {
+            if (!rows.empty())
+                rows += " UNION ALL ";
+            rows += "SELECT substr(datetime, 1, 10) AS day, 1 AS cards, valid AS cards_valid, 0 AS qrs, "
+                    "0 AS qrs_valid, 0 AS purchases, 0 AS purchases_done FROM " + schema + ".card_validated"
+                    " UNION ALL SELECT substr(datetime, 1, 10), 0, 0, 1, valid, 0, 0 FROM " + schema + ".qr_validated"
+                    " UNION ALL SELECT substr(timestamp, 1, 10), 0, 0, 0, 0, 1, success FROM " + schema + ".purchases";
+        }
+        std::string sql = "SELECT day, sum(cards), sum(cards_valid), sum(qrs), sum(qrs_valid), sum(purchases), "
+                          "sum(purchases_done) FROM (" + rows + ") WHERE day BETWEEN ?1 AND ?2 GROUP BY day;";
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db.get(), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            LOG_ERROR("[Partitions] Cannot query audit rows: {}", sqlite3_errmsg(db.get()));
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, from.data(), static_cast<int>(from.size()), SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, to.data(), static_cast<int>(to.size()), SQLITE_STATIC);
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            auto& totals = days[reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))];
+            totals.cards += sqlite3_column_int64(stmt, 1);
+            totals.cards_valid += sqlite3_column_int64(stmt, 2);
+            totals.qrs += sqlite3_column_int64(stmt, 3);
+            totals.qrs_valid += sqlite3_column_int64(stmt, 4);
+            totals.purchases += sqlite3_column_int64(stmt, 5);
+            totals.purchases_done += sqlite3_column_int64(stmt, 6);
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE)
+            LOG_ERROR("[Partitions] Audit query failed: {}", sqlite3_errmsg(db.get()));
+        return rc == SQLITE_DONE;
+    }
+}
+
+AuditPartitions::AuditPartitions(Database& db, Policy policy)
+    : db_(db)
+    , policy_(std::move(policy))
+{
+    std::error_code ec;
+    std::filesystem::create_directories(policy_.directory, ec);
+    if (ec)
+        throw std::runtime_error("Cannot create audit partition directory " + policy_.directory.string() + ": " + ec.message());
+
+    LOG_INFO("[Partitions] Daily audit files in {}, {}, {}", policy_.directory.string(),
+             policy_.retention_days > 0 ? "kept " + std::to_string(policy_.retention_days) + " days" : "kept forever",
+             policy_.compress ? "gzipped once closed" : "not compressed");
+}
+
+AuditPartitions::~AuditPartitions()
+{
+    for (const auto& partition : open_)
+        db_.detach(partition.schema);
+    partitions_open.set(0);
+}
+
+std::string AuditPartitions::schema_for(std::int64_t at)
+{
+    std::string day = day_of(at);
+    for (auto& partition : open_)
+    {
+        if (partition.day == day)
+        {
+            partition.written = true;
+            return partition.schema;
+        }
+    }
+
+    std::string today = day_of(unix_now());
+    if (day != today && std::filesystem::exists(policy_.directory / (std::string(prefix) + day + std::string(compressed_suffix))))
+        return schema_for(unix_now());
+
+    if (!open(day))
+        return "main";
+    open_.back().written = true;
+    return open_.back().schema;
+}
+
+bool AuditPartitions::open(const std::string& day)
+{
+    auto path = policy_.directory / (std::string(prefix) + day + std::string(suffix));
+    std::string schema = schema_of(day);
+    if (!db_.attach(path.string(), schema))
+        return false;
+
+    bool created;
+    {
+        Database::Transaction transaction(db_);
+        created = static_cast<bool>(transaction);
+        for (auto table : tables)
+        {
+            if (!created)
+                break;
+            std::string sql = "CREATE TABLE IF NOT EXISTS " + schema + "." + std::string(table);
+            created = sqlite3_exec(db_.get(), sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+        }
+        if (!created)
+            LOG_ERROR("[Partitions] Cannot create tables in {}: {}", path.string(), sqlite3_errmsg(db_.get()));
+        created = created && transaction.commit() == SQLITE_OK;
+    }
+    if (!created)
+    {
+        db_.detach(schema);
+        return false;
+    }
+
+    open_.push_back({day, std::move(schema), false});
+    partitions_open.set(static_cast<double>(open_.size()));
+    LOG_INFO("[Partitions] Opened {}", path.filename().string());
+    return true;
+}
+
+void AuditPartitions::maintain(std::chrono::steady_clock::time_point now)
+{
+    if (now < next_sweep_)
+        return;
+    next_sweep_ = now + std::chrono::minutes(1);
+
+    // A past day stays open until a whole sweep interval passes without a
+    // row for it, so rows queued just before midnight still land in it.
+    std::string today = day_of(unix_now());
+    for (auto it = open_.begin(); it != open_.end();)
+    {
+        if (it->day != today && !std::exchange(it->written, false) && db_.detach(it->schema))
+        {
+            LOG_INFO("[Partitions] Closed {}{}{}", prefix, it->day, suffix);
+            it = open_.erase(it);
+        }
+        else
+            ++it;
+    }
+    partitions_open.set(static_cast<double>(open_.size()));
+
+    sweep(today);
+}
+
+void AuditPartitions::sweep(std::string_view today)
+{
+    std::string oldest_kept = policy_.retention_days > 0
+        ? day_of(unix_now() - std::int64_t{policy_.retention_days} * 86400) : std::string();
+
+    // One compression per sweep: it runs on the audit thread, which holds
+    // its rows meanwhile.
+    bool compressed = false;
+    for (const auto& file : list_partitions(policy_.directory))
+    {
+        bool is_open = std::any_of(open_.begin(), open_.end(), [&](const auto& partition) { return partition.day == file.day; });
+        if (is_open)
+            continue;
+
+        if (!oldest_kept.empty() && file.day < oldest_kept)
+        {
+            std::error_code ec;
+            std::filesystem::remove(file.path, ec);
+            if (ec)
+            {
+                LOG_WARN("[Partitions] Cannot delete {}: {}", file.path.string(), ec.message());
+                continue;
+            }
+            for (const char* log : {"-wal", "-shm"})
+                std::filesystem::remove(file.path.string() + log, ec);
+            partitions_deleted.inc();
+            LOG_INFO("[Partitions] Deleted {}, older than {} days", file.path.filename().string(), policy_.retention_days);
+        }
+        else if (policy_.compress && !compressed && !file.compressed && file.day < today)
+        {
+            compressed = compress(file.path);
+        }
+    }
+}
+
+bool AuditPartitions::compress(const std::filesystem::path& path)
+{
+    // A log left by a crash holds committed rows: attaching and detaching
+    // the file once checkpoints them into it.
+    std::string log = path.string() + "-wal";
+    if (std::filesystem::exists(log))
+    {
+        if (!db_.attach(path.string(), "audit_recovered") || !db_.detach("audit_recovered"))
+            return false;
+        if (std::filesystem::exists(log))
+        {
+            LOG_WARN("[Partitions] Not compressing {}: its log is still in use", path.filename().string());
+            return false;
+        }
+    }
+
+    auto archive = path;
+    archive += ".gz";
+    if (!gzip_file(path, archive))
+    {
+        LOG_ERROR("[Partitions] Cannot compress {}", path.string());
+        return false;
+    }
+
+    std::error_code ec;
+    auto bytes = std::filesystem::file_size(path, ec);
+    auto archive_bytes = std::filesystem::file_size(archive, ec);
+    std::filesystem::remove(path, ec);
+    partitions_compressed.inc();
+    LOG_INFO("[Partitions] Compressed {}: {} KiB to {} KiB", path.filename().string(), bytes / 1024, archive_bytes / 1024);
+    return true;
+}
+
+bool AuditPartitions::report(Database& db, const std::filesystem::path& directory,
+                             std::string_view from, std::string_view to, std::ostream& out)
+{
+    std::vector<PartitionFile> files;
+    for (auto& file : list_partitions(directory))
+        if (file.day >= from && file.day <= to)
+            files.push_back(std::move(file));
+
+    // Rows written before partitioning was turned on are still in main.
+    std::map<std::string, DayTotals> days;
+    bool ok = add_totals(db, {"main"}, from, to, days);
+
+    for (std::size_t first = 0; ok && first < files.size(); first += report_batch)
+    {
+        std::vector<std::string> schemas;
+        std::vector<std::filesystem::path> unpacked;
+        for (std::size_t i = first; i < std::min(files.size(), first + report_batch); ++i)
+        {
+            auto path = files[i].path;
+            if (files[i].compressed)
+            {
+                auto copy = std::filesystem::temp_directory_path() / ("ocu-report-" + files[i].day + ".db");
+                if (!gunzip_file(path, copy))
+                {
+                    LOG_ERROR("[Partitions] Cannot decompress {}", path.string());
+                    ok = false;
+                    break;
+                }
+                unpacked.push_back(copy);
+                path = copy;
+            }
+
+            std::string schema = "report_" + std::to_string(i - first);
+            if (!db.attach(path.string(), schema))
+            {
+                ok = false;
+                break;
+            }
+            schemas.push_back(std::move(schema));
+        }
+
+        ok = ok && add_totals(db, schemas, from, to, days);
+        for (const auto& schema : schemas)
+            db.detach(schema);
+        std::error_code ec;
+        for (const auto& copy : unpacked)
+            for (const char* end : {"", "-wal", "-shm"})
+                std::filesystem::remove(copy.string() + end, ec);
+    }
+
+    out << files.size() << " partition files from " << from << " to " << to << " in " << directory.string() << "\n";
+    out << "day          card taps    valid    QR scans    valid   purchases   done\n";
+    for (const auto& [day, totals] : days)
+    {
+        char line[120];
+        std::snprintf(line, sizeof(line), "%-10s %11lld %8lld %11lld %8lld %11lld %6lld\n", day.c_str(),
+                      static_cast<long long>(totals.cards), static_cast<long long>(totals.cards_valid),
+                      static_cast<long long>(totals.qrs), static_cast<long long>(totals.qrs_valid),
+                      static_cast<long long>(totals.purchases), static_cast<long long>(totals.purchases_done));
+        out << line;
+    }
+    return ok;
+}
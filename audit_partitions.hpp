@@ -0,0 +1,74 @@
+#pragma once
+
+#include "database.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The audit tables in one SQLite file per local day,
+// audit-YYYY-MM-DD.db under `directory`, so the main file keeps only
+// reference data and its checkpoints, backups and inserts stay as quick
+// as on the first day.
+//
+// A day's file is ATTACHed to the writer connection when the first row
+// for that day is written. It is DETACHed once the day is over and a
+// sweep (at most one a minute) found no row written to it since the
+// last. Closed days are gzipped to audit-YYYY-MM-DD.db.gz if `compress`
+// is set, and deleted once more than `retention_days` old (0 keeps
+// them). A row for a day already compressed goes to today's file.
+//
+// Used by the audit writer thread only.
+class AuditPartitions
+{
+public:
+    struct Policy
+    {
+        std::filesystem::path directory;
+        int retention_days;
+        bool compress;
+    };
+
+    // Throws std::runtime_error when the directory cannot be created.
+    AuditPartitions(Database& db, Policy policy);
+    ~AuditPartitions();
+
+    AuditPartitions(const AuditPartitions&) = delete;
+    AuditPartitions& operator=(const AuditPartitions&) = delete;
+
+    // The schema for rows queued at `at` (Unix seconds), attaching its
+    // file first if needed; "main" when no partition file can be opened.
+    // Call between transactions.
+    [[nodiscard]] std::string schema_for(std::int64_t at);
+
+    // Closes, compresses and deletes partitions that are due.
+    void maintain(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Validations and purchases per day from `from` to `to` (YYYY-MM-DD,
+    // inclusive), read from the partitions of those days alone, compressed
+    // ones included, and from rows the main file holds from before
+    // partitioning. False if a query failed.
+    static bool report(Database& db, const std::filesystem::path& directory,
+                       std::string_view from, std::string_view to, std::ostream& out);
+
+private:
+    struct Partition
+    {
+        std::string day;
+        std::string schema;
+        bool written;  // since the last sweep
+    };
+
+    [[nodiscard]] bool open(const std::string& day);
+    void sweep(std::string_view today);
+    bool compress(const std::filesystem::path& path);
+
+    Database& db_;
+    Policy policy_;
+    std::vector<Partition> open_;
+    std::chrono::steady_clock::time_point next_sweep_;
+};
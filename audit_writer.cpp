@@ -0,0 +1,495 @@
+#include "audit_writer.hpp"
+#include "datetime.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "probes.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+    auto& card_rows = Metrics::registry().counter(
+        "ocu_audit_rows_total", "Audit rows committed by the writer thread, by table", "table=\"card_validated\"");
+    auto& qr_rows = Metrics::registry().counter(
+        "ocu_audit_rows_total", "Audit rows committed by the writer thread, by table", "table=\"qr_validated\"");
+    auto& purchase_rows = Metrics::registry().counter(
+        "ocu_audit_rows_total", "Audit rows committed by the writer thread, by table", "table=\"purchases\"");
+    auto& audit_batches = Metrics::registry().counter(
+        "ocu_audit_batches_total", "Audit transactions committed");
+    auto& audit_failures = Metrics::registry().counter(
+        "ocu_audit_commit_failures_total", "Audit batches that failed and were kept for a retry");
+    auto& audit_queued = Metrics::registry().gauge(
+        "ocu_audit_queue_depth", "Audit rows queued but not yet committed");
+    auto& audit_commit_duration = Metrics::registry().histogram(
+        "ocu_audit_commit_duration_seconds", "Duration of audit batches, BEGIN to COMMIT");
+
+    // Longest wait before retrying after failed commits; the wait doubles
+    // from the flush interval on each failure in a row.
+    constexpr auto max_retry_delay = std::chrono::milliseconds(2000);
+
+    // The tables' own defaults use datetime('now','localtime'): a space,
+    // not a 'T', between date and time.
+    std::array<char, DateTime::text_size> sqlite_local_time(std::int64_t epoch) noexcept
+    {
+        std::array<char, DateTime::text_size> text;
+        DateTime::format_local(epoch, text.data());
+        text[10] = ' ';
+        return text;
+    }
+
+    // `sql` with its "{}" replaced by the schema and a dot, or by nothing
+    // for main, so the main tables keep their unqualified statements.
+    std::string format_sql(std::string_view schema, std::string_view sql)
+    {
+        std::string text(sql);
+        text.replace(text.find("{}"), 2, schema == "main" ? std::string() : std::string(schema) + ".");
+        return text;
+    }
+
+    std::optional<ValidationJournal::Record> to_record(const AuditWriter::Row& row, std::int64_t at) noexcept
+    {
+        using Kind = ValidationJournal::Kind;
+
+        ValidationJournal::Record record{};
+        record.at = at;
+        std::string_view key;
+        if (const auto* card = std::get_if<AuditWriter::CardValidation>(&row))
+        {
+            record.kind = Kind::Card;
+            record.valid = card->valid;
+            key = card->card_number;
+        }
+        else if (const auto* qr = std::get_if<AuditWriter::QrValidation>(&row))
+        {
+            record.kind = Kind::Qr;
+            record.valid = qr->valid;
+            record.number = qr->validator_id;
+            key = qr->token;
+        }
+        else
+        {
+            const auto& sale = std::get<AuditWriter::Purchase>(row);
+            record.kind = Kind::Purchase;
+            record.valid = sale.success;
+            record.number = sale.article_id;
+            record.quantity = sale.quantity;
+            key = sale.card_number;
+        }
+
+        if (key.size() > ValidationJournal::max_key_size)
+            return std::nullopt;
+        record.key_size = static_cast<std::uint8_t>(key.size());
+        std::copy(key.begin(), key.end(), record.key.begin());
+        return record;
+    }
+
+    AuditWriter::Row from_record(const ValidationJournal::Record& record)
+    {
+        std::string key(record.key_view());
+        switch (record.kind)
+        {
+        case ValidationJournal::Kind::Card:
+            return AuditWriter::CardValidation{std::move(key), record.valid != 0};
+        case ValidationJournal::Kind::Qr:
+            return AuditWriter::QrValidation{std::move(key), record.number, record.valid != 0};
+        default:
+            return AuditWriter::Purchase{record.number, std::move(key), record.quantity, record.valid != 0};
+        }
+    }
+}
+
+AuditWriter::AuditWriter(Database& db, Policy policy)
+    : db_(db)
+    , policy_(policy)
+{
+    if (policy_.batch_rows == 0)
+        policy_.batch_rows = 1;
+    batch_.reserve(policy_.batch_rows);
+    wake_rows_ = policy_.durability == Database::Durability::Strict ? 1 : policy_.batch_rows;
+
+    if (policy_.journal && policy_.durability == Database::Durability::Strict)
+    {
+        LOG_WARN("[Audit] Strict durability replies after the commit; the journal is not used");
+        policy_.journal.reset();
+    }
+    if (policy_.journal)
+    {
+        // Numbered past every segment already compacted, so none is
+        // mistaken for one on replay.
+        std::uint64_t next_sequence = 1;
+        auto statement = db_.prepare("SELECT max(sequence) FROM journal_segments;");
+        if (statement && sqlite3_step(statement.get()) == SQLITE_ROW)
+            next_sequence = static_cast<std::uint64_t>(sqlite3_column_int64(statement.get(), 0)) + 1;
+        statement.reset();
+        journal_ = std::make_unique<ValidationJournal>(*policy_.journal, next_sequence);
+    }
+    if (policy_.partitions)
+        partitions_ = std::make_unique<AuditPartitions>(db_, *policy_.partitions);
+}
+
+AuditWriter::~AuditWriter()
+{
+    stop();
+}
+
+void AuditWriter::start()
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (running_)
+            return;
+        running_ = true;
+    }
+
+    thread_ = std::thread(&AuditWriter::run, this);
+    LOG_INFO("[Audit] Writer started: {} durability, every {} ms or {} rows{}{}",
+             Database::durability_name(policy_.durability), policy_.flush_interval.count(),
+             policy_.batch_rows, journal_ ? ", journaled" : "", partitions_ ? ", partitioned by day" : "");
+}
+
+void AuditWriter::stop()
+{
+    {
+        std::lock_guard lock(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+
+    // The thread is gone; write what the last requests queued.
+    flush();
+    if (std::size_t left = queued_.load(std::memory_order_relaxed); left > 0)
+        LOG_ERROR("[Audit] {} rows could not be written", left);
+
+    if (journal_)
+    {
+        journal_->maintain(ValidationJournal::Clock::now(), true);
+        compact();
+        if (!segments_.empty())
+            LOG_ERROR("[Audit] {} journal segments left for the next start", segments_.size());
+    }
+}
+
+void AuditWriter::write(Row row, Done done)
+{
+    std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    bool strict = policy_.durability == Database::Durability::Strict;
+    if (journal_)
+    {
+        auto record = to_record(row, now);
+        if (record && journal_->append(*record))
+        {
+            if (done)
+                done(true);
+            return;
+        }
+    }
+
+    if (strict)
+        queue_.push({std::move(row), now, std::move(done)});
+    else
+    {
+        queue_.push({std::move(row), now, {}});
+        if (done)
+            done(true);
+    }
+
+    std::size_t queued = queued_.fetch_add(1, std::memory_order_relaxed) + 1;
+    audit_queued.set(static_cast<double>(queued));
+    if (queued != wake_rows_)
+        return;
+
+    // A caller waiting on the commit cannot afford a lost wake, so strict
+    // mode passes through the lock to order the wake after the thread's
+    // check. Otherwise a missed wake only means a flush at the end of the
+    // interval.
+    if (strict)
+    {
+        std::lock_guard lock(mutex_);
+    }
+    wake_.notify_one();
+}
+
+void AuditWriter::run()
+{
+    Tracing::name_thread("audit");
+
+    // After a failed commit the kept batch still counts as queued, so the
+    // wake condition holds at once; the thread sleeps the whole delay
+    // instead of spinning on an error that persists (disk full, read-only).
+    auto retry_delay = std::chrono::milliseconds::zero();
+    std::unique_lock lock(mutex_);
+    while (running_)
+    {
+        if (retry_delay > retry_delay.zero())
+            wake_.wait_for(lock, retry_delay, [this] { return !running_; });
+        else
+            wake_.wait_for(lock, policy_.flush_interval, [this]
+            {
+                return !running_ || queued_.load(std::memory_order_relaxed) >= wake_rows_;
+            });
+
+        lock.unlock();
+        bool committed = flush();
+        if (journal_)
+        {
+            journal_->maintain();
+            committed = compact() && committed;
+        }
+        if (committed)
+            retry_delay = retry_delay.zero();
+        else
+            retry_delay = std::min<std::chrono::milliseconds>(
+                std::max<std::chrono::milliseconds>(retry_delay * 2, policy_.flush_interval), max_retry_delay);
+        if (partitions_)
+            partitions_->maintain();
+        lock.lock();
+    }
+}
+
+bool AuditWriter::flush()
+{
+    for (;;)
+    {
+        while (batch_.size() < policy_.batch_rows)
+        {
+            auto entry = queue_.pop();
+            if (!entry)
+                break;
+            batch_.push_back(std::move(*entry));
+        }
+        if (batch_.empty())
+            return true;
+
+        bool full = batch_.size() == policy_.batch_rows;
+        if (!commit(batch_))
+        {
+            audit_failures.inc();
+            drop_waiting();
+            return false;
+        }
+
+        std::size_t left = queued_.fetch_sub(batch_.size(), std::memory_order_relaxed) - batch_.size();
+        audit_queued.set(static_cast<double>(left));
+        batch_.clear();
+
+        // A full batch may have more behind it.
+        if (!full)
+            return true;
+    }
+}
+
+void AuditWriter::drop_waiting()
+{
+    // Callers waiting on a strict commit are told it failed; their rows
+    // are not written later behind their back.
+    auto waiting = std::stable_partition(batch_.begin(), batch_.end(), [](const Entry& entry)
+    {
+        return !entry.done;
+    });
+    std::size_t dropped = static_cast<std::size_t>(batch_.end() - waiting);
+    if (dropped == 0)
+        return;
+
+    for (auto it = waiting; it != batch_.end(); ++it)
+        it->done(false);
+    batch_.erase(waiting, batch_.end());
+    std::size_t left = queued_.fetch_sub(dropped, std::memory_order_relaxed) - dropped;
+    audit_queued.set(static_cast<double>(left));
+}
+
+bool AuditWriter::compact()
+{
+    for (auto& segment : journal_->take_sealed())
+        segments_.push_back(std::move(segment));
+
+    std::vector<Entry> rows;
+    while (!segments_.empty())
+    {
+        const auto& segment = segments_.front();
+        auto records = segment->records();
+        rows.clear();
+        rows.reserve(records.size());
+        for (const auto& record : records)
+            rows.push_back({from_record(record), record.at, {}});
+
+        if (!commit(rows, segment->sequence()))
+        {
+            audit_failures.inc();
+            return false;
+        }
+        LOG_DEBUG("[Audit] Compacted journal segment {}: {} rows", segment->sequence(), rows.size());
+        segment->remove();
+        segments_.pop_front();
+    }
+    return true;
+}
+
+bool AuditWriter::insert(const std::string& schema, const std::vector<const Entry*>& entries,
+                         std::uint64_t& cards, std::uint64_t& qrs, std::uint64_t& purchases)
+{
+    // Checked out once for the whole batch; each row only rebinds them.
+    auto card = db_.prepare(format_sql(schema, "INSERT INTO {}card_validated (card_id, valid, datetime) VALUES (?, ?, ?);"));
+    auto qr = db_.prepare(format_sql(schema,
+        "INSERT INTO {}qr_validated (qr_code, validator_id, valid, datetime) VALUES (?, ?, ?, ?);"));
+    auto purchase = db_.prepare(format_sql(schema,
+        "INSERT INTO {}purchases (article_id, card_number, quantity, success, timestamp) VALUES (?, ?, ?, ?, ?);"));
+    if (!card || !qr || !purchase)
+    {
+        LOG_ERROR("[Audit] Failed to prepare statements: {}", sqlite3_errmsg(db_.get()));
+        return false;
+    }
+
+    for (const Entry* entry : entries)
+    {
+        auto time = sqlite_local_time(entry->queued_at);
+        int time_size = static_cast<int>(time.size());
+        sqlite3_stmt* stmt = nullptr;
+
+        if (const auto* row = std::get_if<CardValidation>(&entry->row))
+        {
+            stmt = card.get();
+            sqlite3_bind_text(stmt, 1, row->card_number.data(), static_cast<int>(row->card_number.size()), SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 2, row->valid ? 1 : 0);
+            sqlite3_bind_text(stmt, 3, time.data(), time_size, SQLITE_STATIC);
+            ++cards;
+        }
+        else if (const auto* row = std::get_if<QrValidation>(&entry->row))
+        {
+            stmt = qr.get();
+            sqlite3_bind_text(stmt, 1, row->token.data(), static_cast<int>(row->token.size()), SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 2, row->validator_id);
+            sqlite3_bind_int(stmt, 3, row->valid ? 1 : 0);
+            sqlite3_bind_text(stmt, 4, time.data(), time_size, SQLITE_STATIC);
+            ++qrs;
+        }
+        else
+        {
+            const auto& sale = std::get<Purchase>(entry->row);
+            stmt = purchase.get();
+            sqlite3_bind_int(stmt, 1, sale.article_id);
+            sqlite3_bind_text(stmt, 2, sale.card_number.data(), static_cast<int>(sale.card_number.size()), SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 3, sale.quantity);
+            sqlite3_bind_int(stmt, 4, sale.success ? 1 : 0);
+            sqlite3_bind_text(stmt, 5, time.data(), time_size, SQLITE_STATIC);
+            ++purchases;
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            LOG_ERROR("[Audit] Failed to insert audit row: {}", sqlite3_errmsg(db_.get()));
+            return false;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    return true;
+}
+
+bool AuditWriter::commit(const std::vector<Entry>& rows, std::optional<std::uint64_t> segment)
+{
+    // Rows grouped by the schema they go to, the partition of the day each
+    // was queued on; partition files are attached before BEGIN.
+    std::vector<std::pair<std::string, std::vector<const Entry*>>> groups;
+    for (const Entry& entry : rows)
+    {
+        std::string schema = partitions_ ? partitions_->schema_for(entry.queued_at) : "main";
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const auto& g) { return g.first == schema; });
+        if (group == groups.end())
+            group = groups.insert(groups.end(), {std::move(schema), {}});
+        group->second.push_back(&entry);
+    }
+
+    Metrics::ScopedTimer timer(audit_commit_duration);
+
+    Database::Transaction transaction(db_);
+    if (!transaction)
+    {
+        LOG_ERROR("[Audit] Failed to begin transaction: {}", sqlite3_errmsg(db_.get()));
+        return false;
+    }
+
+    // A segment is marked compacted in main, which numbers the segments,
+    // and in every partition it writes to. A commit is only atomic per
+    // file, so after a crash each file's own marker decides whether its
+    // rows are replayed.
+    auto compacted = [&](const std::string& schema, std::size_t count) -> std::optional<bool>
+    {
+        auto marker = db_.prepare(format_sql(schema,
+            "INSERT INTO {}journal_segments (sequence, rows) VALUES (?, ?) "
+            "ON CONFLICT(sequence) DO NOTHING RETURNING sequence;"));
+        if (!marker)
+        {
+            LOG_ERROR("[Audit] Failed to prepare journal marker: {}", sqlite3_errmsg(db_.get()));
+            return std::nullopt;
+        }
+        sqlite3_bind_int64(marker.get(), 1, static_cast<sqlite3_int64>(*segment));
+        sqlite3_bind_int64(marker.get(), 2, static_cast<sqlite3_int64>(count));
+        int rc = sqlite3_step(marker.get());
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+        {
+            LOG_ERROR("[Audit] Failed to record journal segment {}: {}", *segment, sqlite3_errmsg(db_.get()));
+            return std::nullopt;
+        }
+        return rc == SQLITE_DONE;
+    };
+
+    bool main_compacted = false;
+    if (segment)
+    {
+        auto done = compacted("main", rows.size());
+        if (!done)
+            return false;
+        main_compacted = *done;
+    }
+
+    std::uint64_t cards = 0;
+    std::uint64_t qrs = 0;
+    std::uint64_t purchases = 0;
+    std::size_t skipped = 0;
+    for (const auto& [schema, entries] : groups)
+    {
+        if (segment)
+        {
+            auto done = schema == "main" ? std::optional<bool>(main_compacted) : compacted(schema, entries.size());
+            if (!done)
+                return false;
+            if (*done)
+            {
+                skipped += entries.size();
+                continue;
+            }
+        }
+        if (!insert(schema, entries, cards, qrs, purchases))
+            return false;
+    }
+    if (segment && skipped == rows.size())
+    {
+        LOG_INFO("[Audit] Journal segment {} was already compacted", *segment);
+        return true;
+    }
+
+    OCU_PROBE(commit__start);
+    int commit_rc = transaction.commit();
+    OCU_PROBE(commit__done, commit_rc);
+    if (commit_rc != SQLITE_OK)
+    {
+        LOG_ERROR("[Audit] Failed to commit {} rows: {}", rows.size(), sqlite3_errstr(commit_rc));
+        return false;
+    }
+
+    for (const Entry& entry : rows)
+        if (entry.done)
+            entry.done(true);
+
+    card_rows.inc(cards);
+    qr_rows.inc(qrs);
+    purchase_rows.inc(purchases);
+    audit_batches.inc();
+    LOG_DEBUG("[Audit] Committed {} rows", rows.size());
+    return true;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "audit_partitions.hpp"
+#include "database.hpp"
+#include "mpsc_queue.hpp"
+#include "validation_journal.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+// Writes the audit rows (card validations, QR validations and purchases)
+// from one background thread, many rows to a transaction, so a request
+// thread never waits on BEGIN, the busy timeout or a commit.
+//
+// write() only queues the row, lock-free. The thread commits what has
+// queued every `flush_interval`, or as soon as `batch_rows` are waiting,
+// binding each row to the same three statements for the whole batch.
+// Every row keeps the time it was queued, not the time it was committed.
+// A batch that fails to commit is kept and retried after a pause that
+// doubles from the flush interval up to two seconds while commits keep
+// failing; stop() writes whatever is still queued.
+//
+// The durability mode decides when a caller hears back. Group and
+// relaxed report a row as soon as it is queued. Strict reports it only
+// once its batch has committed; such a row wakes the thread at once, and
+// rows queued during one commit share the next.
+//
+// With a journal, write() copies the row into the memory-mapped
+// ValidationJournal instead, and the thread compacts each sealed segment
+// into the tables in one transaction. Rows the journal cannot take (a
+// key too long for a record, no segment file) still go through the
+// queue, as do all rows in strict mode.
+//
+// With partitions, each row goes to the AuditPartitions file of the day
+// it was queued on, and the thread closes, compresses and deletes the
+// files that are due between batches.
+class AuditWriter
+{
+public:
+    struct CardValidation
+    {
+        std::string card_number;
+        bool valid;
+    };
+
+    struct QrValidation
+    {
+        std::string token;
+        int validator_id;
+        bool valid;
+    };
+
+    struct Purchase
+    {
+        int article_id;
+        std::string card_number;
+        int quantity;
+        bool success;
+    };
+
+    using Row = std::variant<CardValidation, QrValidation, Purchase>;
+
+    // Told whether the row was stored; false only in strict mode, when its
+    // batch failed to commit and the row was dropped.
+    using Done = std::function<void(bool stored)>;
+
+    struct Policy
+    {
+        std::chrono::milliseconds flush_interval;
+        std::size_t batch_rows;
+        Database::Durability durability;
+        std::optional<ValidationJournal::Policy> journal;  // unset: queue only
+        std::optional<AuditPartitions::Policy> partitions;  // unset: main file
+    };
+
+    // Throws std::runtime_error when the journal or partition directory is
+    // unusable.
+    AuditWriter(Database& db, Policy policy);
+    ~AuditWriter();
+
+    AuditWriter(const AuditWriter&) = delete;
+    AuditWriter& operator=(const AuditWriter&) = delete;
+
+    void start();
+    void stop();
+
+    // Safe from any thread; never blocks. `done` runs once the row is as
+    // durable as the mode promises: on this thread unless strict, on the
+    // writer thread after the commit if strict.
+    void write(Row row, Done done = {});
+
+private:
+    struct Entry
+    {
+        Row row;
+        std::int64_t queued_at;  // Unix seconds
+        Done done;               // strict mode only
+    };
+
+    void run();
+    // False when a commit failed; its rows are kept for the next pass.
+    bool flush();
+    bool compact();
+    void drop_waiting();  // after a failed commit
+    // Writes `rows` in one transaction; with a journal segment number,
+    // records it as compacted in that transaction, or writes nothing if
+    // it already was.
+    [[nodiscard]] bool commit(const std::vector<Entry>& rows, std::optional<std::uint64_t> segment = std::nullopt);
+    // Inserts `entries` into the tables of `schema`, inside commit()'s
+    // transaction, counting them by table.
+    [[nodiscard]] bool insert(const std::string& schema, const std::vector<const Entry*>& entries,
+                              std::uint64_t& cards, std::uint64_t& qrs, std::uint64_t& purchases);
+
+    Database& db_;
+    Policy policy_;
+
+    MpscQueue<Entry> queue_;
+    std::atomic<std::size_t> queued_{0};
+    std::size_t wake_rows_;  // queued rows that wake the thread early
+    std::vector<Entry> batch_;  // writer thread only
+
+    std::unique_ptr<ValidationJournal> journal_;
+    std::deque<std::shared_ptr<ValidationJournal::Segment>> segments_;  // sealed, writer thread only
+    std::unique_ptr<AuditPartitions> partitions_;  // writer thread only
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool running_ = false;
+    std::thread thread_;
+};
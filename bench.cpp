@@ -0,0 +1,770 @@
+#include "bench.hpp"
+#include "audit_writer.hpp"
+#include "card_index.hpp"
+#include "config.hpp"
+#include "coupons.hpp"
+#include "cuckoo_filter.hpp"
+#include "database.hpp"
+#include "datetime.hpp"
+#include "protocol.hpp"
+#include "qr_codec.hpp"
+#include "include/sqlite3.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Bench
+{
+    namespace
+    {
+        // Makes `value` observable so the optimizer cannot drop the work.
+        template<typename T>
+        void keep(const T& value)
+        {
+            asm volatile("" : : "g"(&value) : "memory");
+        }
+
+        template<typename Fn>
+        double ns_per_op(std::size_t iterations, Fn&& fn)
+        {
+            for (std::size_t i = 0; i < iterations / 10 + 1; ++i)
+                fn(i);
+
+            auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < iterations; ++i)
+                fn(i);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+
+            return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations);
+        }
+
+        void report(std::ostream& out, std::string_view name, double legacy_ns, double current_ns)
+        {
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %-20.*s legacy %9.1f ns/op   current %9.1f ns/op   x%.2f\n",
+                          static_cast<int>(name.size()), name.data(), legacy_ns, current_ns,
+                          current_ns > 0 ? legacy_ns / current_ns : 0.0);
+            out << line;
+        }
+
+        // The request parsing Session did before protocol.cpp: copy out of the
+        // receive buffer, strip CR/LF, trim, then istringstream/getline.
+        std::size_t legacy_parse(std::string_view received)
+        {
+            std::string request(received);
+            request.erase(std::remove_if(request.begin(), request.end(),
+                [](char c) { return c == '\n' || c == '\r'; }), request.end());
+
+            std::string trimmed(request);
+            trimmed.erase(std::remove_if(trimmed.begin(), trimmed.end(),
+                [](unsigned char c) { return c == '\r' || c == '\n'; }), trimmed.end());
+
+            auto start = trimmed.find_first_not_of(" \t");
+            auto end = trimmed.find_last_not_of(" \t");
+            if (start == std::string::npos)
+                return 0;
+            trimmed = trimmed.substr(start, end - start + 1);
+
+            if (trimmed == "FETCH_ARTICLES")
+                return 1;
+
+            if (trimmed.starts_with("PURCHASE "))
+            {
+                auto args = trimmed.substr(9);
+                std::istringstream iss(args);
+                std::string article_id_str, card_number;
+                int quantity;
+                if (!(iss >> article_id_str >> card_number >> quantity))
+                    return 0;
+                return static_cast<std::size_t>(std::stoi(article_id_str)) + card_number.size() + quantity;
+            }
+
+            if (trimmed.starts_with("QR"))
+            {
+                auto args = trimmed.substr(2);
+                std::istringstream iss(args);
+                std::string token, uuid, timestamp, hash;
+                if (std::getline(iss, uuid, '|') && std::getline(iss, token, '|')
+                    && std::getline(iss, timestamp, '|') && std::getline(iss, hash))
+                    return uuid.size() + token.size() + timestamp.size() + hash.size();
+                return 0;
+            }
+
+            bool is_card = std::all_of(trimmed.begin(), trimmed.end(),
+                [](char c) { return std::isdigit(c) || std::isalpha(c); });
+            return is_card ? trimmed.size() : 0;
+        }
+
+        std::size_t current_parse(std::string_view received)
+        {
+            auto parsed = Protocol::parse(received);
+            if (!parsed.ok())
+                return 0;
+
+            if (std::holds_alternative<Protocol::FetchArticles>(parsed.command))
+                return 1;
+            if (const auto* purchase = std::get_if<Protocol::Purchase>(&parsed.command))
+                return static_cast<std::size_t>(purchase->article_id) + purchase->card_number.size() + purchase->quantity;
+            if (const auto* scan = std::get_if<Protocol::QrScan>(&parsed.command))
+                return scan->code.size() + scan->token.size() + scan->ticks.size() + scan->hash.size();
+            if (const auto* tap = std::get_if<Protocol::CardTap>(&parsed.command))
+                return tap->card_number.size();
+            return 0;
+        }
+
+        struct Sample
+        {
+            std::string_view name;
+            std::string_view line;
+        };
+
+        constexpr std::array<Sample, 4> protocol_samples =
+        {{
+            {"FETCH_ARTICLES", "FETCH_ARTICLES\r\n"},
+            {"PURCHASE", "PURCHASE 17 0123456789 2\r\n"},
+            {"QR", "QRKsF-Zet|1488bf99-9b7d-4c25-b00b-22065f12649b|638974309111354660|"
+                   "e279acf941396b65aec32aeca1c0e4bf4b2a9cddc500f99677a9ff7f800ebe75\r\n"},
+            {"card", "0123456789\r\n"},
+        }};
+
+        void run_parse(std::size_t iterations, std::ostream& out)
+        {
+            for (const auto& sample : protocol_samples)
+            {
+                if (legacy_parse(sample.line) != current_parse(sample.line))
+                    out << "  " << sample.name << ": legacy and current parsers disagree\n";
+
+                double legacy = ns_per_op(iterations, [&](std::size_t)
+                {
+                    auto result = legacy_parse(sample.line);
+                    keep(result);
+                });
+                double current = ns_per_op(iterations, [&](std::size_t)
+                {
+                    auto result = current_parse(sample.line);
+                    keep(result);
+                });
+                report(out, sample.name, legacy, current);
+            }
+        }
+
+        constexpr std::string_view qr_payload =
+            "KsF-Zet|1488bf99-9b7d-4c25-b00b-22065f12649b|638974309111354660|"
+            "e279acf941396b65aec32aeca1c0e4bf4b2a9cddc500f99677a9ff7f800ebe75";
+
+        // The QR field split Session did before qr_codec: four getline calls.
+        std::size_t stream_split(std::string_view payload)
+        {
+            std::istringstream iss{std::string(payload)};
+            std::string code, token, ticks, hash;
+            if (std::getline(iss, code, '|') && std::getline(iss, token, '|')
+                && std::getline(iss, ticks, '|') && std::getline(iss, hash))
+                return code.size() + token.size() + ticks.size() + hash.size();
+            return 0;
+        }
+
+        template<std::size_t (*find)(std::string_view, std::size_t*, std::size_t) noexcept>
+        std::size_t codec_split(std::string_view payload)
+        {
+            std::size_t bars[3];
+            if (find(payload, bars, 3) != 3)
+                return 0;
+            return bars[0] + (bars[1] - bars[0] - 1) + (bars[2] - bars[1] - 1) + (payload.size() - bars[2] - 1);
+        }
+
+        void run_qr(std::size_t iterations, std::ostream& out)
+        {
+            out << "  vector path: " << Qr::implementation() << "\n";
+
+            std::string_view token = qr_payload.substr(8, Qr::uuid_text_size);
+            std::string_view hash = qr_payload.substr(qr_payload.size() - Qr::digest_hex_size);
+
+            Qr::Uuid scalar_id{}, vector_id{};
+            Qr::Digest scalar_digest{}, vector_digest{};
+            if (stream_split(qr_payload) != codec_split<Qr::find_delimiters>(qr_payload)
+                || !Qr::scalar::decode_uuid(token, scalar_id) || !Qr::decode_uuid(token, vector_id)
+                || scalar_id != vector_id
+                || !Qr::scalar::decode_hex(hash, scalar_digest.data(), scalar_digest.size())
+                || !Qr::decode_hex(hash, vector_digest.data(), vector_digest.size())
+                || scalar_digest != vector_digest)
+                out << "  scalar and vector paths disagree\n";
+
+            double legacy = ns_per_op(iterations, [&](std::size_t)
+            {
+                auto result = stream_split(qr_payload);
+                keep(result);
+            });
+            double current = ns_per_op(iterations, [&](std::size_t)
+            {
+                auto result = codec_split<Qr::find_delimiters>(qr_payload);
+                keep(result);
+            });
+            report(out, "split (stream)", legacy, current);
+
+            legacy = ns_per_op(iterations, [&](std::size_t)
+            {
+                auto result = codec_split<Qr::scalar::find_delimiters>(qr_payload);
+                keep(result);
+            });
+            report(out, "split (scalar)", legacy, current);
+
+            legacy = ns_per_op(iterations, [&](std::size_t)
+            {
+                bool ok = Qr::scalar::decode_uuid(token, scalar_id);
+                keep(ok);
+                keep(scalar_id);
+            });
+            current = ns_per_op(iterations, [&](std::size_t)
+            {
+                bool ok = Qr::decode_uuid(token, vector_id);
+                keep(ok);
+                keep(vector_id);
+            });
+            report(out, "uuid (scalar)", legacy, current);
+
+            legacy = ns_per_op(iterations, [&](std::size_t)
+            {
+                bool ok = Qr::scalar::decode_hex(hash, scalar_digest.data(), scalar_digest.size());
+                keep(ok);
+                keep(scalar_digest);
+            });
+            current = ns_per_op(iterations, [&](std::size_t)
+            {
+                bool ok = Qr::decode_hex(hash, vector_digest.data(), vector_digest.size());
+                keep(ok);
+                keep(vector_digest);
+            });
+            report(out, "sha256 hex (scalar)", legacy, current);
+        }
+
+        // Card numbers as the ingest stores them: ten digits, some cards
+        // holding an expired coupon before the current one.
+        std::vector<Coupons::CardIndex::Row> synthetic_coupons(std::size_t count)
+        {
+            std::vector<Coupons::CardIndex::Row> rows;
+            rows.reserve(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                char number[16];
+                std::snprintf(number, sizeof(number), "%010zu", (i * 2654435761u) % 10'000'000'000u);
+                bool expired = i % 4 == 0;
+                rows.push_back({number, static_cast<int>(i + 1),
+                                expired ? 1'600'000'000 : 1'700'000'000, expired ? 1'650'000'000 : 4'000'000'000});
+            }
+            return rows;
+        }
+
+        // Percentile of per-lookup times; a single lookup is too short for
+        // one clock read, so each sample times a run of 16.
+        template<typename Fn>
+        void report_latency(std::ostream& out, std::string_view name, std::size_t samples, Fn&& fn)
+        {
+            constexpr std::size_t run = 16;
+            std::vector<double> ns(samples);
+            for (std::size_t i = 0; i < samples; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                for (std::size_t j = 0; j < run; ++j)
+                    fn(i * run + j);
+                ns[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / run;
+            }
+            std::sort(ns.begin(), ns.end());
+
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %-20.*s p50 %9.1f ns   p99 %9.1f ns   max %9.1f ns\n",
+                          static_cast<int>(name.size()), name.data(),
+                          ns[samples / 2], ns[samples * 99 / 100], ns.back());
+            out << line;
+        }
+
+        void run_cards(std::size_t iterations, std::ostream& out)
+        {
+            constexpr std::size_t coupon_count = 1'000'000;
+            auto rows = synthetic_coupons(coupon_count);
+
+            auto build_start = std::chrono::steady_clock::now();
+            Coupons::CardIndex index(rows);
+            out << "  built " << index.cards() << " cards in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - build_start).count()
+                << " ms\n";
+
+            // The SQLite path scans the whole table per tap, so it gets a
+            // handful of lookups against the same rows.
+            Database database(":memory:");
+            sqlite3* db = database.get();
+            sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+            sqlite3_stmt* insert;
+            sqlite3_prepare_v2(db, "INSERT INTO coupons(coupon_id, card_number, valid_from, valid_to, "
+                                   "valid_from_epoch, valid_to_epoch) VALUES (?, ?, ?, ?, ?, ?);",
+                               -1, &insert, nullptr);
+            for (const auto& row : rows)
+            {
+                std::string from = DateTime::format_local(row.valid_from);
+                std::string to = DateTime::format_local(row.valid_to);
+                sqlite3_bind_int(insert, 1, row.coupon_id);
+                sqlite3_bind_text(insert, 2, row.card_number.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_text(insert, 3, from.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_bind_text(insert, 4, to.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_bind_int64(insert, 5, row.valid_from);
+                sqlite3_bind_int64(insert, 6, row.valid_to);
+                sqlite3_step(insert);
+                sqlite3_reset(insert);
+            }
+            sqlite3_finalize(insert);
+            sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+            std::mt19937 rng(7);
+            std::vector<std::size_t> picks(iterations);
+            for (auto& pick : picks)
+                pick = rng() % coupon_count;
+
+            Coupons::CouponManager manager(database);
+            auto legacy_lookup = [&](std::size_t i)
+            {
+                const auto& number = rows[picks[i % picks.size()]].card_number;
+                int coupon_id = 0;
+                if (manager.is_valid_card(number))
+                {
+                    auto coupons = manager.get_coupons_by_card(number);
+                    coupon_id = coupons.empty() ? 0 : coupons[0].coupon_id;
+                }
+                keep(coupon_id);
+            };
+            auto index_lookup = [&](std::size_t i)
+            {
+                auto match = index.find(rows[picks[i % picks.size()]].card_number);
+                keep(match);
+            };
+
+            std::size_t legacy_iterations = std::min<std::size_t>(iterations, 20);
+            double legacy = ns_per_op(legacy_iterations, legacy_lookup);
+            double current = ns_per_op(iterations, index_lookup);
+            report(out, "tap (1M coupons)", legacy, current);
+            report_latency(out, "index lookup", iterations / 16 + 1, index_lookup);
+        }
+
+        // validate_QR's lookup against 10k tickets, compiling the statement
+        // per call as before vs checking it out of Database's cache.
+        void run_statements(std::size_t iterations, std::ostream& out)
+        {
+            constexpr std::size_t ticket_count = 10'000;
+            Database database(":memory:");
+            sqlite3* db = database.get();
+
+            std::vector<std::string> tokens;
+            sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+            sqlite3_stmt* insert;
+            sqlite3_prepare_v2(db, "INSERT INTO tickets(ticket_id, token, valid_from, valid_to, valid_from_epoch, valid_to_epoch) "
+                                   "VALUES (?, ?, ?, ?, 1704067200, 4070908800);",
+                               -1, &insert, nullptr);
+            for (std::size_t i = 0; i < ticket_count; ++i)
+            {
+                char token[64];
+                std::snprintf(token, sizeof(token), "%08zx-0000-4000-8000-%012zx", i, i * 2654435761u);
+                tokens.emplace_back(token);
+                sqlite3_bind_int64(insert, 1, static_cast<sqlite3_int64>(i));
+                sqlite3_bind_text(insert, 2, token, -1, SQLITE_TRANSIENT);
+                sqlite3_bind_text(insert, 3, "2024-01-01T00:00:00", -1, SQLITE_STATIC);
+                sqlite3_bind_text(insert, 4, "2099-01-01T00:00:00", -1, SQLITE_STATIC);
+                sqlite3_step(insert);
+                sqlite3_reset(insert);
+            }
+            sqlite3_finalize(insert);
+            sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+            const char* sql =
+                "SELECT valid_from IS NOT NULL AND valid_to IS NOT NULL, "
+                "?2 BETWEEN valid_from_epoch AND valid_to_epoch, "
+                "valid_from_epoch IS NOT NULL AND valid_to_epoch IS NOT NULL "
+                "FROM tickets WHERE token = ?1;";
+            auto lookup = [&](sqlite3_stmt* stmt, std::size_t i)
+            {
+                const auto& token = tokens[i % tokens.size()];
+                sqlite3_bind_text(stmt, 1, token.data(), static_cast<int>(token.size()), SQLITE_STATIC);
+                sqlite3_bind_int64(stmt, 2, 1'760'000'000);
+                bool found = sqlite3_step(stmt) == SQLITE_ROW;
+                keep(found);
+            };
+
+            double legacy = ns_per_op(iterations, [&](std::size_t i)
+            {
+                sqlite3_stmt* stmt;
+                sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+                lookup(stmt, i);
+                sqlite3_finalize(stmt);
+            });
+            double current = ns_per_op(iterations, [&](std::size_t i)
+            {
+                auto statement = database.prepare(sql);
+                lookup(statement.get(), i);
+            });
+            report(out, "ticket by token", legacy, current);
+        }
+
+        std::uint64_t splitmix(std::uint64_t& state) noexcept
+        {
+            std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // Sized the way TokenFilter::rebuild sizes it: twice the live tokens.
+        void run_filter(std::size_t iterations, std::ostream& out)
+        {
+            constexpr std::size_t token_count = 1'000'000;
+            std::uint64_t state = 11;
+            std::vector<std::uint64_t> known(token_count);
+            for (auto& hash : known)
+                hash = splitmix(state);
+            std::vector<std::uint64_t> unknown(iterations);
+            for (auto& hash : unknown)
+                hash = splitmix(state);
+
+            CuckooFilter filter(2 * token_count);
+            for (auto hash : known)
+            {
+                if (!filter.insert(hash))
+                {
+                    out << "  filter full after " << filter.size() << " tokens\n";
+                    return;
+                }
+            }
+
+            std::size_t false_positives = 0;
+            for (auto hash : unknown)
+                false_positives += filter.contains(hash);
+
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %zu tokens, %zu KiB (%.1f bits/token), FPR expected %.5f%% measured %.5f%%\n",
+                          filter.size(), filter.memory_bytes() / 1024,
+                          8.0 * static_cast<double>(filter.memory_bytes()) / static_cast<double>(filter.size()),
+                          filter.false_positive_rate() * 100.0,
+                          100.0 * static_cast<double>(false_positives) / static_cast<double>(unknown.size()));
+            out << line;
+
+            report_latency(out, "known token", iterations / 16 + 1, [&](std::size_t i)
+            {
+                bool hit = filter.contains(known[i % known.size()]);
+                keep(hit);
+            });
+            report_latency(out, "unknown token", iterations / 16 + 1, [&](std::size_t i)
+            {
+                bool hit = filter.contains(unknown[i % unknown.size()]);
+                keep(hit);
+            });
+        }
+
+        // Validity timestamps spread over 2000-2060, so lookups cross DST
+        // changes and the table's binary search sees varied offsets.
+        void run_datetime(std::size_t iterations, std::ostream& out)
+        {
+            std::mt19937_64 rng(5);
+            std::vector<std::int64_t> epochs(4096);
+            for (auto& epoch : epochs)
+                epoch = 946'684'800 + static_cast<std::int64_t>(rng() % 1'893'456'000);
+
+            std::vector<std::string> texts;
+            texts.reserve(epochs.size());
+            for (auto epoch : epochs)
+                texts.push_back(DateTime::format_local(epoch));
+
+            out << "  " << DateTime::load_zone() << " UTC offset changes cached\n";
+
+            char text[DateTime::text_size];
+            double legacy = ns_per_op(iterations, [&](std::size_t i)
+            {
+                DateTime::libc::format_local(epochs[i % epochs.size()], text);
+                keep(text);
+            });
+            double current = ns_per_op(iterations, [&](std::size_t i)
+            {
+                DateTime::format_local(epochs[i % epochs.size()], text);
+                keep(text);
+            });
+            report(out, "format", legacy, current);
+
+            legacy = ns_per_op(iterations, [&](std::size_t i)
+            {
+                auto epoch = DateTime::libc::parse_local(texts[i % texts.size()]);
+                keep(epoch);
+            });
+            current = ns_per_op(iterations, [&](std::size_t i)
+            {
+                auto epoch = DateTime::parse_local(texts[i % texts.size()]);
+                keep(epoch);
+            });
+            report(out, "parse", legacy, current);
+        }
+
+        void remove_database(const std::filesystem::path& path)
+        {
+            std::error_code ec;
+            for (const char* suffix : {"", "-wal", "-shm"})
+                std::filesystem::remove(path.string() + suffix, ec);
+        }
+
+        void report_durability(std::ostream& out, std::string_view name, std::vector<double>& us,
+                               std::size_t rows, std::chrono::steady_clock::duration elapsed)
+        {
+            std::sort(us.begin(), us.end());
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %-8.*s reply p50 %9.1f us   p99 %9.1f us   %9.0f rows/s stored\n",
+                          static_cast<int>(name.size()), name.data(), us[us.size() / 2], us[us.size() * 99 / 100],
+                          static_cast<double>(rows) / std::chrono::duration<double>(elapsed).count());
+            out << line;
+        }
+
+        // Card validations from 16 validator threads, each waiting for its
+        // reply before the next tap, on a scratch database file. Legacy is
+        // the old tap path: one transaction and a FULL checkpoint per row
+        // on the request thread. Rows/s counts until every row is committed.
+        void run_durability(std::size_t iterations, std::ostream& out)
+        {
+            constexpr std::size_t threads = 16;
+            auto path = std::filesystem::temp_directory_path() / "ocu-bench-durability.db";
+            using Clock = std::chrono::steady_clock;
+
+            {
+                remove_database(path);
+                Database database(path.string());
+                database.set_durability(Database::Durability::Strict);
+                std::size_t rows = std::max<std::size_t>(iterations / 20, 100);
+                std::vector<double> us(rows);
+                auto start = Clock::now();
+                for (std::size_t i = 0; i < rows; ++i)
+                {
+                    auto tap = Clock::now();
+                    Database::Transaction transaction(database);
+                    {
+                        auto statement = database.prepare("INSERT INTO card_validated (card_id, valid) VALUES (?, 1);");
+                        sqlite3_bind_int64(statement.get(), 1, static_cast<sqlite3_int64>(i));
+                        sqlite3_step(statement.get());
+                    }
+                    int rc = transaction.commit();
+                    keep(rc);
+                    auto result = database.checkpoint(SQLITE_CHECKPOINT_FULL);
+                    keep(result);
+                    us[i] = std::chrono::duration<double, std::micro>(Clock::now() - tap).count();
+                }
+                report_durability(out, "legacy", us, rows, Clock::now() - start);
+            }
+
+            for (auto mode : {Database::Durability::Strict, Database::Durability::Group, Database::Durability::Relaxed})
+            {
+                remove_database(path);
+                Database database(path.string());
+                database.set_durability(mode);
+                AuditWriter writer(database, {config::AUDIT_FLUSH_INTERVAL, config::AUDIT_BATCH_ROWS, mode, std::nullopt, std::nullopt});
+                writer.start();
+
+                std::vector<double> us(iterations / threads * threads);
+                std::vector<std::thread> validators;
+                auto start = Clock::now();
+                for (std::size_t t = 0; t < threads; ++t)
+                {
+                    validators.emplace_back([&, t]
+                    {
+                        for (std::size_t i = t; i < us.size(); i += threads)
+                        {
+                            std::atomic<bool> replied{false};
+                            auto tap = Clock::now();
+                            writer.write(AuditWriter::CardValidation{std::to_string(i), true}, [&replied](bool)
+                            {
+                                replied.store(true);
+                                replied.notify_one();
+                            });
+                            replied.wait(false);
+                            us[i] = std::chrono::duration<double, std::micro>(Clock::now() - tap).count();
+                        }
+                    });
+                }
+                for (auto& validator : validators)
+                    validator.join();
+                writer.stop();
+                report_durability(out, Database::durability_name(mode), us, us.size(), Clock::now() - start);
+            }
+            remove_database(path);
+        }
+
+        std::string bench_token(std::size_t i)
+        {
+            char token[64];
+            std::snprintf(token, sizeof(token), "%08zx-0000-4000-8000-%012zx", i, i * 2654435761u);
+            return token;
+        }
+
+        void report_storage(std::ostream& out, std::string_view name, std::vector<double>& ingest_us,
+                            std::chrono::steady_clock::duration ingest_elapsed, std::vector<double>& tap_us,
+                            std::chrono::steady_clock::duration tap_elapsed, std::uintmax_t file_bytes)
+        {
+            std::sort(ingest_us.begin(), ingest_us.end());
+            std::sort(tap_us.begin(), tap_us.end());
+            char line[200];
+            std::snprintf(line, sizeof(line),
+                          "  %-8.*s ingest %7.0f tickets/s p99 %8.1f us   validate %7.0f taps/s p50 %7.1f us p99 %8.1f us   %6ju KiB\n",
+                          static_cast<int>(name.size()), name.data(),
+                          static_cast<double>(ingest_us.size()) / std::chrono::duration<double>(ingest_elapsed).count(),
+                          ingest_us[ingest_us.size() * 99 / 100],
+                          static_cast<double>(tap_us.size()) / std::chrono::duration<double>(tap_elapsed).count(),
+                          tap_us[tap_us.size() / 2], tap_us[tap_us.size() * 99 / 100], file_bytes / 1024);
+            out << line;
+        }
+
+        // Every storage profile on a scratch file under TMPDIR, so pointing
+        // TMPDIR at the SD card or eMMC measures that device. Ingest is the
+        // ticket stream alone: an upsert and a commit per ticket. Validation
+        // is 8 validator threads reading a ticket by token, past the result
+        // cache, and waiting for its QR row as the profile's durability mode
+        // promises, while the stream goes on.
+        void run_storage(std::size_t iterations, std::ostream& out)
+        {
+            constexpr std::size_t threads = 8;
+            using Clock = std::chrono::steady_clock;
+            auto path = std::filesystem::temp_directory_path() / "ocu-bench-storage.db";
+            out << "  scratch database in " << path.parent_path().string() << "\n";
+
+            const char* upsert_sql =
+                "INSERT INTO tickets (ticket_id, active, token, valid_from, valid_to, valid_from_epoch, valid_to_epoch) "
+                "VALUES (?1, 1, ?2, '2024-01-01T00:00:00', '2099-01-01T00:00:00', 1704067200, 4070908800) "
+                "ON CONFLICT(ticket_id) DO UPDATE SET active = excluded.active, token = excluded.token;";
+            const char* lookup_sql = "SELECT valid_from_epoch, valid_to_epoch FROM tickets WHERE token = ?1;";
+
+            for (const auto& profile : Database::storage_profiles())
+            {
+                remove_database(path);
+                Database database(path.string(), &profile);
+
+                auto ingest = [&](std::size_t ticket)
+                {
+                    auto start = Clock::now();
+                    std::string token = bench_token(ticket);
+                    Database::Transaction transaction(database);
+                    {
+                        auto statement = database.prepare(upsert_sql);
+                        sqlite3_bind_int64(statement.get(), 1, static_cast<sqlite3_int64>(ticket));
+                        sqlite3_bind_text(statement.get(), 2, token.data(), static_cast<int>(token.size()), SQLITE_TRANSIENT);
+                        sqlite3_step(statement.get());
+                    }
+                    int rc = transaction.commit();
+                    keep(rc);
+                    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                };
+
+                std::vector<double> ingest_us(iterations);
+                auto ingest_start = Clock::now();
+                for (std::size_t i = 0; i < iterations; ++i)
+                    ingest_us[i] = ingest(i);
+                auto ingest_elapsed = Clock::now() - ingest_start;
+
+                AuditWriter writer(database, {config::AUDIT_FLUSH_INTERVAL, config::AUDIT_BATCH_ROWS, profile.durability, std::nullopt, std::nullopt});
+                writer.start();
+                std::atomic<bool> validating{true};
+                std::thread stream([&]
+                {
+                    for (std::size_t i = iterations; validating.load(std::memory_order_relaxed); ++i)
+                        ingest(i);
+                });
+
+                std::vector<double> tap_us(iterations / threads * threads);
+                std::vector<std::thread> validators;
+                auto tap_start = Clock::now();
+                for (std::size_t t = 0; t < threads; ++t)
+                {
+                    validators.emplace_back([&, t]
+                    {
+                        for (std::size_t i = t; i < tap_us.size(); i += threads)
+                        {
+                            auto tap = Clock::now();
+                            std::string token = bench_token(i);
+                            {
+                                auto statement = database.read(lookup_sql);
+                                sqlite3_bind_text(statement.get(), 1, token.data(), static_cast<int>(token.size()), SQLITE_STATIC);
+                                bool found = sqlite3_step(statement.get()) == SQLITE_ROW;
+                                keep(found);
+                            }
+                            std::atomic<bool> replied{false};
+                            writer.write(AuditWriter::QrValidation{std::move(token), 1, true}, [&replied](bool)
+                            {
+                                replied.store(true);
+                                replied.notify_one();
+                            });
+                            replied.wait(false);
+                            tap_us[i] = std::chrono::duration<double, std::micro>(Clock::now() - tap).count();
+                        }
+                    });
+                }
+                for (auto& validator : validators)
+                    validator.join();
+                auto tap_elapsed = Clock::now() - tap_start;
+                validating = false;
+                stream.join();
+                writer.stop();
+
+                // Database and log together: a profile that checkpoints
+                // less often still holds its pages in the log.
+                std::uintmax_t file_bytes = 0;
+                for (const char* suffix : {"", "-wal"})
+                {
+                    std::error_code ec;
+                    auto bytes = std::filesystem::file_size(path.string() + suffix, ec);
+                    file_bytes += ec ? 0 : bytes;
+                }
+                report_storage(out, profile.name, ingest_us, ingest_elapsed, tap_us, tap_elapsed, file_bytes);
+            }
+            remove_database(path);
+        }
+
+        struct Suite
+        {
+            std::string_view name;
+            std::string_view description;
+            std::size_t default_iterations;
+            void (*run)(std::size_t iterations, std::ostream& out);
+        };
+
+        constexpr std::array<Suite, 8> suites =
+        {{
+            {"parse", "validator request parsing, istringstream vs Protocol::parse", 1'000'000, run_parse},
+            {"qr", "QR field split and decode, getline/scalar vs qr_codec", 1'000'000, run_qr},
+            {"cards", "card tap lookup at 1M coupons, SQLite scan vs CardIndex", 1'000'000, run_cards},
+            {"filter", "QR token filter at 1M tokens: lookup time, memory, false positives", 1'000'000, run_filter},
+            {"statements", "QR ticket lookup, prepare per call vs Database statement cache", 100'000, run_statements},
+            {"datetime", "local ISO-8601 text, sscanf/mktime and strftime vs DateTime", 1'000'000, run_datetime},
+            {"durability", "card validation rows per durability mode vs a checkpointed commit per tap", 20'000, run_durability},
+            {"storage", "ticket ingest and QR validation under each storage profile, on a file under TMPDIR", 2'000, run_storage},
+        }};
+    }
+
+    bool run(std::string_view suite, std::size_t iterations, std::ostream& out)
+    {
+        bool found = false;
+        for (const auto& s : suites)
+        {
+            if (suite != "all" && suite != s.name)
+                continue;
+
+            found = true;
+            std::size_t n = iterations ? iterations : s.default_iterations;
+            out << s.name << " (" << n << " iterations): " << s.description << "\n";
+            s.run(n, out);
+        }
+        return found;
+    }
+
+    void list_suites(std::ostream& out)
+    {
+        for (const auto& s : suites)
+            out << "  " << s.name << " - " << s.description << "\n";
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+
+// Micro-benchmarks, run on the target with
+//   ocu_service bench <suite|all> [iterations]
+// Each suite times the current implementation of a hot path against the
+// code it replaced and prints ns/op for both.
+namespace Bench
+{
+    // Runs one suite, or every suite for "all"; iterations 0 uses the suite's
+    // default. Returns false for an unknown suite.
+    bool run(std::string_view suite, std::size_t iterations, std::ostream& out);
+
+    void list_suites(std::ostream& out);
+}
@@ -0,0 +1,194 @@
+#include "card_index.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "include/sqlite3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+namespace Coupons
+{
+    namespace
+    {
+        std::shared_ptr<const CardIndex> current;
+        std::atomic<bool> stale{true};
+
+        auto& indexed_coupons = Metrics::registry().gauge(
+            "ocu_card_index_coupons", "Coupons in the in-memory card index");
+        auto& index_build_duration = Metrics::registry().histogram(
+            "ocu_card_index_build_seconds", "Time to rebuild the card index from the coupons table");
+
+        // FNV-1a, 32 bit: card numbers are short and the table is at most
+        // half full, so a cheap hash is enough.
+        constexpr std::uint32_t hash_card(std::string_view card_number) noexcept
+        {
+            std::uint32_t hash = 2166136261u;
+            for (char c : card_number)
+            {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+    }
+
+    CardIndex::CardIndex(const std::vector<Row>& rows)
+    {
+        slots_.assign(std::bit_ceil(std::max<std::size_t>(16, rows.size() * 2)), 0);
+        mask_ = slots_.size() - 1;
+
+        // First pass: one Card per distinct number, counting its coupons.
+        std::vector<std::uint32_t> row_card(rows.size());
+        for (std::size_t i = 0; i < rows.size(); ++i)
+        {
+            std::string_view number = rows[i].card_number;
+            std::uint32_t hash = hash_card(number);
+            std::size_t slot = probe(number, hash);
+
+            if (slots_[slot] == 0)
+            {
+                Card card{};
+                card.hash = hash;
+                card.key_offset = static_cast<std::uint32_t>(keys_.size());
+                card.key_length = static_cast<std::uint16_t>(number.size());
+                keys_.append(number);
+                cards_.push_back(card);
+                slots_[slot] = static_cast<std::uint32_t>(cards_.size());
+            }
+
+            Card& card = cards_[slots_[slot] - 1];
+            row_card[i] = slots_[slot] - 1;
+            ++card.coupon_count;
+        }
+
+        std::uint32_t next = 0;
+        for (auto& card : cards_)
+        {
+            card.first_coupon = next;
+            next += card.coupon_count;
+        }
+
+        // Second pass: place coupons, keeping table order within a card.
+        validity_.resize(rows.size());
+        std::vector<std::uint32_t> filled(cards_.size(), 0);
+        for (std::size_t i = 0; i < rows.size(); ++i)
+        {
+            const Card& card = cards_[row_card[i]];
+            validity_[card.first_coupon + filled[row_card[i]]++] =
+                Validity{rows[i].valid_from, rows[i].valid_to, rows[i].coupon_id};
+        }
+    }
+
+    std::size_t CardIndex::probe(std::string_view card_number, std::uint32_t hash) const noexcept
+    {
+        for (std::size_t slot = hash & mask_;; slot = (slot + 1) & mask_)
+        {
+            std::uint32_t entry = slots_[slot];
+            if (entry == 0)
+                return slot;
+
+            const Card& card = cards_[entry - 1];
+            if (card.hash == hash && card.key_length == card_number.size()
+                && std::memcmp(keys_.data() + card.key_offset, card_number.data(), card_number.size()) == 0)
+                return slot;
+        }
+    }
+
+    CardIndex::Match CardIndex::find(std::string_view card_number, std::int64_t now) const noexcept
+    {
+        std::uint32_t entry = slots_[probe(card_number, hash_card(card_number))];
+        if (entry == 0)
+            return {Status::Unknown, 0};
+
+        const Card& card = cards_[entry - 1];
+        for (std::uint32_t i = 0; i < card.coupon_count; ++i)
+        {
+            const Validity& validity = validity_[card.first_coupon + i];
+            if (now >= validity.from && now <= validity.to)
+                return {Status::Valid, validity.coupon_id};
+        }
+        return {Status::Inactive, 0};
+    }
+
+    CardIndex::Match CardIndex::find(std::string_view card_number, std::chrono::system_clock::time_point now) const noexcept
+    {
+        return find(card_number, std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
+    }
+
+    std::shared_ptr<const CardIndex> CardIndex::load(sqlite3* db)
+    {
+        const char* sql =
+            "SELECT card_number, coupon_id, valid_from_epoch, valid_to_epoch FROM coupons "
+            "WHERE card_number IS NOT NULL AND card_number != '' ORDER BY id;";
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            LOG_ERROR("Failed to prepare card index query: {}", sqlite3_errmsg(db));
+            return nullptr;
+        }
+
+        std::vector<Row> rows;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            Row row;
+            row.card_number = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            row.coupon_id = sqlite3_column_int(stmt, 1);
+            row.valid_from = sqlite3_column_int64(stmt, 2);
+            row.valid_to = sqlite3_column_int64(stmt, 3);
+            if (sqlite3_column_type(stmt, 2) == SQLITE_NULL || sqlite3_column_type(stmt, 3) == SQLITE_NULL)
+            {
+                row.valid_from = std::numeric_limits<std::int64_t>::max();
+                row.valid_to = std::numeric_limits<std::int64_t>::min();
+            }
+            rows.push_back(std::move(row));
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            LOG_ERROR("Failed to read coupons for the card index: {}", sqlite3_errmsg(db));
+            return nullptr;
+        }
+
+        return std::make_shared<const CardIndex>(rows);
+    }
+
+    std::shared_ptr<const CardIndex> card_index() noexcept
+    {
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+    }
+
+    bool refresh_card_index(sqlite3* db)
+    {
+        if (!stale.exchange(false))
+            return false;
+
+        auto start = std::chrono::steady_clock::now();
+        auto index = CardIndex::load(db);
+        if (!index)
+        {
+            stale = true;
+            return false;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::atomic_store_explicit(&current, std::move(index), std::memory_order_release);
+
+        auto published = card_index();
+        indexed_coupons.set(static_cast<double>(published->coupons()));
+        index_build_duration.observe(elapsed);
+        LOG_INFO("Card index rebuilt: {} cards, {} coupons in {} ms", published->cards(), published->coupons(),
+                 std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        return true;
+    }
+
+    void mark_card_index_stale() noexcept
+    {
+        stale = true;
+    }
+}
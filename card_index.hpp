@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct sqlite3;
+
+namespace Coupons
+{
+    // In-memory view of the coupons table for card taps: card number to the
+    // card's coupons with their validity as Unix seconds.
+    //
+    // A snapshot is immutable once built. refresh_card_index() builds a new
+    // one when the table may have changed and publishes it with an atomic
+    // shared_ptr store, so a tap in progress keeps the snapshot it loaded
+    // and never waits for a rebuild.
+    //
+    // Lookups use open addressing with linear probing over a power-of-two
+    // slot array kept at most half full. A card's coupons sit next to each
+    // other in table order.
+    class CardIndex
+    {
+    public:
+        struct Row
+        {
+            std::string card_number;
+            int coupon_id;
+            std::int64_t valid_from;  // Unix seconds; a row without epochs
+            std::int64_t valid_to;    // gets from > to and never matches
+        };
+
+        enum class Status : std::uint8_t
+        {
+            Unknown,   // no coupon for this card
+            Valid,
+            Inactive,  // coupons exist, none valid at the given time
+        };
+
+        struct Match
+        {
+            Status status;
+            int coupon_id;  // first valid coupon in table order when Valid
+        };
+
+        explicit CardIndex(const std::vector<Row>& rows);
+
+        // Reads the whole coupons table; nullptr if the query fails.
+        [[nodiscard]] static std::shared_ptr<const CardIndex> load(sqlite3* db);
+
+        [[nodiscard]] Match find(std::string_view card_number, std::int64_t now) const noexcept;
+        [[nodiscard]] Match find(std::string_view card_number,
+            std::chrono::system_clock::time_point now = std::chrono::system_clock::now()) const noexcept;
+
+        [[nodiscard]] std::size_t cards() const noexcept { return cards_.size(); }
+        [[nodiscard]] std::size_t coupons() const noexcept { return validity_.size(); }
+
+    private:
+        struct Card
+        {
+            std::uint32_t hash;
+            std::uint32_t key_offset;    // into keys_
+            std::uint32_t first_coupon;  // into validity_
+            std::uint16_t key_length;
+            std::uint16_t coupon_count;
+        };
+
+        struct Validity
+        {
+            std::int64_t from;
+            std::int64_t to;
+            std::int32_t coupon_id;
+        };
+
+        std::vector<std::uint32_t> slots_;  // card index + 1, 0 when empty
+        std::vector<Card> cards_;
+        std::vector<Validity> validity_;
+        std::string keys_;
+        std::size_t mask_ = 0;
+
+        [[nodiscard]] std::size_t probe(std::string_view card_number, std::uint32_t hash) const noexcept;
+    };
+
+    // The current snapshot; nullptr until the first successful refresh.
+    [[nodiscard]] std::shared_ptr<const CardIndex> card_index() noexcept;
+
+    // Rebuilds and publishes the index from `db`, a read-only connection,
+    // if mark_card_index_stale() was called since the last build: after a
+    // coupon fetch, or when Database::poll_external_writes() saw another
+    // process write. Only one thread may call it; main does, every 100 ms.
+    bool refresh_card_index(sqlite3* db);
+
+    // Forces the next refresh: after coupons were written, by this process
+    // or another one.
+    void mark_card_index_stale() noexcept;
+}
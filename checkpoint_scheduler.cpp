@@ -0,0 +1,177 @@
+#include "checkpoint_scheduler.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    auto& passive_checkpoints = Metrics::registry().counter(
+        "ocu_sqlite_checkpoints_total", "Background WAL checkpoints, by mode", "mode=\"passive\"");
+    auto& restart_checkpoints = Metrics::registry().counter(
+        "ocu_sqlite_checkpoints_total", "Background WAL checkpoints, by mode", "mode=\"restart\"");
+    auto& truncate_checkpoints = Metrics::registry().counter(
+        "ocu_sqlite_checkpoints_total", "Background WAL checkpoints, by mode", "mode=\"truncate\"");
+    auto& wal_frames = Metrics::registry().gauge(
+        "ocu_sqlite_wal_frames", "Frames in the write-ahead log after the last commit");
+    auto& backlog_frames = Metrics::registry().gauge(
+        "ocu_sqlite_checkpoint_backlog_frames", "Frames the last checkpoint left in the log because of readers");
+}
+
+CheckpointScheduler::CheckpointScheduler(Database& db, Policy policy)
+    : db_(db)
+    , policy_(policy)
+{
+    sqlite3* raw_db = nullptr;
+    const char* path = sqlite3_db_filename(db_.get(), "main");
+    if (sqlite3_open_v2(path, &raw_db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+    {
+        sqlite3_close(raw_db);
+        throw std::runtime_error(std::string("Cannot open database for checkpoints: ") + path);
+    }
+    connection_.reset(raw_db);
+    sqlite3_busy_timeout(connection_.get(), 500);
+}
+
+CheckpointScheduler::~CheckpointScheduler()
+{
+    stop();
+}
+
+void CheckpointScheduler::start()
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (running_)
+            return;
+        running_ = true;
+        last_commit_ = last_checkpoint_ = Clock::now();
+    }
+
+    db_.set_wal_hook(&CheckpointScheduler::on_commit, this);
+    thread_ = std::thread(&CheckpointScheduler::run, this);
+    LOG_INFO("[Checkpoint] Scheduler started: {} frames, {} ms idle, {} ms max interval",
+             policy_.wal_frames, policy_.idle.count(), policy_.max_interval.count());
+}
+
+void CheckpointScheduler::stop()
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+
+    // Back to automatic checkpoints for whatever still commits.
+    db_.set_wal_hook(nullptr, nullptr);
+    checkpoint(SQLITE_CHECKPOINT_TRUNCATE, "shutdown");
+    LOG_INFO("[Checkpoint] Scheduler stopped");
+}
+
+int CheckpointScheduler::on_commit(void* self, sqlite3*, const char*, int frames)
+{
+    auto* scheduler = static_cast<CheckpointScheduler*>(self);
+    wal_frames.set(frames);
+
+    bool wake;
+    {
+        std::lock_guard lock(scheduler->mutex_);
+        // Only a change of deadline needs the thread: the first commit after
+        // a checkpoint, or the log growing past the size threshold.
+        wake = !scheduler->dirty_;
+        scheduler->dirty_ = true;
+        scheduler->wal_frames_ = frames;
+        scheduler->last_commit_ = Clock::now();
+        wake = wake || scheduler->new_frames() >= scheduler->policy_.wal_frames;
+    }
+    if (wake)
+        scheduler->wake_.notify_one();
+    return SQLITE_OK;
+}
+
+int CheckpointScheduler::new_frames() const noexcept
+{
+    // A log smaller than at the last checkpoint was started over.
+    return wal_frames_ >= checkpointed_log_ ? wal_frames_ - checkpointed_log_ : wal_frames_;
+}
+
+void CheckpointScheduler::run()
+{
+    Tracing::name_thread("checkpoint");
+
+    std::unique_lock lock(mutex_);
+    while (running_)
+    {
+        if (!dirty_)
+        {
+            wake_.wait(lock);
+            continue;
+        }
+
+        auto quiet_since = std::max(last_commit_, last_checkpoint_);
+        auto now = Clock::now();
+        std::string_view reason;
+        if (new_frames() >= policy_.wal_frames)
+            reason = "size";
+        else if (now - quiet_since >= policy_.idle)
+            reason = "idle";
+        else if (now - last_checkpoint_ >= policy_.max_interval)
+            reason = "interval";
+        else
+        {
+            wake_.wait_until(lock, std::min(quiet_since + policy_.idle, last_checkpoint_ + policy_.max_interval));
+            continue;
+        }
+
+        dirty_ = false;
+        lock.unlock();
+        checkpoint(SQLITE_CHECKPOINT_PASSIVE, reason);
+        lock.lock();
+        last_checkpoint_ = Clock::now();
+    }
+}
+
+void CheckpointScheduler::checkpoint(int mode, std::string_view reason)
+{
+    auto started = Clock::now();
+    auto result = Database::checkpoint(connection_.get(), mode);
+    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+
+    (mode == SQLITE_CHECKPOINT_PASSIVE ? passive_checkpoints
+     : mode == SQLITE_CHECKPOINT_RESTART ? restart_checkpoints : truncate_checkpoints).inc();
+
+    if (result.rc != SQLITE_OK && result.rc != SQLITE_BUSY)
+    {
+        LOG_WARN("[Checkpoint] {} checkpoint failed: {}", reason, sqlite3_errmsg(connection_.get()));
+        return;
+    }
+
+    int backlog = std::max(0, result.log_frames - result.checkpointed_frames);
+    backlog_frames.set(backlog);
+    {
+        std::lock_guard lock(mutex_);
+        checkpointed_log_ = result.log_frames;
+    }
+    LOG_DEBUG("[Checkpoint] {}: {}/{} frames in {} us", reason, result.checkpointed_frames, result.log_frames, elapsed_us);
+
+    if (backlog == 0)
+        return;
+
+    if (mode == SQLITE_CHECKPOINT_PASSIVE && result.log_frames >= policy_.escalate_frames)
+    {
+        LOG_INFO("[Checkpoint] Readers held back {} of {} frames; forcing a restart", backlog, result.log_frames);
+        checkpoint(SQLITE_CHECKPOINT_RESTART, reason);
+        return;
+    }
+
+    // Copy what is left on a later pass.
+    std::lock_guard lock(mutex_);
+    dirty_ = true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "database.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+// Checkpoints the write-ahead log from a background thread instead of after
+// every commit, so a tap's commit never waits for readers or for an fsync
+// of the database file.
+//
+// Commits on the server's connection report the log size through the
+// Database's WAL hook, in place of SQLite's own auto-checkpoint. The thread
+// runs a PASSIVE checkpoint on a connection of its own when the log
+// reaches `wal_frames`, once no commit has come for `idle`, and at the
+// latest `max_interval` after the previous one. Readers only make a
+// passive checkpoint stop early. If one leaves part of a log of at
+// least `escalate_frames` behind, a RESTART follows, waiting up to the
+// busy timeout for those readers so the log can start over from the
+// beginning. stop() ends with a TRUNCATE, leaving an empty log behind.
+class CheckpointScheduler
+{
+public:
+    struct Policy
+    {
+        int wal_frames;
+        std::chrono::milliseconds idle;
+        std::chrono::milliseconds max_interval;
+        int escalate_frames;
+    };
+
+    CheckpointScheduler(Database& db, Policy policy);
+    ~CheckpointScheduler();
+
+    CheckpointScheduler(const CheckpointScheduler&) = delete;
+    CheckpointScheduler& operator=(const CheckpointScheduler&) = delete;
+
+    void start();
+    void stop();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct SQLiteDeleter
+    {
+        void operator()(sqlite3* db) const noexcept
+        {
+            sqlite3_close(db);
+        }
+    };
+
+    static int on_commit(void* self, sqlite3* db, const char* schema, int frames);
+    void run();
+    [[nodiscard]] int new_frames() const noexcept;  // mutex_ held
+    void checkpoint(int mode, std::string_view reason);
+
+    Database& db_;
+    Policy policy_;
+    std::unique_ptr<sqlite3, SQLiteDeleter> connection_;
+
+    std::mutex mutex_;  // never held while calling SQLite
+    std::condition_variable wake_;
+    bool running_ = false;
+    bool dirty_ = false;         // commits or a backlog since the last checkpoint
+    int wal_frames_ = 0;         // as of the last commit
+    int checkpointed_log_ = 0;   // log size the last checkpoint saw
+    Clock::time_point last_commit_;
+    Clock::time_point last_checkpoint_;
+    std::thread thread_;
+};
@@ -1,9 +1,15 @@
 #pragma once
+#include <chrono>
+#include <cstddef>
 #include <string_view>
 
 namespace config
 {
     inline constexpr std::string_view DB_PATH = "database.db";
+
+    // SQLite tuning for the flash the database lives on (--storage): one
+    // of Database::storage_profiles(), "default", "sd-card" or "emmc".
+    inline constexpr std::string_view STORAGE_PROFILE = "default";
     
     // Legacy REST API endpoints
     inline constexpr std::string_view API_BASE_URL = "192.168.0.101:11006/api/v1";
@@ -13,4 +19,69 @@ namespace config
     inline constexpr std::string_view GRPC_TICKET_SERVER = "localhost:5109";
     
     inline constexpr int DEFAULT_TCP_PORT = 8888;
+
+    // Local Prometheus endpoint (GET /metrics); 0 disables it.
+    inline constexpr int DEFAULT_METRICS_PORT = 9100;
+
+    // Flight recorder dumps (SIGUSR1, DUMP_FLIGHT, or a request slower than
+    // the threshold; 0 disables the latency trigger).
+    inline constexpr std::string_view FLIGHT_DUMP_DIR = ".";
+    inline constexpr int FLIGHT_THRESHOLD_MS = 250;
+
+    // Fraction of requests and ingest batches traced (0 disables tracing).
+    inline constexpr double TRACE_SAMPLE_RATE = 0.0;
+
+    // Hex-encoded HMAC key for QR signatures; empty leaves them unchecked.
+    inline constexpr std::string_view QR_KEY_FILE = "";
+
+    // QR codes drawn longer ago than this are rejected as screenshots or
+    // replays (0 disables); the skew allows for app clocks running ahead.
+    inline constexpr int QR_MAX_AGE_S = 120;
+    inline constexpr int QR_MAX_CLOCK_SKEW_S = 30;
+
+    // How often expired ticket tokens are removed from the QR token filter.
+    inline constexpr auto TOKEN_FILTER_SWEEP_INTERVAL = std::chrono::seconds(60);
+
+    // A card or QR code accepted again within this window is answered from
+    // memory as already validated, without a second validation row (0
+    // disables). The cache holds at least this many recent taps.
+    inline constexpr auto TAP_REPEAT_WINDOW = std::chrono::seconds(10);
+    inline constexpr std::size_t TAP_CACHE_CAPACITY = 4096;
+
+    // Background WAL checkpoints: when the log has grown by the storage
+    // profile's wal_autocheckpoint frames (pages), after this long without
+    // a commit, or at the latest after the interval. A log at least the
+    // escalation size that readers keep from being fully copied gets a
+    // RESTART checkpoint.
+    inline constexpr auto CHECKPOINT_IDLE = std::chrono::seconds(2);
+    inline constexpr auto CHECKPOINT_MAX_INTERVAL = std::chrono::seconds(60);
+    inline constexpr int CHECKPOINT_ESCALATE_FRAMES = 8000;
+
+    // Validation and purchase rows are queued and committed by one writer
+    // thread, at least this often or as soon as this many are waiting.
+    inline constexpr auto AUDIT_FLUSH_INTERVAL = std::chrono::milliseconds(20);
+    inline constexpr std::size_t AUDIT_BATCH_ROWS = 256;
+
+    // When a validation or purchase must be on disk (--durability):
+    // "strict" before the reply, "group" within one flush interval of it,
+    // "relaxed" by the next checkpoint. See Database::Durability. Empty
+    // takes the storage profile's.
+    inline constexpr std::string_view DURABILITY = "";
+
+    // Optional memory-mapped journal in front of the audit tables (empty
+    // disables): rows are appended to preallocated segment files, msync'ed
+    // every sync interval (0 leaves it to the kernel), and compacted into
+    // SQLite once a segment is full or its first row is SEAL_AFTER old.
+    inline constexpr std::string_view AUDIT_JOURNAL_DIR = "";
+    inline constexpr std::size_t AUDIT_JOURNAL_SEGMENT_RECORDS = 8192;
+    inline constexpr auto AUDIT_JOURNAL_SYNC_INTERVAL = std::chrono::milliseconds(100);
+    inline constexpr auto AUDIT_JOURNAL_SEAL_AFTER = std::chrono::seconds(5);
+
+    // Optional daily audit files, audit-YYYY-MM-DD.db under this directory
+    // (empty keeps the audit tables in the main file). Closed days are
+    // gzipped if COMPRESS is set and deleted after RETENTION_DAYS (0 keeps
+    // them).
+    inline constexpr std::string_view AUDIT_PARTITION_DIR = "";
+    inline constexpr int AUDIT_RETENTION_DAYS = 90;
+    inline constexpr bool AUDIT_PARTITION_COMPRESS = true;
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #include "coupons.hpp"
+#include "database.hpp"
+#include "card_index.hpp"
+#include "datetime.hpp"
 #include "fetcher.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "probes.hpp"
 #include "include/sqlite3.h"
 #include "nlohmann/json.hpp"
-#include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <ctime>
@@ -12,48 +18,70 @@ using json = nlohmann::json;
 
 namespace Coupons
 {
-    CouponManager::CouponManager(sqlite3* db) : db_(db) {}
+    namespace
+    {
+        auto& ingested_coupons = Metrics::registry().counter(
+            "ocu_ingest_rows_total", "Rows stored by ingest, by source", "source=\"coupons\"");
+        auto& coupon_ingest_duration = Metrics::registry().histogram(
+            "ocu_ingest_duration_seconds", "Duration of ingest batches, by source", "source=\"coupons\"");
+
+        void bind_epoch(sqlite3_stmt* stmt, int index, std::string_view datetime)
+        {
+            auto epoch = DateTime::parse_local(datetime);
+            if(epoch)
+                sqlite3_bind_int64(stmt, index, *epoch);
+            else
+                sqlite3_bind_null(stmt, index);
+        }
+    }
+
+    CouponManager::CouponManager(Database& db) : db_(db) {}
 
     bool CouponManager::fetch_and_store(std::string_view endpoint)
     {
-        std::cout << "Fetching coupons from " << endpoint << '\n';
+        LOG_INFO("Fetching coupons from {}", endpoint);
 
         auto json_content = Fetcher::fetch_json(endpoint);
         if(!json_content)
         {
-            std::cerr << "Failed to fetch JSON from " << endpoint << '\n';
+            LOG_ERROR("Failed to fetch JSON from {}", endpoint);
             return false;
         }
 
         int inserted = parse_and_insert(*json_content);
         if(!inserted)
         {  
-            std::cerr << "Failed to parse and insert coupons\n";
+            LOG_ERROR("Failed to parse and insert coupons");
             return false;
         }
-        std::cout << "Successfully inserted " << inserted << " coupons\n";
+        LOG_INFO("Successfully inserted {} coupons", inserted);
         return inserted > 0;
         
     }
 
     int CouponManager::parse_and_insert(std::string_view json_content)
     {
+        Tracing::Trace trace("coupon_ingest");
+        OCU_PROBE(ingest__start, "coupons");
         try
         {
             auto insert_start = std::chrono::steady_clock::now();
 
+            Tracing::Span parse_span("parse");
             auto json_array = json::parse(json_content);
+            parse_span.end();
 
             if(!json_array.is_array())
             {
-                std::cerr << "Invalid JSON: expected array\n";
+                LOG_ERROR("Invalid JSON: expected array");
                 return -1;
             }
 
-            std::cout << "Found " << json_array.size() << " coupons\n";
+            LOG_INFO("Found {} coupons", json_array.size());
 
             int inserted = 0;
 
+            Tracing::Span insert_span("insert");
             for(const auto& item : json_array)
             {
                 Coupon coupon;
@@ -74,14 +102,21 @@ namespace Coupons
                 auto insert_end = std::chrono::steady_clock::now();
                 auto total = std::chrono::duration_cast<std::chrono::microseconds>(insert_end - insert_start).count();
 
-                std::cout << "Total query: " << total << " μs\n"; 
+                LOG_INFO("Total query: {} μs", total);
            }
-            std::cout << "Inserted " << inserted << " coupons\n";
+            insert_span.end();
+            OCU_PROBE(ingest__done, "coupons", inserted);
+            LOG_INFO("Inserted {} coupons", inserted);
+            if (inserted > 0)
+                mark_card_index_stale();
+
+            ingested_coupons.inc(static_cast<std::uint64_t>(inserted));
+            coupon_ingest_duration.observe(std::chrono::steady_clock::now() - insert_start);
             return inserted;
         }
         catch(const json::exception& e)
         {
-            std::cerr << "JSON parse error: " << e.what() << '\n';
+            LOG_ERROR("JSON parse error: {}", e.what());
             return -1;
         }
     }
@@ -89,19 +124,29 @@ namespace Coupons
     bool CouponManager::insert_coupon(const Coupon& coupon)
     {
         
+        // An upsert, not INSERT OR REPLACE; see Database::lookup.
         const char* sql = 
                 "INSERT INTO coupons (coupon_id, customer_id, card_id, card_number, "
-                "valid_from, valid_to, traffic_area_group) "
-                "VALUES (?, ?, ?, ?, ?, ?, ?);";
+                "valid_from, valid_to, traffic_area_group, valid_from_epoch, valid_to_epoch) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?) "
+                "ON CONFLICT(coupon_id) DO UPDATE SET "
+                "customer_id = excluded.customer_id, card_id = excluded.card_id, "
+                "card_number = excluded.card_number, valid_from = excluded.valid_from, "
+                "valid_to = excluded.valid_to, traffic_area_group = excluded.traffic_area_group, "
+                "valid_from_epoch = excluded.valid_from_epoch, valid_to_epoch = excluded.valid_to_epoch;";
         
-        sqlite3_stmt* stmt;
-        if(sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        auto statement = db_.prepare(sql);
+        sqlite3_stmt* stmt = statement.get();
+        if(!stmt)
         {
-            std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_) << '\n';
+            LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_.get()));
             return false;
         }
 
-        sqlite3_bind_int(stmt, 1, coupon.coupon_id);
+        // 0 means the feed had no id; NULL keeps such coupons out of the
+        // unique key instead of each one replacing the last.
+        if(coupon.coupon_id) sqlite3_bind_int(stmt, 1, coupon.coupon_id);
+        else sqlite3_bind_null(stmt, 1);
         sqlite3_bind_int(stmt, 2, coupon.customer_id);
 
         if(coupon.card_id) sqlite3_bind_int(stmt, 3, *coupon.card_id);
@@ -111,55 +156,70 @@ namespace Coupons
         sqlite3_bind_text(stmt, 5, coupon.valid_from.c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_text(stmt, 6, coupon.valid_to.c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_text(stmt, 7, coupon.traffic_area_group.c_str(), -1, SQLITE_TRANSIENT);
+        bind_epoch(stmt, 8, coupon.valid_from);
+        bind_epoch(stmt, 9, coupon.valid_to);
 
-        bool success = (sqlite3_step(stmt) == SQLITE_DONE);
-        sqlite3_finalize(stmt);
-
-        return success;
+        return sqlite3_step(stmt) == SQLITE_DONE;
     }
 
     bool CouponManager::is_valid_card(std::string_view card_number) const
     {
-        const char* sql =  "SELECT valid_from, valid_to FROM coupons WHERE card_number = ? LIMIT 1;";
-
-        sqlite3_stmt* stmt;
-
-        if(sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        // Valid if any of the card's coupons is, as in CardIndex. NULL epochs
+        // (dates that did not parse) compare as not valid.
+        const char* sql =
+            "SELECT EXISTS(SELECT 1 FROM coupons WHERE card_number = ?1 "
+            "AND ?2 BETWEEN valid_from_epoch AND valid_to_epoch);";
+
+        Tracing::Span prepare_span("prepare");
+        auto statement = db_.read(sql);
+        sqlite3_stmt* stmt = statement.get();
+        if(!stmt)
         {
-            std::cerr << "Failed to prepare statement " << sqlite3_errmsg(db_) << '\n';
+            LOG_ERROR("Failed to prepare statement {}", sqlite3_errmsg(db_.reader()));
             return false;
         }
+        prepare_span.end();
 
-        sqlite3_bind_text(stmt, 1, std::string(card_number).c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 1, card_number.data(), static_cast<int>(card_number.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, std::time(nullptr));
 
-        bool is_valid = false;
-
-        if(sqlite3_step(stmt) == SQLITE_ROW)
-        {
-           const char* valid_from_str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-           const char* valid_to_str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        Tracing::Span step_span("step");
+        bool is_valid = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) != 0;
+        step_span.end();
 
-           if(valid_from_str && valid_to_str)
-           {
-            // Copy strings to avoid dangling pointers
-            std::string valid_from_copy(valid_from_str);
-            std::string valid_to_copy(valid_to_str);
+        if(!is_valid)
+            LOG_INFO("No coupon valid now for card: {}", card_number);
 
-            auto time_from = parse_iso8601(valid_from_copy);
-            auto time_to = parse_iso8601(valid_to_copy);
-            auto now = std::chrono::system_clock::now();
+        return is_valid;
+    }
 
-            if(time_from && time_to)
-            {
-                is_valid = (now >= *time_from && now <= *time_to);
-                if(!is_valid) std::cout << "Card expired or not yet valid for: " << card_number << '\n';
-            }
-           }
 
+    std::optional<int> CouponManager::find_valid_coupon(std::string_view card_number) const
+    {
+        const char* sql =
+            "SELECT coupon_id FROM coupons WHERE card_number = ?1 "
+            "AND ?2 BETWEEN valid_from_epoch AND valid_to_epoch ORDER BY id LIMIT 1;";
+
+        Tracing::Span prepare_span("prepare");
+        auto statement = db_.read(sql);
+        sqlite3_stmt* stmt = statement.get();
+        if(!stmt)
+        {
+            LOG_ERROR("Failed to prepare statement {}", sqlite3_errmsg(db_.reader()));
+            return std::nullopt;
         }
+        prepare_span.end();
 
-        sqlite3_finalize(stmt);
-        return is_valid;
+        sqlite3_bind_text(stmt, 1, card_number.data(), static_cast<int>(card_number.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, std::time(nullptr));
+
+        Tracing::Span step_span("step");
+        if(sqlite3_step(stmt) != SQLITE_ROW)
+        {
+            LOG_INFO("No coupon valid now for card: {}", card_number);
+            return std::nullopt;
+        }
+        return sqlite3_column_int(stmt, 0);
     }
 
 
@@ -167,75 +227,34 @@ namespace Coupons
     {
         std::vector<Coupon> coupons;
 
-        const char* sql = 
-        "SELECT coupon_id, customer_id, card_id, card_number, valid_from, valid_to, traffic_area_group "
-        "FROM coupons WHERE card_number = ?;";
-
-        sqlite3_stmt* stmt;
-        if(sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        Tracing::Span lookup_span("lookup");
+        auto rows = db_.lookup("coupons", "card_number",
+            "coupon_id, customer_id, card_id, card_number, valid_from, valid_to, traffic_area_group",
+            std::string(card_number));
+        if(!rows)
         {
-            std::cerr << "Failed to prepare query: " << sqlite3_errmsg(db_) << '\n';
+            LOG_ERROR("Failed to query coupons: {}", sqlite3_errmsg(db_.reader()));
             return coupons;
         }
+        lookup_span.end();
 
-        sqlite3_bind_text(stmt, 1, std::string(card_number).c_str(), -1, SQLITE_TRANSIENT);
-
-        while(sqlite3_step(stmt) == SQLITE_ROW)
+        for(std::size_t row = 0; row < rows->size(); ++row)
         {
             Coupon coupon;
-            coupon.coupon_id = sqlite3_column_int(stmt, 0);
-            coupon.customer_id = sqlite3_column_int(stmt, 1);
+            coupon.coupon_id = static_cast<int>(rows->integer(row, 0));
+            coupon.customer_id = static_cast<int>(rows->integer(row, 1));
 
-            if(sqlite3_column_type(stmt,2) != SQLITE_NULL)
-                coupon.card_id = sqlite3_column_int(stmt, 2);
-            
-            const char* card_num = reinterpret_cast<const char*>(sqlite3_column_text(stmt,3));
-            const char* valid_from = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-            const char* valid_to = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-            const char* traffic_area = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
+            if(!rows->is_null(row, 2))
+                coupon.card_id = static_cast<int>(rows->integer(row, 2));
             
-            if (card_num) coupon.card_number = card_num;
-            if (valid_from) coupon.valid_from = valid_from;
-            if (valid_to) coupon.valid_to = valid_to;
-            if (traffic_area) coupon.traffic_area_group = traffic_area;
+            coupon.card_number = rows->text(row, 3);
+            coupon.valid_from = rows->text(row, 4);
+            coupon.valid_to = rows->text(row, 5);
+            coupon.traffic_area_group = rows->text(row, 6);
             
             coupons.push_back(std::move(coupon));
         }
         
-        sqlite3_finalize(stmt);
-            return coupons;  
+        return coupons;
     }
-
-    std::optional<std::chrono::system_clock::time_point>
-    CouponManager::parse_iso8601(std::string_view datetime_str)
-    {
-        std::tm tm = {};
-        
-        // Manual parsing of ISO 8601 format: 2024-01-15T10:30:00
-        int year, month, day, hour, min, sec;
-        int parsed = std::sscanf(datetime_str.data(), "%d-%d-%dT%d:%d:%d",
-                                &year, &month, &day, &hour, &min, &sec);
-        
-        if (parsed != 6) {
-            return std::nullopt;
-        }
-        
-        tm.tm_year = year - 1900;
-        tm.tm_mon = month - 1;
-        tm.tm_mday = day;
-        tm.tm_hour = hour;
-        tm.tm_min = min;
-        tm.tm_sec = sec;
-        tm.tm_isdst = -1;  
-        
-        std::time_t time = std::mktime(&tm);
-        if (time == -1) {
-            return std::nullopt;
-        }
-        
-        return std::chrono::system_clock::from_time_t(time);
-
-    }
-
-
 }
\ No newline at end of file
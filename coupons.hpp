@@ -6,7 +6,7 @@
 #include <vector>
 #include <chrono>
 
-struct sqlite3;
+class Database;
 
 namespace Coupons
 {
@@ -24,16 +24,18 @@ namespace Coupons
     class CouponManager
     {
     public:
-        explicit CouponManager(sqlite3* db);
+        explicit CouponManager(Database& db);
 
         [[nodiscard]] bool fetch_and_store(std::string_view endpoint);
         [[nodiscard]] int parse_and_insert(std::string_view json_content);
         [[nodiscard]] bool is_valid_card(std::string_view card_number) const;
+        // The first coupon of the card, in table order, that is valid now:
+        // the one CardIndex::find would return.
+        [[nodiscard]] std::optional<int> find_valid_coupon(std::string_view card_number) const;
         [[nodiscard]] std::vector<Coupon> get_coupons_by_card(std::string_view card_number) const;
 
     private:
-        sqlite3* db_;
-        [[nodiscard]] static std::optional<std::chrono::system_clock::time_point> parse_iso8601(std::string_view datetime_str);
+        Database& db_;
         [[nodiscard]] bool insert_coupon(const Coupon& coupon);
     };
 
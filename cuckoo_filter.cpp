@@ -0,0 +1,145 @@
+#include "cuckoo_filter.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace
+{
+    std::uint16_t fingerprint_of(std::uint64_t hash) noexcept
+    {
+        auto fingerprint = static_cast<std::uint16_t>(hash >> 48);
+        return fingerprint ? fingerprint : 1;  // 0 marks an empty slot
+    }
+}
+
+CuckooFilter::CuckooFilter(std::size_t capacity)
+{
+    std::size_t buckets = std::bit_ceil(std::max<std::size_t>(
+        1, static_cast<std::size_t>(static_cast<double>(capacity) / (bucket_size * 0.95)) + 1));
+    buckets_.assign(buckets, Bucket{});
+    mask_ = buckets - 1;
+}
+
+std::size_t CuckooFilter::alternate(std::size_t bucket, std::uint16_t fingerprint) const noexcept
+{
+    // Partial-key cuckoo hashing: the other bucket depends only on the
+    // fingerprint, so an entry can move without its original key.
+    return (bucket ^ (fingerprint * 0x5bd1e995u)) & mask_;
+}
+
+bool CuckooFilter::place(std::size_t bucket, std::uint16_t fingerprint) noexcept
+{
+    for (auto& slot : buckets_[bucket].fingerprints)
+    {
+        if (slot == 0)
+        {
+            slot = fingerprint;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CuckooFilter::bucket_has(std::size_t bucket, std::uint16_t fingerprint) const noexcept
+{
+    const auto& slots = buckets_[bucket].fingerprints;
+    return (slots[0] == fingerprint) | (slots[1] == fingerprint) | (slots[2] == fingerprint) | (slots[3] == fingerprint);
+}
+
+bool CuckooFilter::insert(std::uint64_t hash) noexcept
+{
+    if (has_victim_)
+        return false;
+
+    std::uint16_t fingerprint = fingerprint_of(hash);
+    std::size_t bucket = hash & mask_;
+
+    if (place(bucket, fingerprint) || place(alternate(bucket, fingerprint), fingerprint))
+    {
+        ++size_;
+        return true;
+    }
+
+    // Both buckets full: evict a random entry to its other bucket, and so on.
+    if (kick_state_ & 1)
+        bucket = alternate(bucket, fingerprint);
+    for (int kick = 0; kick < max_kicks; ++kick)
+    {
+        kick_state_ ^= kick_state_ << 13;
+        kick_state_ ^= kick_state_ >> 17;
+        kick_state_ ^= kick_state_ << 5;
+
+        std::swap(fingerprint, buckets_[bucket].fingerprints[kick_state_ % bucket_size]);
+        bucket = alternate(bucket, fingerprint);
+        if (place(bucket, fingerprint))
+        {
+            ++size_;
+            return true;
+        }
+    }
+
+    // The new key went in; the last evicted one is held aside.
+    has_victim_ = true;
+    victim_fingerprint_ = fingerprint;
+    victim_bucket_ = bucket;
+    ++size_;
+    return true;
+}
+
+bool CuckooFilter::erase(std::uint64_t hash) noexcept
+{
+    std::uint16_t fingerprint = fingerprint_of(hash);
+    std::size_t first = hash & mask_;
+    std::size_t second = alternate(first, fingerprint);
+
+    for (std::size_t bucket : {first, second})
+    {
+        for (auto& slot : buckets_[bucket].fingerprints)
+        {
+            if (slot == fingerprint)
+            {
+                slot = 0;
+                --size_;
+                // Room now: move the held-aside entry back in.
+                if (has_victim_ && (place(victim_bucket_, victim_fingerprint_)
+                    || place(alternate(victim_bucket_, victim_fingerprint_), victim_fingerprint_)))
+                    has_victim_ = false;
+                return true;
+            }
+        }
+    }
+
+    if (has_victim_ && victim_fingerprint_ == fingerprint && (victim_bucket_ == first || victim_bucket_ == second))
+    {
+        has_victim_ = false;
+        --size_;
+        return true;
+    }
+    return false;
+}
+
+bool CuckooFilter::contains(std::uint64_t hash) const noexcept
+{
+    std::uint16_t fingerprint = fingerprint_of(hash);
+    std::size_t first = hash & mask_;
+    std::size_t second = alternate(first, fingerprint);
+
+    return bucket_has(first, fingerprint) || bucket_has(second, fingerprint)
+        || (has_victim_ && victim_fingerprint_ == fingerprint && (victim_bucket_ == first || victim_bucket_ == second));
+}
+
+void CuckooFilter::clear() noexcept
+{
+    std::fill(buckets_.begin(), buckets_.end(), Bucket{});
+    size_ = 0;
+    has_victim_ = false;
+}
+
+double CuckooFilter::false_positive_rate() const noexcept
+{
+    // A lookup compares against up to 2 * bucket_size fingerprints, each
+    // slot occupied with probability `load`.
+    double load = slots() ? static_cast<double>(size_) / static_cast<double>(slots()) : 0.0;
+    return 1.0 - std::pow(1.0 - 1.0 / 65535.0, 2.0 * bucket_size * load);
+}
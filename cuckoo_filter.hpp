@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Cuckoo filter (Fan et al., 2014) over 64-bit key hashes: 16-bit
+// fingerprints in buckets of four, each key having two candidate buckets.
+// Unlike a Bloom filter it supports removal, so expired keys can be taken
+// out. A key that was inserted is always found; one that was not is
+// reported present with probability about 8 / 65536 at full load.
+//
+// Not thread-safe; callers serialise access.
+class CuckooFilter
+{
+public:
+    // Sized for `capacity` keys at 95% bucket occupancy.
+    explicit CuckooFilter(std::size_t capacity = 0);
+
+    // False when the filter is full; the key is then not stored and the
+    // filter should be rebuilt larger.
+    [[nodiscard]] bool insert(std::uint64_t hash) noexcept;
+
+    // Removes one copy of a key inserted earlier. Removing a key that was
+    // never inserted may remove another key's fingerprint.
+    bool erase(std::uint64_t hash) noexcept;
+
+    [[nodiscard]] bool contains(std::uint64_t hash) const noexcept;
+
+    void clear() noexcept;
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] std::size_t slots() const noexcept { return buckets_.size() * bucket_size; }
+    [[nodiscard]] std::size_t memory_bytes() const noexcept { return buckets_.size() * sizeof(Bucket); }
+
+    // Expected false-positive rate at the current occupancy.
+    [[nodiscard]] double false_positive_rate() const noexcept;
+
+private:
+    static constexpr std::size_t bucket_size = 4;
+    static constexpr int max_kicks = 500;
+
+    struct Bucket
+    {
+        std::uint16_t fingerprints[bucket_size];
+    };
+
+    std::vector<Bucket> buckets_;
+    std::size_t mask_ = 0;
+    std::size_t size_ = 0;
+    std::uint32_t kick_state_ = 0x9E3779B9u;
+
+    // The entry evicted when an insert gave up, kept so it stays findable.
+    bool has_victim_ = false;
+    std::uint16_t victim_fingerprint_ = 0;
+    std::size_t victim_bucket_ = 0;
+
+    [[nodiscard]] std::size_t alternate(std::size_t bucket, std::uint16_t fingerprint) const noexcept;
+    bool place(std::size_t bucket, std::uint16_t fingerprint) noexcept;
+    [[nodiscard]] bool bucket_has(std::size_t bucket, std::uint16_t fingerprint) const noexcept;
+};
@@ -1,12 +1,367 @@
 #include "database.hpp"
 #include "config.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "probes.hpp"
+#include "logger.hpp"
 
 #include <stdexcept>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <string>
 #include <string_view>  
+#include <utility>
 #include <sstream>
+#include <vector>
 
 
+namespace
+{
+    auto& checkpoint_duration = Metrics::registry().histogram(
+        "ocu_sqlite_checkpoint_duration_seconds", "Duration of WAL checkpoints");
+    auto& statement_cache_hits = Metrics::registry().counter(
+        "ocu_sqlite_statement_cache_hits_total", "Statements served from the prepared statement cache");
+    auto& statement_cache_misses = Metrics::registry().counter(
+        "ocu_sqlite_statement_cache_misses_total", "Statements compiled because none was cached");
+    auto& scan_plans = Metrics::registry().counter(
+        "ocu_sqlite_scan_plans_total", "Statements expected to use an index whose query plan scans a table");
+    auto& result_cache_hits = Metrics::registry().counter(
+        "ocu_sqlite_result_cache_hits_total", "Lookups answered from the query result cache");
+    auto& result_cache_misses = Metrics::registry().counter(
+        "ocu_sqlite_result_cache_misses_total", "Lookups that ran their query");
+    auto& result_cache_invalidations = Metrics::registry().counter(
+        "ocu_sqlite_result_cache_invalidations_total", "Cached lookups dropped because a write changed their rows");
+    auto& reader_connections = Metrics::registry().gauge(
+        "ocu_sqlite_reader_connections", "Read-only connections open, one per thread that has read");
+
+    // Presets for the flash a validator boots from. `bench storage`, run
+    // with TMPDIR on the device, shows which suits it.
+    constexpr std::array<Database::StorageProfile, 3> profiles
+    {{
+        {"default", "SQLite's own settings, as earlier builds ran",
+         0, -2000, 4096, 0, 1000, -1, Database::Durability::Group},
+        {"sd-card", "SD cards: larger pages, fewer and longer checkpoints, a log file that is reused, no temp files",
+         std::int64_t{32} << 20, -8192, 8192, 2, 4000, std::int64_t{16} << 20, Database::Durability::Group},
+        {"emmc", "eMMC: reads through a large mapping and page cache, a small log file, no temp files",
+         std::int64_t{256} << 20, -16384, 4096, 2, 1000, std::int64_t{4} << 20, Database::Durability::Group},
+    }};
+
+    // The settings each connection keeps for itself, readers included.
+    std::string connection_pragmas(const Database::StorageProfile& profile)
+    {
+        return "PRAGMA mmap_size = " + std::to_string(profile.mmap_size)
+             + "; PRAGMA cache_size = " + std::to_string(profile.cache_size)
+             + "; PRAGMA temp_store = " + std::to_string(profile.temp_store) + ";";
+    }
+
+    std::atomic<std::uint64_t> next_readers_id{1};
+
+#ifdef OCU_HAVE_PROBES
+    int profile_statement(unsigned, void*, void* stmt, void* duration_ns)
+    {
+        OCU_PROBE(sql__statement, sqlite3_sql(static_cast<sqlite3_stmt*>(stmt)),
+                  *static_cast<sqlite3_int64*>(duration_ns));
+        return 0;
+    }
+#endif
+}
+
+// Idle prepared statements by SQL text. Several copies of one statement
+// can exist when threads run it at the same time; the extras beyond
+// max_idle_per_sql are finalized on return.
+struct Database::StatementCache
+{
+    static constexpr std::size_t max_idle_per_sql = 4;
+
+    std::mutex mutex;
+    std::map<std::string, std::vector<sqlite3_stmt*>, std::less<>> idle;
+
+    ~StatementCache()
+    {
+        for (auto& [sql, statements] : idle)
+            for (auto* stmt : statements)
+                sqlite3_finalize(stmt);
+    }
+
+    void give_back(sqlite3_stmt* stmt) noexcept
+    {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        std::string_view sql = sqlite3_sql(stmt);
+        {
+            std::lock_guard lock(mutex);
+            auto it = idle.find(sql);
+            if (it != idle.end() && it->second.size() < max_idle_per_sql)
+            {
+                it->second.push_back(stmt);
+                return;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+};
+
+// Results of Database::lookup by query and key, least recently used
+// dropped first. The update and rollback hooks only queue what changed:
+// they run inside whichever thread's sqlite3_step made the change and must
+// not use the connection, so the next lookup applies the queue. Neither
+// of their mutexes is held while calling SQLite; `invalidating` is, so a
+// lookup cannot answer from an entry another thread is about to drop.
+//
+// With reader connections, a change is only queued once the WAL hook
+// reports its commit. Until then the readers still see the old row, and a
+// lookup may cache it; dropping the entry before the commit would not
+// stop that.
+struct Database::ResultCache
+{
+    static constexpr std::size_t max_entries = 4096;
+    static constexpr std::size_t max_pending = 1024;  // then drop everything
+
+    struct Change
+    {
+        std::string table;
+        sqlite3_int64 rowid;
+        bool deleted;
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const Rows> rows;
+        std::string table;
+        std::string key_index;  // into by_key
+        std::list<std::string>::iterator recent;
+    };
+
+    std::shared_mutex invalidating;  // held exclusively by a pass over the queue
+    std::atomic<bool> queued{false};  // pending or flush is set
+
+    std::mutex pending_mutex;
+    std::vector<Change> pending;
+    std::set<std::string, std::less<>> watched;  // tables a lookup has read
+    bool flush = false;
+    bool deferred = false;                // reader connections: queue on commit
+    std::vector<Change> uncommitted;
+    bool flush_on_commit = false;
+    std::atomic<std::uint64_t> writes{0};
+
+    std::mutex wal_hook_mutex;  // held while calling the hook, so removing it waits
+    WalHook wal_hook = nullptr;
+    void* wal_context = nullptr;
+    int autocheckpoint_frames = 0;  // without a hook; 0 never
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> recent;  // most recently used first
+    std::unordered_map<std::string, std::vector<std::string>> by_key;  // table, column, key
+    std::unordered_map<std::string, std::vector<std::string>> by_row;  // table, rowid
+    std::map<std::string, std::set<std::string>, std::less<>> key_columns;
+    std::int64_t data_version = -1;
+
+    static std::string row_index(std::string_view table, sqlite3_int64 rowid)
+    {
+        std::string index(table);
+        index += '\x1f';
+        index += std::to_string(rowid);
+        return index;
+    }
+
+    static void encode(std::string& out, const Key& key)
+    {
+        if (const auto* number = std::get_if<std::int64_t>(&key))
+            out += 'i' + std::to_string(*number);
+        else
+            out += 't' + std::get<std::string>(key);
+    }
+
+    static void unlink(std::unordered_map<std::string, std::vector<std::string>>& index,
+                       const std::string& index_key, const std::string& query)
+    {
+        auto it = index.find(index_key);
+        if (it == index.end())
+            return;
+        std::erase(it->second, query);
+        if (it->second.empty())
+            index.erase(it);
+    }
+
+    void erase(const std::string& query)
+    {
+        auto it = entries.find(query);
+        if (it == entries.end())
+            return;
+        unlink(by_key, it->second.key_index, query);
+        for (auto rowid : it->second.rows->rowids)
+            unlink(by_row, row_index(it->second.table, rowid), query);
+        recent.erase(it->second.recent);
+        entries.erase(it);
+    }
+
+    int erase_indexed(std::unordered_map<std::string, std::vector<std::string>>& index, const std::string& index_key)
+    {
+        auto it = index.find(index_key);
+        if (it == index.end())
+            return 0;
+        auto queries = it->second;
+        for (const auto& query : queries)
+            erase(query);
+        return static_cast<int>(queries.size());
+    }
+
+    void insert(const std::string& query, std::string_view table, std::string key_index,
+                std::shared_ptr<const Rows> rows)
+    {
+        erase(query);
+        if (entries.size() >= max_entries)
+        {
+            std::string oldest = recent.back();
+            erase(oldest);
+        }
+
+        recent.push_front(query);
+        for (auto rowid : rows->rowids)
+            by_row[row_index(table, rowid)].push_back(query);
+        by_key[key_index].push_back(query);
+        entries.emplace(query, Entry{std::move(rows), std::string(table), std::move(key_index), recent.begin()});
+    }
+
+    void clear()
+    {
+        entries.clear();
+        recent.clear();
+        by_key.clear();
+        by_row.clear();
+    }
+
+    void queue(std::string_view table, sqlite3_int64 rowid, bool deleted)
+    {
+        std::lock_guard lock(pending_mutex);
+        // No lookup reads the audit tables; their batches would only
+        // fill the queue until everything is dropped.
+        if (!watched.contains(table))
+            return;
+        writes.fetch_add(1, std::memory_order_relaxed);
+        auto& changes = deferred ? uncommitted : pending;
+        bool& overflow = deferred ? flush_on_commit : flush;
+        if (!overflow && changes.size() >= max_pending)
+        {
+            changes.clear();
+            overflow = true;
+        }
+        else if (!overflow)
+            changes.push_back({std::string(table), rowid, deleted});
+        if (!deferred)
+            queued.store(true, std::memory_order_release);
+    }
+
+    void commit()
+    {
+        std::lock_guard lock(pending_mutex);
+        if (uncommitted.empty() && !flush_on_commit)
+            return;
+        // Also a write for lookups whose read began before the commit.
+        writes.fetch_add(1, std::memory_order_relaxed);
+        if (flush_on_commit || pending.size() + uncommitted.size() > max_pending)
+        {
+            pending.clear();
+            flush = true;
+        }
+        else if (!flush)
+            pending.insert(pending.end(), uncommitted.begin(), uncommitted.end());
+        uncommitted.clear();
+        flush_on_commit = false;
+        queued.store(true, std::memory_order_release);
+    }
+
+    static void on_update(void* self, int operation, const char*, const char* table, sqlite3_int64 rowid)
+    {
+        static_cast<ResultCache*>(self)->queue(table, rowid, operation == SQLITE_DELETE);
+    }
+
+    static void on_rollback(void* self)
+    {
+        auto* cache = static_cast<ResultCache*>(self);
+        std::lock_guard lock(cache->pending_mutex);
+        if (cache->deferred)
+        {
+            // The readers never saw these changes.
+            cache->uncommitted.clear();
+            cache->flush_on_commit = false;
+            return;
+        }
+        // Rolled-back rows may have been read into the cache meanwhile.
+        cache->writes.fetch_add(1, std::memory_order_relaxed);
+        cache->pending.clear();
+        cache->flush = true;
+        cache->queued.store(true, std::memory_order_release);
+    }
+
+    static int on_commit(void* self, sqlite3* db, const char* schema, int frames)
+    {
+        auto* cache = static_cast<ResultCache*>(self);
+        cache->commit();
+
+        // An attached file's log is not the one a hook keeps track of.
+        std::lock_guard lock(cache->wal_hook_mutex);
+        if (cache->wal_hook && std::string_view(schema) == "main")
+            return cache->wal_hook(cache->wal_context, db, schema, frames);
+        // Installing this hook turned SQLite's own auto-checkpoint off.
+        if (cache->autocheckpoint_frames > 0 && frames >= cache->autocheckpoint_frames)
+            sqlite3_wal_checkpoint(db, schema);
+        return SQLITE_OK;
+    }
+};
+
+// Read-only connections to the database file, one per thread that reads.
+// A thread finds its own in a thread_local list, without a lock; the
+// mutex is only taken to open one. Each connection and its statements are
+// used by that thread alone, hence SQLITE_OPEN_NOMUTEX. They stay open
+// until the Database closes.
+struct Database::Readers
+{
+    struct Connection
+    {
+        std::unique_ptr<sqlite3, SQLiteDeleter> db;
+        StatementCache statements;  // after db: finalized before close
+    };
+
+    std::uint64_t id = next_readers_id.fetch_add(1, std::memory_order_relaxed);  // never reused
+    std::string path;
+    std::string pragmas;  // from the storage profile
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Connection>> connections;
+
+    Connection* open()
+    {
+        sqlite3* raw_db = nullptr;
+        if (sqlite3_open_v2(path.c_str(), &raw_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+        {
+            LOG_WARN("Cannot open a reader connection to {}, reading on the writer: {}",
+                     path, raw_db ? sqlite3_errmsg(raw_db) : "out of memory");
+            sqlite3_close(raw_db);
+            return nullptr;
+        }
+        sqlite3_busy_timeout(raw_db, 500);
+        sqlite3_exec(raw_db, pragmas.c_str(), nullptr, nullptr, nullptr);
+
+        auto connection = std::make_unique<Connection>();
+        connection->db.reset(raw_db);
+        std::lock_guard lock(mutex);
+        connections.push_back(std::move(connection));
+        reader_connections.set(static_cast<double>(connections.size()));
+        return connections.back().get();
+    }
+};
+
 template<typename... Args>
 std::string format_string(Args&&... args)
 {
@@ -15,8 +370,16 @@ std::string format_string(Args&&... args)
     return oss.str();
 }
 
+struct Database::Migration
+{
+    int version;
+    std::string_view description;
+    void (Database::*apply)();
+};
 
-Database::Database(std::string_view path)
+
+Database::Database(std::string_view path, const StorageProfile* profile)
+    : profile_(profile ? profile : &profiles.front())
 {
     sqlite3* raw_db = nullptr;
     if(sqlite3_open(path.data(), &raw_db) != SQLITE_OK)
@@ -26,16 +389,100 @@ Database::Database(std::string_view path)
         );
         
     db_.reset(raw_db);
+    statements_ = std::make_unique<StatementCache>();
 
+    apply_profile();
     execute_sql("PRAGMA journal_mode=WAL;");
     execute_sql("PRAGMA busy_timeout=500;");
 
-    
-    init_tables();
+    migrate();
 
+    int page_size = pragma_int("page_size");
+    if (page_size != profile_->page_size)
+        LOG_INFO("Database pages stay {} bytes: the {} storage profile's {} only applies to a new file",
+                 page_size, profile_->name, profile_->page_size);
+
+    results_ = std::make_unique<ResultCache>();
+    results_->autocheckpoint_frames = profile_->wal_autocheckpoint;
+    const char* file = sqlite3_db_filename(db_.get(), "main");
+    if (file && *file)
+    {
+        readers_ = std::make_unique<Readers>();
+        readers_->path = file;
+        readers_->pragmas = connection_pragmas(*profile_);
+        results_->deferred = true;
+    }
+    sqlite3_update_hook(db_.get(), &ResultCache::on_update, results_.get());
+    sqlite3_rollback_hook(db_.get(), &ResultCache::on_rollback, results_.get());
+    sqlite3_wal_hook(db_.get(), &ResultCache::on_commit, results_.get());
+}
+
+void Database::apply_profile()
+{
+    // Before journal_mode=WAL, which writes the first page of a new file.
+    execute_sql(format_string("PRAGMA page_size = ", profile_->page_size, ";"));
+    execute_sql(connection_pragmas(*profile_));
+    execute_sql(format_string("PRAGMA journal_size_limit = ", profile_->journal_size_limit, ";"));
+    set_durability(profile_->durability);
 }
 
-void Database::init_tables()
+int Database::pragma_int(std::string_view name)
+{
+    sqlite3_stmt* stmt;
+    std::string sql = format_string("PRAGMA ", name, ";");
+    if (sqlite3_prepare_v2(db_.get(), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return 0;
+    int value = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+int Database::schema_version()
+{
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_.get(), "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(format_string("Cannot read schema version: ", sqlite3_errmsg(db_.get())));
+
+    int version = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+void Database::migrate()
+{
+    // Append only: a database records the last version applied in
+    // PRAGMA user_version and runs everything after it on open.
+    static constexpr std::array<Migration, 5> migrations
+    {{
+        {1, "base tables", &Database::create_tables},
+        {2, "validity epochs", &Database::add_validity_epochs},
+        {3, "lookup indexes and unique keys", &Database::add_lookup_indexes},
+        {4, "compacted journal segments", &Database::add_journal_segments},
+        {5, "one ticket row per token", &Database::add_unique_tokens},
+    }};
+
+    int version = schema_version();
+    int latest = migrations.back().version;
+    if (version == latest)
+        return;
+    if (version > latest)
+    {
+        LOG_WARN("Database schema version {} is newer than this build knows ({}); leaving it as is", version, latest);
+        return;
+    }
+
+    for (const auto& migration : migrations)
+    {
+        if (migration.version <= version)
+            continue;
+
+        LOG_INFO("Migrating database schema to version {}: {}", migration.version, migration.description);
+        (this->*migration.apply)();
+        execute_sql(format_string("PRAGMA user_version = ", migration.version, ";"));
+    }
+}
+
+void Database::create_tables()
 {
     constexpr std::array table_schemas = 
     {
@@ -49,7 +496,9 @@ void Database::init_tables()
             "card_number TEXT,"
             "valid_from TEXT,"
             "valid_to TEXT,"
-            "traffic_area_group TEXT);"
+            "traffic_area_group TEXT,"
+            "valid_from_epoch INTEGER,"
+            "valid_to_epoch INTEGER);"
         },
         std::string_view
         {
@@ -118,7 +567,9 @@ void Database::init_tables()
             "traffic_zone INTEGER,"
             "article_id INTEGER,"
             "invoice_item_id INTEGER,"
-            "token TEXT)"
+            "token TEXT,"
+            "valid_from_epoch INTEGER,"
+            "valid_to_epoch INTEGER)"
             /*public class Ticket
             {
                 public long Id { get; set; }
@@ -139,7 +590,691 @@ void Database::init_tables()
     
     for (const auto& schema : table_schemas) 
         execute_sql(schema);
-    
+}
+
+void Database::add_validity_epochs()
+{
+    // Validity as Unix seconds next to the local-time text, so validation
+    // compares integers in SQL instead of parsing dates per request.
+    for (std::string_view table : {"coupons", "tickets"})
+    {
+        add_epoch_columns(table);
+        backfill_epochs(table);
+    }
+}
+
+void Database::add_lookup_indexes()
+{
+    // Every lookup on the validation path is answered from an index that
+    // covers it; the ids the upstream services assign become unique keys,
+    // so re-fetching a coupon, article or ticket replaces its row.
+    constexpr std::array indexes =
+    {
+        "CREATE UNIQUE INDEX IF NOT EXISTS ux_coupons_coupon_id ON coupons(coupon_id);",
+        "CREATE UNIQUE INDEX IF NOT EXISTS ux_articles_article_id ON articles(article_id);",
+        "CREATE UNIQUE INDEX IF NOT EXISTS ux_tickets_ticket_id ON tickets(ticket_id);",
+        "CREATE INDEX IF NOT EXISTS idx_coupons_card_validity "
+        "ON coupons(card_number, valid_from_epoch, valid_to_epoch);",
+        "CREATE INDEX IF NOT EXISTS idx_tickets_token_validity "
+        "ON tickets(token, valid_from_epoch, valid_to_epoch);",
+        "CREATE INDEX IF NOT EXISTS idx_tickets_valid_to ON tickets(valid_to_epoch, token);",
+    };
+
+    // One transaction: readers see either the old tables or the
+    // deduplicated, indexed ones.
+    execute_sql("BEGIN IMMEDIATE;");
+    try
+    {
+        execute_sql("UPDATE coupons SET coupon_id = NULL WHERE coupon_id = 0;");
+        int removed = remove_duplicates("coupons", "coupon_id")
+                    + remove_duplicates("articles", "article_id")
+                    + remove_duplicates("tickets", "ticket_id");
+        for (const char* index : indexes)
+            execute_sql(index);
+        execute_sql("COMMIT;");
+        if (removed > 0)
+            LOG_INFO("Removed {} duplicate rows before adding unique keys", removed);
+    }
+    catch (const std::exception&)
+    {
+        sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+void Database::add_journal_segments()
+{
+    // One row per audit journal segment moved into the audit tables, in
+    // the same transaction as its rows: a segment replayed after a crash
+    // between that commit and deleting its file is not imported twice.
+    execute_sql(
+        "CREATE TABLE IF NOT EXISTS journal_segments("
+        "sequence INTEGER PRIMARY KEY,"
+        "rows INTEGER,"
+        "compacted_at TEXT DEFAULT(datetime('now','localtime')));");
+}
+
+void Database::add_unique_tokens()
+{
+    // A ticket activated offline was stored without a ticket_id, and the
+    // same ticket streamed later got a second row. The streamed row keeps
+    // the offline validity window if it has none of its own, the offline
+    // row goes, and of any other rows sharing a token the newest wins.
+    execute_sql("BEGIN IMMEDIATE;");
+    try
+    {
+        execute_sql(
+            "UPDATE tickets SET (valid_from, valid_to, valid_from_epoch, valid_to_epoch) = "
+            "(SELECT o.valid_from, o.valid_to, o.valid_from_epoch, o.valid_to_epoch FROM tickets o "
+            "WHERE o.token = tickets.token AND o.ticket_id IS NULL AND o.valid_to_epoch IS NOT NULL "
+            "ORDER BY o.id LIMIT 1) "
+            "WHERE ticket_id IS NOT NULL AND valid_to_epoch IS NULL AND token IN "
+            "(SELECT token FROM tickets WHERE ticket_id IS NULL AND valid_to_epoch IS NOT NULL);");
+        execute_sql(
+            "DELETE FROM tickets WHERE ticket_id IS NULL AND token IN "
+            "(SELECT token FROM tickets WHERE ticket_id IS NOT NULL);");
+        execute_sql(
+            "DELETE FROM tickets WHERE token IS NOT NULL AND token != '' AND id NOT IN "
+            "(SELECT max(id) FROM tickets WHERE token IS NOT NULL AND token != '' GROUP BY token);");
+        execute_sql(
+            "CREATE UNIQUE INDEX IF NOT EXISTS ux_tickets_token ON tickets(token) "
+            "WHERE token IS NOT NULL AND token != '';");
+        execute_sql("COMMIT;");
+    }
+    catch (const std::exception&)
+    {
+        sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+int Database::remove_duplicates(std::string_view table, std::string_view key)
+{
+    // Earlier builds appended a row per fetch; the newest copy wins.
+    execute_sql(format_string(
+        "DELETE FROM ", table, " WHERE ", key, " IS NOT NULL AND id NOT IN "
+        "(SELECT max(id) FROM ", table, " WHERE ", key, " IS NOT NULL GROUP BY ", key, ");"));
+    return sqlite3_changes(db_.get());
+}
+
+bool Database::has_column(std::string_view table, std::string_view column)
+{
+    std::string sql = format_string("PRAGMA table_info(", table, ");");
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_.get(), sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(format_string("Cannot read schema of ", table, ": ", sqlite3_errmsg(db_.get())));
+
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        found = column == reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+void Database::add_epoch_columns(std::string_view table)
+{
+    for (std::string_view column : {"valid_from_epoch", "valid_to_epoch"})
+    {
+        if (!has_column(table, column))
+            execute_sql(format_string("ALTER TABLE ", table, " ADD COLUMN ", column, " INTEGER;"));
+    }
+}
+
+void Database::backfill_epochs(std::string_view table)
+{
+    // Rows written before the epoch columns existed. The text is local
+    // time; SQLite's 'utc' modifier converts it the way mktime would.
+    // Done in id ranges, one short transaction each, so another process
+    // writing to the file is never locked out for the whole table.
+    constexpr sqlite3_int64 batch = 5000;
+
+    std::string range_sql = format_string(
+        "SELECT min(id), max(id) FROM ", table,
+        " WHERE valid_from_epoch IS NULL AND valid_to_epoch IS NULL "
+        "AND (valid_from IS NOT NULL OR valid_to IS NOT NULL);");
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db_.get(), range_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(format_string("Cannot scan ", table, ": ", sqlite3_errmsg(db_.get())));
+    bool pending = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+    sqlite3_int64 first = pending ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_int64 last = pending ? sqlite3_column_int64(stmt, 1) : 0;
+    sqlite3_finalize(stmt);
+    if (!pending)
+        return;
+
+    std::string update_sql = format_string(
+        "UPDATE ", table, " SET "
+        "valid_from_epoch = CAST(strftime('%s', valid_from, 'utc') AS INTEGER), "
+        "valid_to_epoch = CAST(strftime('%s', valid_to, 'utc') AS INTEGER) "
+        "WHERE id BETWEEN ? AND ? AND valid_from_epoch IS NULL AND valid_to_epoch IS NULL;");
+    if (sqlite3_prepare_v2(db_.get(), update_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        throw std::runtime_error(format_string("Cannot migrate ", table, ": ", sqlite3_errmsg(db_.get())));
+
+    int updated = 0;
+    for (sqlite3_int64 from = first; from <= last; from += batch)
+    {
+        sqlite3_bind_int64(stmt, 1, from);
+        sqlite3_bind_int64(stmt, 2, from + batch - 1);
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE)
+        {
+            sqlite3_finalize(stmt);
+            throw std::runtime_error(format_string("Epoch backfill of ", table, " failed: ", sqlite3_errmsg(db_.get())));
+        }
+        updated += sqlite3_changes(db_.get());
+    }
+    sqlite3_finalize(stmt);
+
+    LOG_INFO("Backfilled validity epochs for {} {} rows", updated, table);
+}
+
+Database::~Database() = default;
+Database::Database(Database&&) noexcept = default;
+Database& Database::operator=(Database&&) noexcept = default;
+
+Database::Transaction::Transaction(Database& db)
+    : db_(db.get())
+    , lock_(*db.transaction_mutex_)
+{
+    active_ = sqlite3_exec(db_, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+Database::Transaction::~Transaction()
+{
+    if (active_)
+        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+}
+
+int Database::Transaction::commit()
+{
+    if (!active_)
+        return SQLITE_MISUSE;
+    active_ = false;
+    int rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK)
+        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return rc;
+}
+
+Database::Statement::Statement(Statement&& other) noexcept
+    : cache_(std::exchange(other.cache_, nullptr)), stmt_(std::exchange(other.stmt_, nullptr))
+{
+}
+
+Database::Statement& Database::Statement::operator=(Statement&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        cache_ = std::exchange(other.cache_, nullptr);
+        stmt_ = std::exchange(other.stmt_, nullptr);
+    }
+    return *this;
+}
+
+void Database::Statement::reset() noexcept
+{
+    if (stmt_)
+        cache_->give_back(stmt_);
+    stmt_ = nullptr;
+    cache_ = nullptr;
+}
+
+Database::Statement Database::prepare(std::string_view sql, Plan plan)
+{
+    return checkout(db_.get(), *statements_, sql, plan);
+}
+
+Database::Statement Database::read(std::string_view sql, Plan plan)
+{
+    StatementCache* statements = nullptr;
+    if (sqlite3* db = reader_connection(statements))
+        return checkout(db, *statements, sql, plan);
+    return prepare(sql, plan);
+}
+
+sqlite3* Database::reader()
+{
+    StatementCache* statements = nullptr;
+    sqlite3* db = reader_connection(statements);
+    return db ? db : db_.get();
+}
+
+sqlite3* Database::reader_connection(StatementCache*& statements)
+{
+    if (!readers_)
+        return nullptr;
+
+    // One entry per Database this thread has read from; a failed open is
+    // remembered too, so it is not retried on every read.
+    static thread_local std::vector<std::pair<std::uint64_t, Readers::Connection*>> owned;
+    auto it = std::find_if(owned.begin(), owned.end(), [this](const auto& entry) { return entry.first == readers_->id; });
+    Readers::Connection* connection = it != owned.end() ? it->second : owned.emplace_back(readers_->id, readers_->open()).second;
+    if (!connection)
+        return nullptr;
+    statements = &connection->statements;
+    return connection->db.get();
+}
+
+Database::Statement Database::checkout(sqlite3* db, StatementCache& cache, std::string_view sql, Plan plan)
+{
+    {
+        std::lock_guard lock(cache.mutex);
+        auto it = cache.idle.find(sql);
+        if (it != cache.idle.end() && !it->second.empty())
+        {
+            sqlite3_stmt* stmt = it->second.back();
+            it->second.pop_back();
+            statement_cache_hits.inc();
+            return Statement(&cache, stmt);
+        }
+    }
+
+    // Compiled outside the lock: preparing can take longer than running
+    // the statement, and other threads may want other statements meanwhile.
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v3(db, sql.data(), static_cast<int>(sql.size()),
+                           SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+        return {};
+    statement_cache_misses.inc();
+    if (plan == Plan::Indexed)
+        check_plan(db, stmt);
+
+    {
+        std::lock_guard lock(cache.mutex);
+        cache.idle.try_emplace(std::string(sql));
+    }
+    return Statement(&cache, stmt);
+}
+
+void Database::check_plan(sqlite3* db, sqlite3_stmt* stmt)
+{
+    // Once per compiled statement, so the cost stays off the hot path.
+    std::string sql = format_string("EXPLAIN QUERY PLAN ", sqlite3_sql(stmt));
+    sqlite3_stmt* explain;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &explain, nullptr) != SQLITE_OK)
+        return;
+
+    while (sqlite3_step(explain) == SQLITE_ROW)
+    {
+        const char* detail = reinterpret_cast<const char*>(sqlite3_column_text(explain, 3));
+        std::string_view step = detail ? detail : "";
+        if (step.substr(0, 5) == "SCAN " && step != "SCAN CONSTANT ROW")
+        {
+            scan_plans.inc();
+            LOG_WARN("Query plan has a table scan ({}): {}", step, sqlite3_sql(stmt));
+        }
+    }
+    sqlite3_finalize(explain);
+}
+
+bool Database::Rows::is_null(std::size_t row, std::size_t column) const
+{
+    return std::holds_alternative<std::monostate>(at(row, column));
+}
+
+std::int64_t Database::Rows::integer(std::size_t row, std::size_t column) const
+{
+    const Value& value = at(row, column);
+    if (const auto* number = std::get_if<std::int64_t>(&value))
+        return *number;
+    if (const auto* real = std::get_if<double>(&value))
+        return static_cast<std::int64_t>(*real);
+    return 0;
+}
+
+double Database::Rows::real(std::size_t row, std::size_t column) const
+{
+    const Value& value = at(row, column);
+    if (const auto* real = std::get_if<double>(&value))
+        return *real;
+    if (const auto* number = std::get_if<std::int64_t>(&value))
+        return static_cast<double>(*number);
+    return 0.0;
+}
+
+std::string_view Database::Rows::text(std::size_t row, std::size_t column) const
+{
+    const auto* text = std::get_if<std::string>(&at(row, column));
+    return text ? std::string_view(*text) : std::string_view();
+}
+
+std::shared_ptr<const Database::Rows> Database::lookup(std::string_view table, std::string_view key_column,
+                                                       std::string_view columns, const Key& key)
+{
+    invalidate_results();
+
+    std::string sql = format_string("SELECT rowid, ", columns, " FROM ", table, " WHERE ", key_column, " = ?1;");
+    std::string query = sql + '\x1f';
+    ResultCache::encode(query, key);
+    std::string key_index = format_string(table, '\x1f', key_column, '\x1f');
+    ResultCache::encode(key_index, key);
+
+    {
+        std::lock_guard lock(results_->mutex);
+        auto it = results_->entries.find(query);
+        if (it != results_->entries.end())
+        {
+            results_->recent.splice(results_->recent.begin(), results_->recent, it->second.recent);
+            result_cache_hits.inc();
+            return it->second.rows;
+        }
+        results_->key_columns[std::string(table)].emplace(key_column);
+    }
+    {
+        // Before `writes` is read below, so no write to the table is missed.
+        std::lock_guard lock(results_->pending_mutex);
+        if (!results_->watched.contains(table))
+            results_->watched.emplace(table);
+    }
+    result_cache_misses.inc();
+
+    // A write while the query runs could be missing from its result or
+    // already invalidated; the result is then returned but not kept.
+    std::uint64_t writes = results_->writes.load(std::memory_order_relaxed);
+
+    auto statement = read(sql);
+    sqlite3_stmt* stmt = statement.get();
+    if (!stmt)
+        return nullptr;
+
+    if (const auto* number = std::get_if<std::int64_t>(&key))
+        sqlite3_bind_int64(stmt, 1, *number);
+    else
+    {
+        const auto& text = std::get<std::string>(key);
+        sqlite3_bind_text(stmt, 1, text.data(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+    }
+
+    auto rows = std::make_shared<Rows>();
+    rows->columns = static_cast<std::size_t>(sqlite3_column_count(stmt) - 1);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        rows->rowids.push_back(sqlite3_column_int64(stmt, 0));
+        for (int column = 1; column <= static_cast<int>(rows->columns); ++column)
+        {
+            switch (sqlite3_column_type(stmt, column))
+            {
+            case SQLITE_NULL:
+                rows->values.emplace_back();
+                break;
+            case SQLITE_INTEGER:
+                rows->values.emplace_back(std::int64_t{sqlite3_column_int64(stmt, column)});
+                break;
+            case SQLITE_FLOAT:
+                rows->values.emplace_back(sqlite3_column_double(stmt, column));
+                break;
+            default:
+                rows->values.emplace_back(std::string(
+                    reinterpret_cast<const char*>(sqlite3_column_text(stmt, column)),
+                    static_cast<std::size_t>(sqlite3_column_bytes(stmt, column))));
+                break;
+            }
+        }
+    }
+    if (rc != SQLITE_DONE)
+        return nullptr;
+    statement.reset();
+
+    // Checked under the cache lock: a commit queued after this check is
+    // applied after the insert, so it still drops the entry. On the writer,
+    // inside another thread's open transaction, the rows may be rolled back.
+    std::lock_guard lock(results_->mutex);
+    if (results_->writes.load(std::memory_order_relaxed) == writes
+        && (readers_ || sqlite3_get_autocommit(db_.get())))
+        results_->insert(query, table, std::move(key_index), rows);
+    return rows;
+}
+
+void Database::invalidate_results()
+{
+    if (!results_->queued.load(std::memory_order_acquire))
+    {
+        // Nothing new, but a pass another thread is making may be about to
+        // drop entries this lookup would otherwise return.
+        std::shared_lock wait(results_->invalidating);
+        return;
+    }
+
+    std::lock_guard invalidating(results_->invalidating);
+    std::vector<ResultCache::Change> changes;
+    bool flush;
+    {
+        std::lock_guard lock(results_->pending_mutex);
+        changes.swap(results_->pending);
+        flush = std::exchange(results_->flush, false);
+        results_->queued.store(false, std::memory_order_relaxed);
+    }
+
+    if (flush)
+    {
+        std::lock_guard lock(results_->mutex);
+        result_cache_invalidations.inc(results_->entries.size());
+        results_->clear();
+        return;
+    }
+    if (changes.empty())
+        return;
+
+    std::map<std::string, std::set<std::string>, std::less<>> key_columns;
+    {
+        std::lock_guard lock(results_->mutex);
+        key_columns = results_->key_columns;
+    }
+
+    // An inserted or updated row can now match a lookup that did not
+    // return it: find the keys it holds, outside the cache lock.
+    std::vector<std::string> stale_keys;
+    for (const auto& change : changes)
+    {
+        auto columns = key_columns.find(change.table);
+        if (change.deleted || columns == key_columns.end())
+            continue;
+
+        for (const auto& column : columns->second)
+        {
+            auto statement = read(format_string("SELECT ", column, " FROM ", change.table, " WHERE rowid = ?1;"));
+            sqlite3_stmt* stmt = statement.get();
+            if (!stmt)
+                continue;
+            sqlite3_bind_int64(stmt, 1, change.rowid);
+            if (sqlite3_step(stmt) != SQLITE_ROW)
+                continue;
+
+            std::string key_index = format_string(change.table, '\x1f', column, '\x1f');
+            switch (sqlite3_column_type(stmt, 0))
+            {
+            case SQLITE_NULL:
+                continue;
+            case SQLITE_INTEGER:
+                ResultCache::encode(key_index, std::int64_t{sqlite3_column_int64(stmt, 0)});
+                break;
+            default:
+                ResultCache::encode(key_index, std::string(
+                    reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                    static_cast<std::size_t>(sqlite3_column_bytes(stmt, 0))));
+                break;
+            }
+            stale_keys.push_back(std::move(key_index));
+        }
+    }
+
+    std::lock_guard lock(results_->mutex);
+    int dropped = 0;
+    for (const auto& change : changes)
+    {
+        if (key_columns.contains(change.table))
+            dropped += results_->erase_indexed(results_->by_row, ResultCache::row_index(change.table, change.rowid));
+    }
+    for (const auto& key_index : stale_keys)
+        dropped += results_->erase_indexed(results_->by_key, key_index);
+    result_cache_invalidations.inc(static_cast<std::uint64_t>(dropped));
+}
+
+void Database::set_wal_hook(WalHook hook, void* context)
+{
+    std::lock_guard lock(results_->wal_hook_mutex);
+    results_->wal_hook = hook;
+    results_->wal_context = context;
+}
+
+bool Database::attach(const std::string& path, std::string_view schema)
+{
+    std::lock_guard lock(*transaction_mutex_);
+    sqlite3_stmt* stmt;
+    std::string sql = format_string("ATTACH DATABASE ?1 AS ", schema, ";");
+    int rc = sqlite3_prepare_v2(db_.get(), sql.c_str(), -1, &stmt, nullptr);
+    if (rc == SQLITE_OK)
+    {
+        sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_OK)
+    {
+        LOG_ERROR("Cannot attach {}: {}", path, sqlite3_errmsg(db_.get()));
+        return false;
+    }
+
+    // Page size first: journal_mode=WAL writes the first page of a new file.
+    std::string pragmas = format_string(
+        "PRAGMA ", schema, ".page_size = ", profile_->page_size, "; "
+        "PRAGMA ", schema, ".journal_mode = WAL; "
+        "PRAGMA ", schema, ".synchronous = ", pragma_int("main.synchronous"), "; "
+        "PRAGMA ", schema, ".journal_size_limit = ", profile_->journal_size_limit, ";");
+    if (sqlite3_exec(db_.get(), pragmas.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        LOG_ERROR("Cannot set up {}: {}", path, sqlite3_errmsg(db_.get()));
+        sqlite3_exec(db_.get(), format_string("DETACH DATABASE ", schema, ";").c_str(), nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
+
+bool Database::detach(std::string_view schema)
+{
+    std::lock_guard lock(*transaction_mutex_);
+
+    // Idle statements naming the schema would fail once it is gone.
+    std::string qualified = format_string(schema, ".");
+    {
+        std::lock_guard idle_lock(statements_->mutex);
+        std::erase_if(statements_->idle, [&](auto& entry)
+        {
+            if (entry.first.find(qualified) == std::string::npos)
+                return false;
+            for (auto* stmt : entry.second)
+                sqlite3_finalize(stmt);
+            return true;
+        });
+    }
+
+    std::string sql = format_string("DETACH DATABASE ", schema, ";");
+    if (sqlite3_exec(db_.get(), sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        LOG_ERROR("Cannot detach {}: {}", schema, sqlite3_errmsg(db_.get()));
+        return false;
+    }
+    return true;
+}
+
+bool Database::poll_external_writes()
+{
+    auto statement = prepare("PRAGMA data_version;");
+    sqlite3_stmt* stmt = statement.get();
+    if (!stmt || sqlite3_step(stmt) != SQLITE_ROW)
+        return false;
+    std::int64_t version = sqlite3_column_int64(stmt, 0);
+
+    std::lock_guard lock(results_->mutex);
+    bool changed = results_->data_version != -1 && results_->data_version != version;
+    if (changed)
+    {
+        result_cache_invalidations.inc(results_->entries.size());
+        results_->clear();
+    }
+    results_->data_version = version;
+    return changed;
+}
+
+std::optional<Database::Durability> Database::parse_durability(std::string_view name) noexcept
+{
+    for (auto durability : {Durability::Strict, Durability::Group, Durability::Relaxed})
+        if (name == durability_name(durability))
+            return durability;
+    return std::nullopt;
+}
+
+std::string_view Database::durability_name(Durability durability) noexcept
+{
+    switch (durability)
+    {
+    case Durability::Strict:
+        return "strict";
+    case Durability::Group:
+        return "group";
+    case Durability::Relaxed:
+        return "relaxed";
+    }
+    return "unknown";
+}
+
+void Database::set_durability(Durability durability)
+{
+    execute_sql(durability == Durability::Relaxed ? "PRAGMA synchronous = NORMAL;" : "PRAGMA synchronous = FULL;");
+}
+
+std::span<const Database::StorageProfile> Database::storage_profiles() noexcept
+{
+    return profiles;
+}
+
+const Database::StorageProfile* Database::find_storage_profile(std::string_view name) noexcept
+{
+    for (const auto& profile : profiles)
+        if (profile.name == name)
+            return &profile;
+    return nullptr;
+}
+
+Database::CheckpointResult Database::checkpoint(int mode)
+{
+    return checkpoint(db_.get(), mode);
+}
+
+Database::CheckpointResult Database::checkpoint(sqlite3* db, int mode)
+{
+    CheckpointResult result{SQLITE_OK, 0, 0};
+    OCU_PROBE(checkpoint__start, mode);
+    {
+        Metrics::ScopedTimer timer(checkpoint_duration);
+        Tracing::Span span("checkpoint");
+        result.rc = sqlite3_wal_checkpoint_v2(
+            db,
+            nullptr,  // All databases
+            mode,
+            &result.log_frames,
+            &result.checkpointed_frames
+        );
+    }
+    OCU_PROBE(checkpoint__done, result.rc, result.log_frames, result.checkpointed_frames);
+    return result;
+}
+
+void Database::update_statement_probe()
+{
+#ifdef OCU_HAVE_PROBES
+    // SQLite's profile hook times every statement, so it is only installed
+    // while a tracer is attached to sql__statement.
+    bool enabled = OCU_PROBE_ENABLED(sql__statement);
+    if (enabled == statement_probe_installed_)
+        return;
+
+    sqlite3_trace_v2(db_.get(), enabled ? SQLITE_TRACE_PROFILE : 0, enabled ? profile_statement : nullptr, nullptr);
+    statement_probe_installed_ = enabled;
+#endif
 }
 
 void Database::execute_sql(std::string_view sql)
@@ -2,26 +2,240 @@
 
 #include "include/sqlite3.h"
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
+#include <variant>
+#include <vector>
 
 class Database
 {
+    struct StatementCache;
+    struct ResultCache;
+    struct Readers;
+    struct Migration;
+
 public:
+    struct StorageProfile;
 
-    explicit Database(std::string_view path);
-    ~Database() = default;
+    // Opens `path` tuned by `profile` (the "default" one if none).
+    explicit Database(std::string_view path, const StorageProfile* profile = nullptr);
+    ~Database();
 
     // no copy constructor or operator
     Database(const Database&) = delete;
     Database& operator=(const Database&) = delete;
 
     //allowed move for const and op
-    Database(Database&&) = default;
-    Database& operator=(Database&&) noexcept = default;
+    Database(Database&&) noexcept;
+    Database& operator=(Database&&) noexcept;
     
     [[nodiscard]]sqlite3* get() const noexcept {return db_.get();}
 
+    // A prepared statement checked out of the statement cache. Going out of
+    // scope (or reset()) resets it, clears its bindings and hands it back,
+    // so the next prepare() of the same SQL skips compilation.
+    class Statement
+    {
+    public:
+        Statement() = default;
+        ~Statement() { reset(); }
+
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+
+        Statement(Statement&& other) noexcept;
+        Statement& operator=(Statement&& other) noexcept;
+
+        [[nodiscard]] sqlite3_stmt* get() const noexcept { return stmt_; }
+        explicit operator bool() const noexcept { return stmt_ != nullptr; }
+
+        // Returns the statement to the cache now, e.g. before starting a
+        // transaction that must not see an active read.
+        void reset() noexcept;
+
+    private:
+        friend class Database;
+        Statement(StatementCache* cache, sqlite3_stmt* stmt) noexcept : cache_(cache), stmt_(stmt) {}
+
+        StatementCache* cache_ = nullptr;
+        sqlite3_stmt* stmt_ = nullptr;
+    };
+
+    // BEGIN IMMEDIATE on this connection, serialised with every other
+    // Transaction: a connection has one transaction at a time, so threads
+    // sharing it must not interleave their BEGIN and COMMIT. Rolls back on
+    // destruction unless committed.
+    class Transaction
+    {
+    public:
+        explicit Transaction(Database& db);
+        ~Transaction();
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        // False when BEGIN failed; sqlite3_errmsg has the reason.
+        explicit operator bool() const noexcept { return active_; }
+
+        // The COMMIT result code; the transaction is over either way.
+        int commit();
+
+    private:
+        sqlite3* db_;
+        std::unique_lock<std::mutex> lock_;
+        bool active_ = false;
+    };
+
+    // Whether a statement is expected to read a whole table. Indexed ones
+    // have their query plan checked when first compiled; a plan that
+    // scans is logged and counted in ocu_sqlite_scan_plans_total.
+    enum class Plan
+    {
+        Indexed,
+        Scan,
+    };
+
+    // Checks out a compiled statement for `sql`, preparing it on a cache
+    // miss. The text is the cache key, so pass the same literal each time.
+    // Empty on a prepare error; sqlite3_errmsg(get()) has the reason.
+    // Safe from any thread: a statement is only ever checked out once.
+    // This is the writer connection: use it for writes, and for reads that
+    // must see the calling thread's own uncommitted ones.
+    [[nodiscard]] Statement prepare(std::string_view sql, Plan plan = Plan::Indexed);
+
+    // Like prepare(), on the calling thread's read-only connection, opened
+    // on its first read. WAL lets it read the last commit while the writer
+    // is busy, so a lookup never waits behind ticket ingest or an audit
+    // batch. An in-memory database cannot be opened twice; it reads on the
+    // writer. Empty on a prepare error; sqlite3_errmsg(reader()) has the
+    // reason.
+    [[nodiscard]] Statement read(std::string_view sql, Plan plan = Plan::Indexed);
+
+    // The connection read() uses on this thread.
+    [[nodiscard]] sqlite3* reader();
+
+    // A column value as SQLite stored it: NULL, INTEGER, REAL or TEXT.
+    using Value = std::variant<std::monostate, std::int64_t, double, std::string>;
+    using Key = std::variant<std::int64_t, std::string>;
+
+    // Rows returned by lookup(), row-major, with the rowid of each.
+    struct Rows
+    {
+        std::size_t columns = 0;
+        std::vector<sqlite3_int64> rowids;
+        std::vector<Value> values;
+
+        [[nodiscard]] std::size_t size() const noexcept { return rowids.size(); }
+        [[nodiscard]] bool empty() const noexcept { return rowids.empty(); }
+        [[nodiscard]] const Value& at(std::size_t row, std::size_t column) const { return values[row * columns + column]; }
+        [[nodiscard]] bool is_null(std::size_t row, std::size_t column) const;
+
+        // Converted like sqlite3_column_*: NULL reads as 0 or "".
+        [[nodiscard]] std::int64_t integer(std::size_t row, std::size_t column) const;
+        [[nodiscard]] double real(std::size_t row, std::size_t column) const;
+        [[nodiscard]] std::string_view text(std::size_t row, std::size_t column) const;
+    };
+
+    // `columns` (an SQL select list) of the rows of `table` whose
+    // `key_column` equals `key`, read like read() and served from the
+    // result cache when an earlier lookup fetched them. Writes on the
+    // writer connection invalidate exactly the cached lookups they affect,
+    // through the update hook, once committed: those that returned the
+    // changed row and those for the key the row has now. Rows that INSERT
+    // OR REPLACE deletes never reach the update hook, so tables read
+    // through lookup() are written with upserts (ON CONFLICT DO UPDATE).
+    // nullptr on a query error; sqlite3_errmsg(reader()) has the reason.
+    [[nodiscard]] std::shared_ptr<const Rows> lookup(std::string_view table, std::string_view key_column,
+                                                     std::string_view columns, const Key& key);
+
+    // Called after every commit to the main file on the writer connection,
+    // as by sqlite3_wal_hook, which Database keeps for itself to learn when its
+    // writes become visible to the readers. Without a hook, the log is
+    // checkpointed once it reaches the storage profile's
+    // wal_autocheckpoint frames, as SQLite's own auto-checkpoint would.
+    using WalHook = int (*)(void* context, sqlite3* db, const char* schema, int frames);
+    void set_wal_hook(WalHook hook, void* context);
+
+    // ATTACHes the database file at `path` to the writer connection as
+    // `schema` (an identifier, not quoted), between transactions, with the
+    // main file's synchronous mode and the storage profile's log settings.
+    // False on failure, with the reason logged. detach() also drops the
+    // cached statements naming `schema`.
+    bool attach(const std::string& path, std::string_view schema);
+    bool detach(std::string_view schema);
+
+    // Drops every cached result if another process wrote to the file since
+    // the last call (PRAGMA data_version on the writer, which unlike a
+    // reader's does not count this process's own commits), since the
+    // update hook only sees this connection. True if it did. Called from
+    // the main loop.
+    bool poll_external_writes();
+
+    // How durable a validation or purchase is when its reply is sent:
+    //   Strict   committed, with the WAL fsynced (synchronous=FULL).
+    //   Group    queued for the next audit batch, whose commit fsyncs the
+    //            WAL; a crash loses at most one flush interval of rows.
+    //   Relaxed  queued; commits skip the fsync (synchronous=NORMAL) and
+    //            reach the disk with the next checkpoint.
+    enum class Durability
+    {
+        Strict,
+        Group,
+        Relaxed,
+    };
+
+    [[nodiscard]] static std::optional<Durability> parse_durability(std::string_view name) noexcept;
+    [[nodiscard]] static std::string_view durability_name(Durability durability) noexcept;
+
+    // PRAGMA synchronous for `durability`, for every write on this
+    // connection: the audit writer's batches and ticket ingest alike.
+    void set_durability(Durability durability);
+
+    // SQLite tuning for the storage under the database file, applied when
+    // it is opened. Sizes are bytes unless noted.
+    struct StorageProfile
+    {
+        std::string_view name;
+        std::string_view description;
+        std::int64_t mmap_size;           // read through a mapping; 0 disables
+        int cache_size;                   // as PRAGMA cache_size: KiB if negative, else pages
+        int page_size;                    // only takes effect on a new file
+        int temp_store;                   // 0 default, 1 file, 2 memory
+        int wal_autocheckpoint;           // log frames that make a checkpoint due
+        std::int64_t journal_size_limit;  // log kept after a checkpoint; -1 keeps all
+        Durability durability;            // synchronous mode unless --durability says otherwise
+    };
+
+    // The built-in profiles, "default" (SQLite's own settings) first.
+    [[nodiscard]] static std::span<const StorageProfile> storage_profiles() noexcept;
+    [[nodiscard]] static const StorageProfile* find_storage_profile(std::string_view name) noexcept;
+
+    [[nodiscard]] const StorageProfile& storage_profile() const noexcept { return *profile_; }
+
+    struct CheckpointResult
+    {
+        int rc;
+        int log_frames;
+        int checkpointed_frames;
+    };
+
+    // Runs a WAL checkpoint on all attached databases and records its
+    // duration in the ocu_sqlite_checkpoint_duration_seconds histogram.
+    // The static overload runs it on another connection to the same file,
+    // such as the checkpoint scheduler's own.
+    [[nodiscard]] CheckpointResult checkpoint(int mode = SQLITE_CHECKPOINT_FULL);
+    [[nodiscard]] static CheckpointResult checkpoint(sqlite3* db, int mode);
+
+    // Installs or removes the statement profiling hook behind the
+    // sql__statement probe, depending on whether a tracer is attached.
+    // Called periodically from the main loop.
+    void update_statement_probe();
+
 
 private:
 
@@ -34,7 +248,37 @@ private:
     };
 
     std::unique_ptr<sqlite3, SQLiteDeleter> db_;
+    std::unique_ptr<StatementCache> statements_;  // after db_: finalized before close
+    std::unique_ptr<ResultCache> results_;
+    std::unique_ptr<Readers> readers_;  // unset for an in-memory database
+    const StorageProfile* profile_;
+    std::unique_ptr<std::mutex> transaction_mutex_ = std::make_unique<std::mutex>();
+    bool statement_probe_installed_ = false;
     void execute_sql(std::string_view sql);
+    void apply_profile();
+    [[nodiscard]] int pragma_int(std::string_view name);
+
+    // Applies the migrations newer than PRAGMA user_version, in order,
+    // recording each; does nothing when the schema is current.
+    void migrate();
+    [[nodiscard]] int schema_version();
+
+    // Migrations. Each is idempotent, so one interrupted before its
+    // version was recorded simply runs again.
+    void create_tables();
+    void add_validity_epochs();
+    void add_lookup_indexes();
+    void add_journal_segments();
+    void add_unique_tokens();
+
+    [[nodiscard]] bool has_column(std::string_view table, std::string_view column);
+    void add_epoch_columns(std::string_view table);
+    void backfill_epochs(std::string_view table);
+    int remove_duplicates(std::string_view table, std::string_view key);
+    [[nodiscard]] static Statement checkout(sqlite3* db, StatementCache& cache, std::string_view sql, Plan plan);
+    static void check_plan(sqlite3* db, sqlite3_stmt* stmt);
+    [[nodiscard]] sqlite3* reader_connection(StatementCache*& statements);  // nullptr: use the writer
 
-    void init_tables();
+    // Applies the changes the hooks queued since the last lookup.
+    void invalidate_results();
 };
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "datetime.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+namespace DateTime
+{
+    namespace
+    {
+        constexpr std::int64_t seconds_per_day = 86'400;
+        constexpr std::int64_t table_begin = days_from_civil(1970, 1, 1) * seconds_per_day;
+        constexpr std::int64_t table_end = days_from_civil(2100, 1, 1) * seconds_per_day;
+
+        // Offsets change at most a few times a year; a week between samples
+        // finds every change as long as two are never within one week.
+        constexpr std::int64_t sample_step = 7 * seconds_per_day;
+
+        std::int32_t libc_offset(std::int64_t epoch) noexcept
+        {
+            std::time_t time = static_cast<std::time_t>(epoch);
+            std::tm tm{};
+            localtime_r(&time, &tm);
+            return static_cast<std::int32_t>(tm.tm_gmtoff);
+        }
+
+        struct Transition
+        {
+            std::int64_t at;      // first second with the new offset
+            std::int32_t offset;
+        };
+
+        // Lookups index `first` by the bucket the time falls in, then step
+        // over the few transitions inside that bucket: no binary search.
+        constexpr int bucket_shift = 21;  // about 24 days
+
+        struct Zone
+        {
+            std::int32_t initial_offset;
+            std::vector<Transition> transitions;
+            std::vector<std::uint32_t> first;  // transitions before each bucket
+        };
+
+        Zone build_zone()
+        {
+            Zone zone{libc_offset(table_begin), {}, {}};
+            std::int32_t previous = zone.initial_offset;
+            for (std::int64_t t = table_begin + sample_step; t < table_end + sample_step; t += sample_step)
+            {
+                std::int32_t offset = libc_offset(t);
+                if (offset == previous)
+                    continue;
+
+                std::int64_t low = t - sample_step;
+                std::int64_t high = t;
+                while (high - low > 1)
+                {
+                    std::int64_t middle = low + (high - low) / 2;
+                    (libc_offset(middle) == previous ? low : high) = middle;
+                }
+                zone.transitions.push_back({high, offset});
+                previous = offset;
+            }
+
+            std::size_t buckets = static_cast<std::size_t>((table_end - table_begin) >> bucket_shift) + 1;
+            zone.first.resize(buckets);
+            std::uint32_t count = 0;
+            for (std::size_t bucket = 0; bucket < buckets; ++bucket)
+            {
+                std::int64_t start = table_begin + (static_cast<std::int64_t>(bucket) << bucket_shift);
+                while (count < zone.transitions.size() && zone.transitions[count].at <= start)
+                    ++count;
+                zone.first[bucket] = count;
+            }
+            return zone;
+        }
+
+        const Zone& zone()
+        {
+            static const Zone loaded = build_zone();
+            return loaded;
+        }
+
+        // Two ASCII digits; out of range when either is not a digit.
+        constexpr unsigned two_digits(const char* p) noexcept
+        {
+            unsigned tens = static_cast<unsigned char>(p[0]) - '0';
+            unsigned ones = static_cast<unsigned char>(p[1]) - '0';
+            return tens < 10 && ones < 10 ? tens * 10 + ones : 100;
+        }
+
+        constexpr void put_two_digits(char* out, unsigned value) noexcept
+        {
+            out[0] = static_cast<char>('0' + value / 10);
+            out[1] = static_cast<char>('0' + value % 10);
+        }
+    }
+
+    std::int32_t utc_offset(std::int64_t epoch) noexcept
+    {
+        if (epoch < table_begin || epoch >= table_end)
+            return libc_offset(epoch);
+
+        const Zone& local = zone();
+        std::size_t count = local.first[static_cast<std::size_t>((epoch - table_begin) >> bucket_shift)];
+        while (count < local.transitions.size() && local.transitions[count].at <= epoch)
+            ++count;
+        return count ? local.transitions[count - 1].offset : local.initial_offset;
+    }
+
+    std::size_t load_zone()
+    {
+        return zone().transitions.size();
+    }
+
+    std::optional<std::int64_t> parse_local(std::string_view text) noexcept
+    {
+        if (text.size() < text_size)
+            return std::nullopt;
+
+        const char* p = text.data();
+        unsigned century = two_digits(p);
+        unsigned year = two_digits(p + 2);
+        unsigned month = two_digits(p + 5);
+        unsigned day = two_digits(p + 8);
+        unsigned hour = two_digits(p + 11);
+        unsigned minute = two_digits(p + 14);
+        unsigned second = two_digits(p + 17);
+
+        bool separators = (p[4] == '-') & (p[7] == '-') & ((p[10] == 'T') | (p[10] == ' '))
+                        & (p[13] == ':') & (p[16] == ':');
+        bool ranges = (century < 100) & (year < 100) & (month - 1 < 12) & (day - 1 < 31)
+                    & (hour < 24) & (minute < 60) & (second < 61);
+        if (!(separators & ranges))
+            return std::nullopt;
+
+        std::int64_t local = days_from_civil(century * 100 + year, month, day) * seconds_per_day
+                           + hour * 3600 + minute * 60 + second;
+
+        // The offsets a day either side bracket any change near `local`.
+        std::int32_t before = utc_offset(local - seconds_per_day);
+        std::int32_t after = utc_offset(local + seconds_per_day);
+        if (before == after || utc_offset(local - before) == before)
+            return local - before;
+        if (utc_offset(local - after) == after)
+            return local - after;
+        return local - before;
+    }
+
+    void format_local(std::int64_t epoch, char* out) noexcept
+    {
+        std::int64_t local = epoch + utc_offset(epoch);
+        std::int64_t days = local / seconds_per_day;
+        std::int64_t seconds = local % seconds_per_day;
+        if (seconds < 0)
+        {
+            seconds += seconds_per_day;
+            --days;
+        }
+
+        Civil date = civil_from_days(days);
+        auto year = static_cast<unsigned>(date.year);
+        put_two_digits(out, year / 100 % 100);
+        put_two_digits(out + 2, year % 100);
+        out[4] = '-';
+        put_two_digits(out + 5, date.month);
+        out[7] = '-';
+        put_two_digits(out + 8, date.day);
+        out[10] = 'T';
+        put_two_digits(out + 11, static_cast<unsigned>(seconds / 3600));
+        out[13] = ':';
+        put_two_digits(out + 14, static_cast<unsigned>(seconds / 60 % 60));
+        out[16] = ':';
+        put_two_digits(out + 17, static_cast<unsigned>(seconds % 60));
+    }
+
+    std::string format_local(std::int64_t epoch)
+    {
+        std::string text(text_size, '\0');
+        format_local(epoch, text.data());
+        return text;
+    }
+
+    std::string format_local(std::chrono::system_clock::time_point time)
+    {
+        return format_local(std::chrono::floor<std::chrono::seconds>(time.time_since_epoch()).count());
+    }
+
+    namespace libc
+    {
+        std::optional<std::int64_t> parse_local(std::string_view text) noexcept
+        {
+            char buffer[32];
+            std::size_t size = std::min(text.size(), sizeof(buffer) - 1);
+            std::copy_n(text.data(), size, buffer);
+            buffer[size] = '\0';
+
+            std::tm tm{};
+            if (std::sscanf(buffer, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                            &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+                return std::nullopt;
+
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+            tm.tm_isdst = -1;
+            std::time_t time = std::mktime(&tm);
+            if (time == -1)
+                return std::nullopt;
+            return time;
+        }
+
+        void format_local(std::int64_t epoch, char* out) noexcept
+        {
+            std::time_t time = static_cast<std::time_t>(epoch);
+            std::tm tm{};
+            localtime_r(&time, &tm);
+            char buffer[32];
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+            std::copy_n(buffer, text_size, out);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Local-time text as the database stores it ("2024-01-15T10:30:00") and
+// Unix seconds, converted without libc.
+//
+// Dates are civil-from-days arithmetic; the UTC offset comes from a table
+// of the process time zone's transitions (TZ or /etc/localtime), sampled
+// from localtime_r once on first use for 1970-2100. Outside that range,
+// the libc functions answer. Nothing here allocates except the std::string
+// overload of format_local, and nothing takes libc's time-zone lock after
+// the table is built.
+namespace DateTime
+{
+    inline constexpr std::size_t text_size = 19;  // YYYY-MM-DDTHH:MM:SS
+
+    // Days since 1970-01-01 of a proleptic Gregorian date, and back.
+    [[nodiscard]] constexpr std::int64_t days_from_civil(std::int64_t year, unsigned month, unsigned day) noexcept
+    {
+        year -= month <= 2;
+        std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+        auto year_of_era = static_cast<unsigned>(year - era * 400);
+        unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+        return era * 146097 + static_cast<std::int64_t>(day_of_era) - 719468;
+    }
+
+    struct Civil
+    {
+        std::int64_t year;
+        unsigned month;
+        unsigned day;
+    };
+
+    [[nodiscard]] constexpr Civil civil_from_days(std::int64_t days) noexcept
+    {
+        days += 719468;
+        std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        auto day_of_era = static_cast<unsigned>(days - era * 146097);
+        unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        unsigned month_index = (5 * day_of_year + 2) / 153;
+        unsigned day = day_of_year - (153 * month_index + 2) / 5 + 1;
+        unsigned month = month_index < 10 ? month_index + 3 : month_index - 9;
+        return {static_cast<std::int64_t>(year_of_era) + era * 400 + (month <= 2), month, day};
+    }
+
+    // Seconds east of UTC in the local zone at `epoch`.
+    [[nodiscard]] std::int32_t utc_offset(std::int64_t epoch) noexcept;
+
+    // Builds the transition table now instead of on the first conversion;
+    // returns the number of transitions found.
+    std::size_t load_zone();
+
+    // Reads the first 19 characters as local time, ignoring anything after
+    // them (fractions, offsets). A local time repeated by a DST change is
+    // its first instant (mktime picks either, depending on earlier calls);
+    // one skipped is read with the offset before the change, so 02:30
+    // becomes 03:30 as with mktime.
+    [[nodiscard]] std::optional<std::int64_t> parse_local(std::string_view text) noexcept;
+
+    // Writes exactly text_size characters, no terminator.
+    void format_local(std::int64_t epoch, char* out) noexcept;
+    [[nodiscard]] std::string format_local(std::int64_t epoch);
+    [[nodiscard]] std::string format_local(std::chrono::system_clock::time_point time);
+
+    // sscanf/mktime and localtime_r/strftime, the reference for
+    // `ocu_service bench datetime`.
+    namespace libc
+    {
+        [[nodiscard]] std::optional<std::int64_t> parse_local(std::string_view text) noexcept;
+        void format_local(std::int64_t epoch, char* out) noexcept;
+    }
+}
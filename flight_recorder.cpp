@@ -0,0 +1,147 @@
+#include "flight_recorder.hpp"
+#include "datetime.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+namespace FlightRecorder
+{
+    namespace
+    {
+        constexpr std::array<char, 8> dump_magic = {'O', 'C', 'U', 'F', 'R', 'E', 'C', '1'};
+
+        struct DumpHeader
+        {
+            std::array<char, 8> magic;
+            std::uint32_t entry_size;
+            std::uint32_t count;
+        };
+
+        constexpr std::array<std::string_view, 6> command_names =
+        {
+            "unknown", "fetch_articles", "purchase", "qr", "card", "dump_flight",
+        };
+
+        constexpr std::array<std::string_view, 4> result_names =
+        {
+            "unknown", "accepted", "rejected", "failed",
+        };
+    }
+
+    void Recorder::record(const Entry& entry) noexcept
+    {
+        auto sequence = next_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots_[sequence & (capacity - 1)];
+
+        // Seqlock: readers discard a slot whose version changed under them.
+        slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.entry = entry;
+        slot.entry.sequence = sequence;
+
+        slot.version.store(2 * sequence + 2, std::memory_order_release);
+    }
+
+    void Recorder::set_latency_threshold(std::chrono::microseconds threshold) noexcept
+    {
+        threshold_us_.store(threshold.count(), std::memory_order_relaxed);
+    }
+
+    void Recorder::note_latency(std::chrono::microseconds elapsed) noexcept
+    {
+        auto threshold = threshold_us_.load(std::memory_order_relaxed);
+        if (threshold <= 0 || elapsed.count() < threshold)
+            return;
+
+        auto now_s = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto last = last_threshold_dump_s_.load(std::memory_order_relaxed);
+
+        if (last != 0 && now_s - last < 60)
+            return;
+        if (last_threshold_dump_s_.compare_exchange_strong(last, now_s, std::memory_order_relaxed))
+            request_dump();
+    }
+
+    int Recorder::dump(const std::string& path) const
+    {
+        std::vector<Entry> entries;
+        entries.reserve(capacity);
+
+        for (const auto& slot : slots_)
+        {
+            auto before = slot.version.load(std::memory_order_acquire);
+            if (before == 0 || (before & 1))
+                continue;
+
+            Entry copy = slot.entry;
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot.version.load(std::memory_order_relaxed) == before)
+                entries.push_back(copy);
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+        {
+            return a.sequence < b.sequence;
+        });
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return -1;
+
+        DumpHeader header{dump_magic, static_cast<std::uint32_t>(sizeof(Entry)),
+                          static_cast<std::uint32_t>(entries.size())};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()),
+                   static_cast<std::streamsize>(entries.size() * sizeof(Entry)));
+
+        return file ? static_cast<int>(entries.size()) : -1;
+    }
+
+    Recorder& recorder()
+    {
+        static Recorder instance;
+        return instance;
+    }
+
+    bool print_dump(const std::string& path, std::ostream& out)
+    {
+        std::ifstream file(path, std::ios::binary);
+        DumpHeader header{};
+
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || header.magic != dump_magic || header.entry_size != sizeof(Entry))
+            return false;
+
+        out << "seq        time                       command         result    error key_hash          "
+               "read_us  parsed_us handled_us written_us\n";
+
+        Entry entry{};
+        for (std::uint32_t i = 0; i < header.count; ++i)
+        {
+            if (!file.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+                return false;
+
+            char time_text[DateTime::text_size + 1] = {};
+            DateTime::format_local(static_cast<std::int64_t>(entry.wall_time_us / 1'000'000), time_text);
+
+            char line[256];
+            std::snprintf(line, sizeof(line),
+                "%-10llu %s.%06lld %-15s %-9s %5u %016llx %8u %9u %10u %10u\n",
+                static_cast<unsigned long long>(entry.sequence),
+                time_text, static_cast<long long>(entry.wall_time_us % 1'000'000),
+                entry.command < command_names.size() ? command_names[entry.command].data() : "?",
+                static_cast<std::size_t>(entry.result) < result_names.size()
+                    ? result_names[static_cast<std::size_t>(entry.result)].data() : "?",
+                static_cast<unsigned>(entry.error),
+                static_cast<unsigned long long>(entry.key_hash),
+                entry.read_us, entry.parsed_us, entry.handled_us, entry.written_us);
+            out << line;
+        }
+        return true;
+    }
+}
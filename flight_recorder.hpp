@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// In-memory flight recorder of recent validator requests.
+//
+// Every answered request leaves one fixed-size binary entry in a ring of the
+// last `capacity` requests. Recording is a handful of relaxed atomics and a
+// 48-byte copy; nothing is formatted on the request path. A dump writes the
+// ring to a file that `ocu_service flight-dump <file>` decodes.
+//
+// Dumps are requested (SIGUSR1, the DUMP_FLIGHT command, or a request slower
+// than the latency threshold) and carried out by the main loop, so neither a
+// signal handler nor the network thread ever touches the file system.
+namespace FlightRecorder
+{
+    enum class Result : std::uint8_t
+    {
+        Unknown,
+        Accepted,
+        Rejected,
+        Failed,
+    };
+
+    struct Entry
+    {
+        std::uint64_t sequence;      // assigned by the recorder
+        std::int64_t wall_time_us;   // system clock when the connection was accepted
+        std::uint64_t key_hash;      // hash_key() of the card number or QR token, 0 if none
+        // Phase timestamps in microseconds since accept.
+        std::uint32_t read_us;
+        std::uint32_t parsed_us;
+        std::uint32_t handled_us;
+        std::uint32_t written_us;
+        std::uint8_t command;        // RequestKind
+        Result result;
+        std::uint16_t error;         // SQLite result code or 0
+        std::uint32_t reserved;
+    };
+    static_assert(sizeof(Entry) == 48, "Entry is part of the dump file format");
+
+    // FNV-1a; stable across builds so dumps from different units compare.
+    [[nodiscard]] constexpr std::uint64_t hash_key(std::string_view key) noexcept
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (char c : key)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    class Recorder
+    {
+    public:
+        static constexpr std::size_t capacity = 4096;  // power of two
+
+        // Safe to call from any thread.
+        void record(const Entry& entry) noexcept;
+
+        // Async-signal-safe.
+        void request_dump() noexcept { dump_requested_.store(true, std::memory_order_release); }
+
+        // Requests a dump when `elapsed` exceeds the threshold, at most once
+        // per minute so a sustained slowdown does not flood the disk.
+        void note_latency(std::chrono::microseconds elapsed) noexcept;
+        void set_latency_threshold(std::chrono::microseconds threshold) noexcept;
+
+        [[nodiscard]] bool take_dump_request() noexcept
+        {
+            return dump_requested_.exchange(false, std::memory_order_acq_rel);
+        }
+
+        // Writes the current ring, oldest entry first; returns the number of
+        // entries written or -1 if the file cannot be written.
+        int dump(const std::string& path) const;
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::uint64_t> version{0};  // odd while being written
+            Entry entry{};
+        };
+
+        std::array<Slot, capacity> slots_;
+        std::atomic<std::uint64_t> next_{0};
+        std::atomic<bool> dump_requested_{false};
+        std::atomic<std::int64_t> threshold_us_{0};
+        std::atomic<std::int64_t> last_threshold_dump_s_{0};
+    };
+
+    [[nodiscard]] Recorder& recorder();
+
+    // Prints a dump file as one line per request; returns false if the file
+    // is missing or not a flight recorder dump.
+    bool print_dump(const std::string& path, std::ostream& out);
+}
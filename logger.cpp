@@ -0,0 +1,336 @@
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Log
+{
+    namespace
+    {
+        // Per-thread ring size; must be a power of two. 512 records is ~128 KiB
+        // per logging thread and absorbs several seconds of request logging.
+        constexpr std::size_t ring_capacity = 512;
+
+        struct Ring
+        {
+            std::array<Record, ring_capacity> slots;
+            alignas(64) std::atomic<std::uint64_t> head{0};   // written by the owning thread
+            alignas(64) std::atomic<std::uint64_t> tail{0};   // written by the writer thread
+            std::atomic<bool> retired{false};
+        };
+
+        struct State
+        {
+            std::mutex rings_mutex;
+            std::vector<std::shared_ptr<Ring>> rings;
+
+            std::atomic<bool> running{false};
+            std::thread writer;
+
+            // Serialises synchronous writes made while the writer is not running.
+            std::mutex sync_mutex;
+        };
+
+        State& state()
+        {
+            static State instance;
+            return instance;
+        }
+
+        auto& dropped_lines = Metrics::registry().counter(
+            "ocu_log_dropped_total", "Log lines dropped because a thread's log ring was full");
+
+        struct ThreadRing
+        {
+            std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+
+            ThreadRing()
+            {
+                std::lock_guard<std::mutex> lock(state().rings_mutex);
+                state().rings.push_back(ring);
+            }
+
+            ~ThreadRing()
+            {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        };
+
+        Ring& local_ring()
+        {
+            thread_local ThreadRing local;
+            return *local.ring;
+        }
+
+        thread_local Record scratch_record;
+
+        constexpr std::string_view level_name(Level level)
+        {
+            switch (level)
+            {
+                case Level::Debug: return "DEBUG";
+                case Level::Info:  return "INFO ";
+                case Level::Warn:  return "WARN ";
+                case Level::Error: return "ERROR";
+            }
+            return "?????";
+        }
+
+        void append_timestamp(std::string& out, std::int64_t timestamp_ns)
+        {
+            // Formatting happens on the writer thread, or under sync_mutex
+            // before it starts, so caching the last second's text is safe and
+            // avoids a localtime_r per line.
+            static std::int64_t cached_second = -1;
+            static char cached_text[16];
+
+            std::int64_t second = timestamp_ns / 1'000'000'000;
+            if (second != cached_second)
+            {
+                std::time_t t = static_cast<std::time_t>(second);
+                std::tm tm{};
+                localtime_r(&t, &tm);
+                std::strftime(cached_text, sizeof(cached_text), "%H:%M:%S", &tm);
+                cached_second = second;
+            }
+
+            char millis[8];
+            std::snprintf(millis, sizeof(millis), ".%03d", static_cast<int>((timestamp_ns / 1'000'000) % 1000));
+            out += cached_text;
+            out += millis;
+        }
+
+        // Appends the next encoded argument; returns the offset after it.
+        std::size_t append_argument(std::string& out, const Record& record, std::size_t offset)
+        {
+            const char* data = record.payload.data();
+            auto type = static_cast<ArgType>(data[offset++]);
+            char buffer[32];
+
+            switch (type)
+            {
+                case ArgType::Int:
+                {
+                    std::int64_t v;
+                    std::memcpy(&v, data + offset, sizeof(v));
+                    std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(v));
+                    out += buffer;
+                    return offset + sizeof(v);
+                }
+                case ArgType::UInt:
+                {
+                    std::uint64_t v;
+                    std::memcpy(&v, data + offset, sizeof(v));
+                    std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(v));
+                    out += buffer;
+                    return offset + sizeof(v);
+                }
+                case ArgType::Double:
+                {
+                    double v;
+                    std::memcpy(&v, data + offset, sizeof(v));
+                    std::snprintf(buffer, sizeof(buffer), "%g", v);
+                    out += buffer;
+                    return offset + sizeof(v);
+                }
+                case ArgType::Bool:
+                    out += data[offset] ? "true" : "false";
+                    return offset + 1;
+                case ArgType::Char:
+                    out += data[offset];
+                    return offset + 1;
+                case ArgType::String:
+                {
+                    std::uint16_t length;
+                    std::memcpy(&length, data + offset, sizeof(length));
+                    out.append(data + offset + sizeof(length), length);
+                    return offset + sizeof(length) + length;
+                }
+            }
+            return record.size;
+        }
+
+        void format(const Record& record, std::string& out)
+        {
+            append_timestamp(out, record.timestamp_ns);
+            out += ' ';
+            out += level_name(record.level);
+            out += ' ';
+
+            std::string_view fmt = record.format;
+            std::size_t offset = 0;
+            std::size_t pos = 0;
+
+            while (pos < fmt.size())
+            {
+                auto placeholder = fmt.find("{}", pos);
+                if (placeholder == std::string_view::npos)
+                {
+                    out.append(fmt.substr(pos));
+                    break;
+                }
+
+                out.append(fmt.substr(pos, placeholder - pos));
+                if (offset < record.size)
+                    offset = append_argument(out, record, offset);
+                pos = placeholder + 2;
+            }
+
+            if (record.truncated)
+                out += " [truncated]";
+            if (out.empty() || out.back() != '\n')
+                out += '\n';
+        }
+
+        void write_out(const std::string& out, std::FILE* stream)
+        {
+            if (out.empty())
+                return;
+            std::fwrite(out.data(), 1, out.size(), stream);
+            std::fflush(stream);
+        }
+
+        // Formats and writes everything currently published; returns the
+        // number of lines written.
+        std::size_t drain()
+        {
+            static std::vector<std::shared_ptr<Ring>> rings;
+            static std::vector<std::uint64_t> heads;
+            static std::vector<const Record*> batch;
+            static std::string out;
+            static std::string err;
+            static std::uint64_t reported_drops = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(state().rings_mutex);
+                auto& all = state().rings;
+                all.erase(std::remove_if(all.begin(), all.end(), [](const std::shared_ptr<Ring>& ring)
+                {
+                    return ring->retired.load(std::memory_order_acquire)
+                        && ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+                }), all.end());
+                rings = all;
+            }
+
+            heads.clear();
+            batch.clear();
+            for (const auto& ring : rings)
+            {
+                auto head = ring->head.load(std::memory_order_acquire);
+                for (auto i = ring->tail.load(std::memory_order_relaxed); i != head; ++i)
+                    batch.push_back(&ring->slots[i & (ring_capacity - 1)]);
+                heads.push_back(head);
+            }
+
+            // Rings are per thread; merge them back into one timeline.
+            std::stable_sort(batch.begin(), batch.end(), [](const Record* a, const Record* b)
+            {
+                return a->timestamp_ns < b->timestamp_ns;
+            });
+
+            out.clear();
+            err.clear();
+            for (const Record* record : batch)
+                format(*record, record->level >= Level::Warn ? err : out);
+
+            for (std::size_t i = 0; i < rings.size(); ++i)
+                rings[i]->tail.store(heads[i], std::memory_order_release);
+
+            auto drops = dropped_lines.value();
+            if (drops != reported_drops)
+            {
+                err += "[Log] " + std::to_string(drops - reported_drops) + " log lines dropped\n";
+                reported_drops = drops;
+            }
+
+            write_out(out, stdout);
+            write_out(err, stderr);
+
+            rings.clear();
+            return batch.size();
+        }
+
+        void writer_loop()
+        {
+            while (true)
+            {
+                bool running = state().running.load(std::memory_order_acquire);
+                std::size_t written = drain();
+
+                if (!running && written == 0)
+                    break;
+                if (written == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    namespace detail
+    {
+        std::int64_t now_ns() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        Record* acquire()
+        {
+            if (!state().running.load(std::memory_order_acquire))
+                return &scratch_record;
+
+            Ring& ring = local_ring();
+            auto head = ring.head.load(std::memory_order_relaxed);
+            if (head - ring.tail.load(std::memory_order_acquire) >= ring_capacity)
+            {
+                dropped_lines.inc();
+                return nullptr;
+            }
+            return &ring.slots[head & (ring_capacity - 1)];
+        }
+
+        void publish(Record* record)
+        {
+            if (record == &scratch_record)
+            {
+                std::lock_guard<std::mutex> lock(state().sync_mutex);
+
+                std::string line;
+                format(*record, line);
+                write_out(line, record->level >= Level::Warn ? stderr : stdout);
+                return;
+            }
+
+            Ring& ring = local_ring();
+            ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    }
+
+    void start()
+    {
+        if (state().running.exchange(true))
+            return;
+        state().writer = std::thread(writer_loop);
+    }
+
+    void stop()
+    {
+        if (!state().running.exchange(false))
+            return;
+        if (state().writer.joinable())
+            state().writer.join();
+    }
+
+    std::uint64_t dropped()
+    {
+        return dropped_lines.value();
+    }
+}
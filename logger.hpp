@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// Asynchronous logger for the request and stream hot paths.
+//
+// LOG_xxx("Card valid: {} Coupon ID: {}", card, id) copies the arguments in
+// binary form into a per-thread lock-free ring; a background writer thread
+// does the formatting and the write to stdout/stderr. Levels below
+// OCU_LOG_LEVEL are discarded at compile time. When a ring is full the line
+// is dropped and counted instead of blocking the caller.
+//
+// The format argument must be a string literal: only its pointer is stored.
+
+#ifndef OCU_LOG_LEVEL
+#define OCU_LOG_LEVEL 1  // 0 debug, 1 info, 2 warn, 3 error
+#endif
+
+namespace Log
+{
+    enum class Level : std::uint8_t
+    {
+        Debug = 0,
+        Info = 1,
+        Warn = 2,
+        Error = 3,
+    };
+
+    inline constexpr Level compiled_level = static_cast<Level>(OCU_LOG_LEVEL);
+
+    inline constexpr std::size_t record_payload_size = 216;
+
+    enum class ArgType : std::uint8_t
+    {
+        Int,
+        UInt,
+        Double,
+        Bool,
+        Char,
+        String,
+    };
+
+    struct Record
+    {
+        std::int64_t timestamp_ns;  // system clock
+        const char* format;
+        Level level;
+        std::uint8_t truncated;
+        std::uint16_t size;
+        std::array<char, record_payload_size> payload;
+    };
+
+    // Starts the writer thread. Until then (and after stop()) lines are
+    // formatted and written synchronously by the calling thread.
+    void start();
+    // Drains all pending lines and joins the writer thread.
+    void stop();
+
+    [[nodiscard]] std::uint64_t dropped();
+
+    namespace detail
+    {
+        // Returns a slot in the calling thread's ring, or nullptr if the ring
+        // is full (the drop is already counted).
+        [[nodiscard]] Record* acquire();
+        void publish(Record* record);
+
+        class Encoder
+        {
+        public:
+            explicit Encoder(Record& record) noexcept : record_(record) {}
+
+            void put(ArgType type, const void* data, std::size_t size) noexcept
+            {
+                if (record_.size + 1 + size > record_payload_size)
+                {
+                    record_.truncated = 1;
+                    return;
+                }
+                record_.payload[record_.size++] = static_cast<char>(type);
+                std::memcpy(record_.payload.data() + record_.size, data, size);
+                record_.size = static_cast<std::uint16_t>(record_.size + size);
+            }
+
+            void put_string(std::string_view text) noexcept
+            {
+                constexpr std::size_t header = 1 + sizeof(std::uint16_t);
+                if (record_.size + header > record_payload_size)
+                {
+                    record_.truncated = 1;
+                    return;
+                }
+                std::size_t room = record_payload_size - record_.size - header;
+                auto length = static_cast<std::uint16_t>(text.size() < room ? text.size() : room);
+                if (length < text.size())
+                    record_.truncated = 1;
+
+                record_.payload[record_.size++] = static_cast<char>(ArgType::String);
+                std::memcpy(record_.payload.data() + record_.size, &length, sizeof(length));
+                std::memcpy(record_.payload.data() + record_.size + sizeof(length), text.data(), length);
+                record_.size = static_cast<std::uint16_t>(record_.size + sizeof(length) + length);
+            }
+
+            template<typename T>
+            void encode(const T& value) noexcept
+            {
+                using U = std::remove_cvref_t<T>;
+                if constexpr (std::is_same_v<U, bool>)
+                {
+                    put(ArgType::Bool, &value, 1);
+                }
+                else if constexpr (std::is_same_v<U, char>)
+                {
+                    put(ArgType::Char, &value, 1);
+                }
+                else if constexpr (std::is_enum_v<U>)
+                {
+                    encode(static_cast<std::underlying_type_t<U>>(value));
+                }
+                else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+                {
+                    std::int64_t v = value;
+                    put(ArgType::Int, &v, sizeof(v));
+                }
+                else if constexpr (std::is_integral_v<U>)
+                {
+                    std::uint64_t v = value;
+                    put(ArgType::UInt, &v, sizeof(v));
+                }
+                else if constexpr (std::is_floating_point_v<U>)
+                {
+                    double v = value;
+                    put(ArgType::Double, &v, sizeof(v));
+                }
+                else if constexpr (std::is_convertible_v<const U&, std::string_view>)
+                {
+                    put_string(std::string_view(value));
+                }
+                else
+                {
+                    static_assert(sizeof(U) == 0, "Unsupported log argument type");
+                }
+            }
+
+            void encode(const char* value) noexcept
+            {
+                put_string(value ? std::string_view(value) : std::string_view("(null)"));
+            }
+
+        private:
+            Record& record_;
+        };
+
+        [[nodiscard]] std::int64_t now_ns() noexcept;
+    }
+
+    template<typename... Args>
+    void write(Level level, const char* format, const Args&... args) noexcept
+    {
+        Record* record = detail::acquire();
+        if (!record)
+            return;
+
+        record->timestamp_ns = detail::now_ns();
+        record->format = format;
+        record->level = level;
+        record->truncated = 0;
+        record->size = 0;
+
+        detail::Encoder encoder(*record);
+        (encoder.encode(args), ...);
+
+        detail::publish(record);
+    }
+}
+
+#define OCU_LOG(level, ...)                                    \
+    do                                                         \
+    {                                                          \
+        if constexpr ((level) >= ::Log::compiled_level)        \
+            ::Log::write((level), __VA_ARGS__);                \
+    } while (0)
+
+#define LOG_DEBUG(...) OCU_LOG(::Log::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...) OCU_LOG(::Log::Level::Info, __VA_ARGS__)
+#define LOG_WARN(...) OCU_LOG(::Log::Level::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) OCU_LOG(::Log::Level::Error, __VA_ARGS__)
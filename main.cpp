@@ -1,16 +1,34 @@
 #include "database.hpp"
 #include "fetcher.hpp"
 #include "coupons.hpp"
+#include "card_index.hpp"
+#include "datetime.hpp"
+#include "token_filter.hpp"
+#include "checkpoint_scheduler.hpp"
+#include "audit_writer.hpp"
 #include "articles.hpp"
 #include "sender.hpp"
 #include "ticket_manager.hpp"
 #include "config.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "flight_recorder.hpp"
+#include "tracing.hpp"
+#include "bench.hpp"
+#include "qr_auth.hpp"
+#include "sha256.hpp"
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <filesystem>
 #include <csignal>
 #include <thread>
 #include <atomic>
+#include <ctime>
 
 Sender* g_sender = nullptr;
 Tickets::TicketManager* g_ticket_manager = nullptr;
@@ -33,14 +51,70 @@ void signal_handler(int signal) {
     }
 }
 
+// Only sets a flag; the main loop writes the dump.
+void flight_dump_signal_handler(int) {
+    FlightRecorder::recorder().request_dump();
+}
+
+std::string flight_dump_path(const std::string& dir) {
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+    localtime_r(&now, &tm);
+    char name[40];
+    std::strftime(name, sizeof(name), "flight-%Y%m%d-%H%M%S.bin", &tm);
+    return (std::filesystem::path(dir) / name).string();
+}
+
+// Server options are given as --name=value after the positional arguments.
+std::optional<std::string> find_option(int argc, char* argv[], std::string_view name) {
+    for (int i = 2; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with(name) && arg.size() > name.size() && arg[name.size()] == '=') {
+            return std::string(arg.substr(name.size() + 1));
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<std::string> positional_args(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 2; i < argc; ++i) {
+        if (!std::string_view(argv[i]).starts_with("--")) {
+            args.emplace_back(argv[i]);
+        }
+    }
+    return args;
+}
+
 void print_usage(const char* program_name) {
     std::cout << "Usage:\n";
-    std::cout << "  " << program_name << " server [port] [grpc_addr]  - Start server (TCP + gRPC client)\n";
+    std::cout << "  " << program_name << " server [port] [grpc_addr] [options]  - Start server (TCP + gRPC client)\n";
     std::cout << "      port: TCP port for validators (default: 8888)\n";
-    std::cout << "      grpc_addr: gRPC ticket server (default: localhost:5109)\n\n";
+    std::cout << "      grpc_addr: gRPC ticket server (default: localhost:5109)\n";
+    std::cout << "      --metrics-port=N: Prometheus /metrics endpoint, 0 disables (default: 9100)\n";
+    std::cout << "      --flight-dir=DIR: Where flight recorder dumps are written (default: .)\n";
+    std::cout << "      --flight-threshold-ms=N: Dump when a request takes longer, 0 disables (default: 250)\n";
+    std::cout << "      --trace-sample=R: Fraction of requests traced, served at /trace (default: 0)\n";
+    std::cout << "      --trace-file=PATH: Write collected traces as Chrome trace JSON on exit\n";
+    std::cout << "      --qr-key-file=PATH: Hex HMAC key; verify QR signatures before the DB lookup\n";
+    std::cout << "      --qr-max-age-s=N: Reject QR codes drawn longer ago, 0 disables (default: 120)\n";
+    std::cout << "      --audit-journal=DIR: Journal audit rows in memory-mapped segments under DIR\n";
+    std::cout << "      --audit-partitions=DIR: Write audit rows to one file per day under DIR\n";
+    std::cout << "      --audit-retention-days=N: Delete daily audit files older than N days, 0 keeps them (default: 90)\n";
+    std::cout << "      --durability=MODE: strict, group or relaxed; when a tap's row must be on disk (default: the storage profile's)\n";
+    std::cout << "      --storage=PROFILE: SQLite tuning for the flash device (default: default):\n";
+    for (const auto& profile : Database::storage_profiles()) {
+        std::cout << "        " << profile.name << " - " << profile.description << "\n";
+    }
+    std::cout << "\n";
     std::cout << "  " << program_name << " fetch coupon              - Fetch coupons from REST API\n";
     std::cout << "  " << program_name << " fetch articles            - Fetch articles from REST API\n";
     std::cout << "  " << program_name << " validate <card_id>        - Validate coupon by card_id\n";
+    std::cout << "  " << program_name << " flight-dump <file>        - Print a flight recorder dump\n";
+    std::cout << "  " << program_name << " audit-report <from> <to>  - Daily audit totals, dates as YYYY-MM-DD\n";
+    std::cout << "      --audit-partitions=DIR: Daily audit files to read besides the database\n";
+    std::cout << "  " << program_name << " bench <suite|all> [n]     - Run micro-benchmarks:\n";
+    Bench::list_suites(std::cout);
 }
 
 int main(int argc, char* argv[]) {
@@ -52,20 +126,141 @@ int main(int argc, char* argv[]) {
 
         std::string command = argv[1];
 
+        if (command == "flight-dump") {
+            if (argc < 3) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!FlightRecorder::print_dump(argv[2], std::cout)) {
+                std::cerr << "Not a flight recorder dump: " << argv[2] << "\n";
+                return 1;
+            }
+            return 0;
+        }
+
+        if (command == "bench") {
+            std::string suite = (argc >= 3) ? argv[2] : "all";
+            std::size_t iterations = (argc >= 4) ? std::stoul(argv[3]) : 0;
+            if (!Bench::run(suite, iterations, std::cout)) {
+                std::cerr << "Unknown benchmark suite: " << suite << "\n";
+                Bench::list_suites(std::cerr);
+                return 1;
+            }
+            return 0;
+        }
+
+        if (command == "server") {
+            Log::start();
+        }
+
+        auto trace_sample_opt = find_option(argc, argv, "--trace-sample");
+        double trace_sample = trace_sample_opt ? std::stod(*trace_sample_opt) : config::TRACE_SAMPLE_RATE;
+        std::string trace_file = find_option(argc, argv, "--trace-file").value_or("");
+        if (trace_sample > 0.0) {
+            Tracing::set_sample_rate(trace_sample);
+            Tracing::name_thread("main");
+        }
+
+        std::string storage_opt = find_option(argc, argv, "--storage").value_or(std::string(config::STORAGE_PROFILE));
+        const auto* storage = Database::find_storage_profile(storage_opt);
+        if (!storage) {
+            throw std::runtime_error("Unknown storage profile: " + storage_opt);
+        }
+
         std::cout << "Opening database...\n";
-        Database db(config::DB_PATH);
+        Database db(config::DB_PATH, storage);
         std::cout << "Database opened\n\n";
 
         if (command == "server") {
 
-            int tcp_port = (argc >= 3) ? std::stoi(argv[2]) : config::DEFAULT_TCP_PORT;
-            std::string grpc_server = (argc >= 4) ? argv[3] : std::string(config::GRPC_TICKET_SERVER);
+            auto args = positional_args(argc, argv);
+            int tcp_port = (args.size() >= 1) ? std::stoi(args[0]) : config::DEFAULT_TCP_PORT;
+            std::string grpc_server = (args.size() >= 2) ? args[1] : std::string(config::GRPC_TICKET_SERVER);
+
+            auto metrics_port_opt = find_option(argc, argv, "--metrics-port");
+            int metrics_port = metrics_port_opt ? std::stoi(*metrics_port_opt) : config::DEFAULT_METRICS_PORT;
+
+            std::string flight_dir = find_option(argc, argv, "--flight-dir").value_or(std::string(config::FLIGHT_DUMP_DIR));
+            auto flight_threshold_opt = find_option(argc, argv, "--flight-threshold-ms");
+            int flight_threshold_ms = flight_threshold_opt ? std::stoi(*flight_threshold_opt) : config::FLIGHT_THRESHOLD_MS;
+            FlightRecorder::recorder().set_latency_threshold(std::chrono::milliseconds(flight_threshold_ms));
+
+            std::string qr_key_file = find_option(argc, argv, "--qr-key-file").value_or(std::string(config::QR_KEY_FILE));
+            if (!qr_key_file.empty()) {
+                QrAuth::load_key(qr_key_file);
+            }
+            auto qr_max_age_opt = find_option(argc, argv, "--qr-max-age-s");
+            int qr_max_age_s = qr_max_age_opt ? std::stoi(*qr_max_age_opt) : config::QR_MAX_AGE_S;
+            QrAuth::set_freshness_window(std::chrono::seconds(qr_max_age_s), std::chrono::seconds(config::QR_MAX_CLOCK_SKEW_S));
+
+            std::string durability_opt = find_option(argc, argv, "--durability").value_or(std::string(config::DURABILITY));
+            Database::Durability durability = storage->durability;
+            if (!durability_opt.empty()) {
+                auto durability_mode = Database::parse_durability(durability_opt);
+                if (!durability_mode) {
+                    throw std::runtime_error("Unknown durability mode: " + durability_opt + " (strict, group or relaxed)");
+                }
+                durability = *durability_mode;
+                db.set_durability(durability);
+            }
             
+            std::string partition_dir = find_option(argc, argv, "--audit-partitions").value_or(std::string(config::AUDIT_PARTITION_DIR));
+            std::optional<AuditPartitions::Policy> partitions;
+            if (!partition_dir.empty()) {
+                auto retention_opt = find_option(argc, argv, "--audit-retention-days");
+                partitions = AuditPartitions::Policy{
+                    partition_dir,
+                    retention_opt ? std::stoi(*retention_opt) : config::AUDIT_RETENTION_DAYS,
+                    config::AUDIT_PARTITION_COMPRESS,
+                };
+            }
+
             std::cout << "=== Starting OCU Service ===\n";
             std::cout << "TCP Port (for validators): " << tcp_port << "\n";
             std::cout << "gRPC Server (for tickets): " << grpc_server << "\n";
+            std::cout << "Metrics port: " << (metrics_port > 0 ? std::to_string(metrics_port) : "disabled") << "\n";
+            std::cout << "QR signatures: "
+                      << (QrAuth::enabled() ? "verified (SHA-256: " + std::string(Sha256::implementation()) + ")" : "not checked")
+                      << "\n";
+            std::cout << "QR max age: " << (qr_max_age_s > 0 ? std::to_string(qr_max_age_s) + " s" : "unlimited") << "\n";
+            std::cout << "Durability: " << Database::durability_name(durability) << "\n";
+            std::cout << "Storage profile: " << storage->name << "\n";
+            std::cout << "Audit partitions: "
+                      << (partitions ? partitions->directory.string() + ", kept "
+                          + (partitions->retention_days > 0 ? std::to_string(partitions->retention_days) + " days" : "forever")
+                          : "off")
+                      << "\n";
             std::cout << "============================\n\n";
+
+            std::string wal_path = std::string(config::DB_PATH) + "-wal";
+            Metrics::registry().gauge_callback(
+                "ocu_sqlite_wal_bytes", "Current size of the SQLite write-ahead log",
+                [wal_path] {
+                    std::error_code ec;
+                    auto size = std::filesystem::file_size(wal_path, ec);
+                    return ec ? 0.0 : static_cast<double>(size);
+                });
+
+            std::optional<Metrics::Server> metrics_server;
+            if (metrics_port > 0) {
+                metrics_server.emplace(metrics_port);
+                metrics_server->start();
+            }
             
+            CheckpointScheduler checkpoints(db, {
+                storage->wal_autocheckpoint,
+                config::CHECKPOINT_IDLE,
+                config::CHECKPOINT_MAX_INTERVAL,
+                config::CHECKPOINT_ESCALATE_FRAMES,
+            });
+            checkpoints.start();
+
+            LOG_INFO("[MAIN] Time zone: {} UTC offset changes cached", DateTime::load_zone());
+            // Full-table scans run on a read-only connection, never holding
+            // up ticket ingest or audit commits on the writer.
+            Coupons::refresh_card_index(db.reader());
+            Tickets::token_filter().rebuild(db.reader());
+
             std::cout << "[MAIN] Starting Ticket Manager (gRPC client)...\n";
             Tickets::TicketManager ticket_manager(db, grpc_server);
             g_ticket_manager = &ticket_manager;
@@ -74,11 +269,32 @@ int main(int argc, char* argv[]) {
             std::this_thread::sleep_for(std::chrono::seconds(1));
             
             std::cout << "[MAIN] Starting TCP Server for validators...\n";
-            Sender sender(db, tcp_port);
+            std::string audit_journal = find_option(argc, argv, "--audit-journal").value_or(std::string(config::AUDIT_JOURNAL_DIR));
+            std::optional<ValidationJournal::Policy> journal;
+            if (!audit_journal.empty()) {
+                journal = ValidationJournal::Policy{
+                    audit_journal,
+                    config::AUDIT_JOURNAL_SEGMENT_RECORDS,
+                    config::AUDIT_JOURNAL_SYNC_INTERVAL,
+                    config::AUDIT_JOURNAL_SEAL_AFTER,
+                };
+            }
+
+            AuditWriter audit(db, {
+                config::AUDIT_FLUSH_INTERVAL,
+                config::AUDIT_BATCH_ROWS,
+                durability,
+                journal,
+                partitions,
+            });
+            audit.start();
+
+            Sender sender(db, audit, tcp_port);
             g_sender = &sender;
             
             std::signal(SIGINT, signal_handler);
             std::signal(SIGTERM, signal_handler);
+            std::signal(SIGUSR1, flight_dump_signal_handler);
             
             g_running = true;
             
@@ -89,8 +305,34 @@ int main(int argc, char* argv[]) {
             std::cout << "[MAIN] All services started. Press Ctrl+C to stop.\n";
             
             // Wait for shutdown signal
+            auto next_token_sweep = std::chrono::steady_clock::now() + config::TOKEN_FILTER_SWEEP_INTERVAL;
             while (g_running) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                db.update_statement_probe();
+                if (db.poll_external_writes()) {
+                    Coupons::mark_card_index_stale();
+                }
+                Coupons::refresh_card_index(db.reader());
+
+                if (Tickets::token_filter().needs_rebuild()) {
+                    Tickets::token_filter().rebuild(db.reader());
+                } else if (std::chrono::steady_clock::now() >= next_token_sweep) {
+                    int removed = Tickets::token_filter().sweep(db.reader());
+                    if (removed > 0) {
+                        LOG_INFO("[MAIN] Token filter: {} expired tokens removed", removed);
+                    }
+                    next_token_sweep = std::chrono::steady_clock::now() + config::TOKEN_FILTER_SWEEP_INTERVAL;
+                }
+
+                if (FlightRecorder::recorder().take_dump_request()) {
+                    std::string path = flight_dump_path(flight_dir);
+                    int written = FlightRecorder::recorder().dump(path);
+                    if (written >= 0) {
+                        LOG_INFO("[MAIN] Flight recorder: {} requests written to {}", written, path);
+                    } else {
+                        LOG_ERROR("[MAIN] Flight recorder: cannot write {}", path);
+                    }
+                }
             }
             
             // Clean shutdown
@@ -101,15 +343,22 @@ int main(int argc, char* argv[]) {
             if (sender_thread.joinable()) {
                 sender_thread.join();
             }
+            audit.stop();
+            checkpoints.stop();
+
+            if (metrics_server) {
+                metrics_server->stop();
+            }
             
             std::cout << "[MAIN] All services stopped\n";
+            Log::stop();
         }
         else if (command == "fetch" && argc >= 3) {
             std::string fetch_type = argv[2];
             
             if (fetch_type == "coupon") {
                 std::cout << "=== Fetching Coupons from REST API ===\n";
-                Coupons::CouponManager manager(db.get());
+                Coupons::CouponManager manager(db);
                 
                 if (manager.fetch_and_store(config::COUPON_ENDPOINT)) {
                     std::cout << "Success\n";
@@ -120,7 +369,7 @@ int main(int argc, char* argv[]) {
             } 
             else if (fetch_type == "article" || fetch_type == "articles") {
                 std::cout << "=== Fetching Articles from REST API ===\n";
-                Articles::ArticleManager manager(db.get());
+                Articles::ArticleManager manager(db);
                 
                 if (manager.fetch_and_store(config::ARTICLES_ENDPOINT)) {
                     std::cout << "Success\n";
@@ -139,7 +388,7 @@ int main(int argc, char* argv[]) {
             std::string card_number = argv[2];
             
             std::cout << "=== Validating: " << card_number << " ===\n";
-            Coupons::CouponManager manager(db.get());
+            Coupons::CouponManager manager(db);
             
             if (manager.is_valid_card(card_number)) {
                 auto coupons = manager.get_coupons_by_card(card_number);
@@ -156,15 +405,31 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
         }
+        else if (command == "audit-report" && argc >= 4) {
+            std::string partition_dir = find_option(argc, argv, "--audit-partitions").value_or(std::string(config::AUDIT_PARTITION_DIR));
+            if (!AuditPartitions::report(db, partition_dir.empty() ? "." : partition_dir, argv[2], argv[3], std::cout)) {
+                std::cerr << "Audit report failed\n";
+                return 1;
+            }
+        }
         else {
             std::cerr << "Unknown command: " << command << "\n";
             print_usage(argv[0]);
             return 1;
         }
 
+        if (!trace_file.empty()) {
+            if (Tracing::write_chrome_json(trace_file)) {
+                std::cout << "Trace written to " << trace_file << "\n";
+            } else {
+                std::cerr << "Cannot write trace to " << trace_file << "\n";
+            }
+        }
+
         return 0;
         
     } catch (const std::exception& e) {
+        Log::stop();
         std::cerr << "Error: " << e.what() << '\n';
         return 1;
     }
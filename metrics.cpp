@@ -0,0 +1,230 @@
+#include "metrics.hpp"
+#include "include/httplib.h"
+#include "logger.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+namespace Metrics
+{
+    namespace
+    {
+        void append_number(std::string& out, double value)
+        {
+            char buffer[32];
+            int len = std::snprintf(buffer, sizeof(buffer), "%.10g", value);
+            out.append(buffer, len > 0 ? static_cast<std::size_t>(len) : 0);
+        }
+
+        void append_sample(std::string& out, std::string_view name, std::string_view labels, double value)
+        {
+            out.append(name);
+            if (!labels.empty())
+            {
+                out += '{';
+                out.append(labels);
+                out += '}';
+            }
+            out += ' ';
+            append_number(out, value);
+            out += '\n';
+        }
+    }
+
+    Histogram::Histogram(std::vector<std::uint64_t> bounds_us)
+        : bounds_us_(std::move(bounds_us))
+        , buckets_(std::make_unique<std::atomic<std::uint64_t>[]>(bounds_us_.size() + 1))
+    {
+        std::sort(bounds_us_.begin(), bounds_us_.end());
+        for (std::size_t i = 0; i <= bounds_us_.size(); ++i)
+            buckets_[i].store(0, std::memory_order_relaxed);
+    }
+
+    void Histogram::observe_us(std::uint64_t us) noexcept
+    {
+        // Bucket counts are stored non-cumulative; render() sums them up.
+        auto it = std::lower_bound(bounds_us_.begin(), bounds_us_.end(), us);
+        buckets_[static_cast<std::size_t>(it - bounds_us_.begin())].fetch_add(1, std::memory_order_relaxed);
+        sum_us_.fetch_add(us, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Histogram::render(std::string& out, std::string_view name, std::string_view labels) const
+    {
+        std::string bucket_name = std::string(name) + "_bucket";
+        std::string prefix = labels.empty() ? std::string() : std::string(labels) + ",";
+
+        std::uint64_t cumulative = 0;
+        for (std::size_t i = 0; i < bounds_us_.size(); ++i)
+        {
+            cumulative += buckets_[i].load(std::memory_order_relaxed);
+
+            std::string le;
+            append_number(le, static_cast<double>(bounds_us_[i]) / 1e6);
+            append_sample(out, bucket_name, prefix + "le=\"" + le + "\"", static_cast<double>(cumulative));
+        }
+        cumulative += buckets_[bounds_us_.size()].load(std::memory_order_relaxed);
+        append_sample(out, bucket_name, prefix + "le=\"+Inf\"", static_cast<double>(cumulative));
+
+        append_sample(out, std::string(name) + "_sum", labels,
+                      static_cast<double>(sum_us_.load(std::memory_order_relaxed)) / 1e6);
+        append_sample(out, std::string(name) + "_count", labels,
+                      static_cast<double>(count_.load(std::memory_order_relaxed)));
+    }
+
+    std::vector<std::uint64_t> latency_buckets_us()
+    {
+        return {50, 100, 250, 500, 1'000, 2'500, 5'000, 10'000, 25'000, 50'000,
+                100'000, 250'000, 500'000, 1'000'000, 2'500'000};
+    }
+
+    Registry::Child& Registry::child(std::string_view name, std::string_view help, Type type, std::string_view labels)
+    {
+        auto family = std::find_if(families_.begin(), families_.end(),
+            [name](const Family& f) { return f.name == name; });
+
+        if (family == families_.end())
+        {
+            families_.push_back(Family{std::string(name), std::string(help), type, {}});
+            family = std::prev(families_.end());
+        }
+        else if (family->type != type)
+        {
+            throw std::logic_error("Metric registered with two types: " + std::string(name));
+        }
+
+        auto existing = std::find_if(family->children.begin(), family->children.end(),
+            [labels](const Child& c) { return c.labels == labels; });
+        if (existing != family->children.end())
+            return *existing;
+
+        auto& created = family->children.emplace_back();
+        created.labels = labels;
+        return created;
+    }
+
+    Counter& Registry::counter(std::string_view name, std::string_view help, std::string_view labels)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& c = child(name, help, Type::Counter, labels);
+        if (!c.counter)
+            c.counter = &counters_.emplace_back();
+        return *c.counter;
+    }
+
+    Gauge& Registry::gauge(std::string_view name, std::string_view help, std::string_view labels)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& c = child(name, help, Type::Gauge, labels);
+        if (!c.gauge && !c.callback)
+            c.gauge = &gauges_.emplace_back();
+        if (!c.gauge)
+            throw std::logic_error("Gauge already registered as a callback: " + std::string(name));
+        return *c.gauge;
+    }
+
+    Histogram& Registry::histogram(std::string_view name, std::string_view help, std::string_view labels,
+                                   std::vector<std::uint64_t> bounds_us)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& c = child(name, help, Type::Histogram, labels);
+        if (!c.histogram)
+            c.histogram = &histograms_.emplace_back(std::move(bounds_us));
+        return *c.histogram;
+    }
+
+    void Registry::gauge_callback(std::string_view name, std::string_view help, std::function<double()> fn,
+                                  std::string_view labels)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& c = child(name, help, Type::Gauge, labels);
+        c.gauge = nullptr;
+        c.callback = std::move(fn);
+    }
+
+    std::string Registry::render() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::string out;
+        out.reserve(families_.size() * 256);
+
+        for (const auto& family : families_)
+        {
+            const char* type = family.type == Type::Counter ? "counter"
+                             : family.type == Type::Gauge ? "gauge" : "histogram";
+
+            out += "# HELP " + family.name + " " + family.help + "\n";
+            out += "# TYPE " + family.name + " " + type + "\n";
+
+            for (const auto& c : family.children)
+            {
+                if (c.counter)
+                    append_sample(out, family.name, c.labels, static_cast<double>(c.counter->value()));
+                else if (c.gauge)
+                    append_sample(out, family.name, c.labels, c.gauge->value());
+                else if (c.callback)
+                    append_sample(out, family.name, c.labels, c.callback());
+                else if (c.histogram)
+                    c.histogram->render(out, family.name, c.labels);
+            }
+        }
+        return out;
+    }
+
+    Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    struct Server::Impl
+    {
+        httplib::Server http;
+    };
+
+    Server::Server(int port)
+        : port_(port)
+        , impl_(std::make_unique<Impl>())
+    {
+        // One worker is plenty for a scraper and keeps the footprint small.
+        impl_->http.new_task_queue = [] { return new httplib::ThreadPool(1); };
+
+        impl_->http.Get("/metrics", [](const httplib::Request&, httplib::Response& res)
+        {
+            res.set_content(registry().render(), "text/plain; version=0.0.4");
+        });
+
+        impl_->http.Get("/trace", [](const httplib::Request&, httplib::Response& res)
+        {
+            res.set_content(Tracing::chrome_json(), "application/json");
+        });
+    }
+
+    Server::~Server()
+    {
+        stop();
+    }
+
+    void Server::start()
+    {
+        if (!impl_->http.bind_to_port("0.0.0.0", port_))
+            throw std::runtime_error("Cannot bind metrics endpoint to port " + std::to_string(port_));
+
+        thread_ = std::thread([this]
+        {
+            impl_->http.listen_after_bind();
+        });
+
+        LOG_INFO("[Metrics] Serving /metrics and /trace on 0.0.0.0:{}", port_);
+    }
+
+    void Server::stop()
+    {
+        impl_->http.stop();
+        if (thread_.joinable())
+            thread_.join();
+    }
+}
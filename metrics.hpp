@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Prometheus-style process metrics.
+//
+// Counters, gauges and histograms are plain atomics updated with relaxed
+// ordering, so recording on the request path never takes a lock. Only
+// registration and rendering (startup and scrape time) go through the
+// registry mutex.
+namespace Metrics
+{
+    class Counter
+    {
+    public:
+        void inc(std::uint64_t n = 1) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+        [[nodiscard]] std::uint64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint64_t> value_{0};
+    };
+
+    class Gauge
+    {
+    public:
+        void set(double value) noexcept { value_.store(value, std::memory_order_relaxed); }
+        [[nodiscard]] double value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value_{0.0};
+    };
+
+    // Fixed-bucket histogram; observations are kept in microseconds and
+    // rendered in seconds, as Prometheus expects.
+    class Histogram
+    {
+    public:
+        explicit Histogram(std::vector<std::uint64_t> bounds_us);
+
+        void observe_us(std::uint64_t us) noexcept;
+
+        template<typename Rep, typename Period>
+        void observe(std::chrono::duration<Rep, Period> elapsed) noexcept
+        {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+            observe_us(us > 0 ? static_cast<std::uint64_t>(us) : 0);
+        }
+
+        void render(std::string& out, std::string_view name, std::string_view labels) const;
+
+    private:
+        std::vector<std::uint64_t> bounds_us_;
+        std::unique_ptr<std::atomic<std::uint64_t>[]> buckets_;
+        std::atomic<std::uint64_t> sum_us_{0};
+        std::atomic<std::uint64_t> count_{0};
+    };
+
+    // 50 us .. 2.5 s, the range a tap or a single SQLite statement can take.
+    [[nodiscard]] std::vector<std::uint64_t> latency_buckets_us();
+
+    class Registry
+    {
+    public:
+        // `labels` is the inner part of the label set, e.g. command="card".
+        // Registering the same name and labels twice returns the same metric.
+        Counter& counter(std::string_view name, std::string_view help, std::string_view labels = {});
+        Gauge& gauge(std::string_view name, std::string_view help, std::string_view labels = {});
+        Histogram& histogram(std::string_view name, std::string_view help, std::string_view labels = {},
+                             std::vector<std::uint64_t> bounds_us = latency_buckets_us());
+
+        // Gauge evaluated at scrape time, for values that are expensive or
+        // pointless to keep current (file sizes, cache occupancy).
+        void gauge_callback(std::string_view name, std::string_view help, std::function<double()> fn,
+                            std::string_view labels = {});
+
+        [[nodiscard]] std::string render() const;
+
+    private:
+        enum class Type { Counter, Gauge, Histogram };
+
+        struct Child
+        {
+            std::string labels;
+            Counter* counter = nullptr;
+            Gauge* gauge = nullptr;
+            Histogram* histogram = nullptr;
+            std::function<double()> callback;
+        };
+
+        struct Family
+        {
+            std::string name;
+            std::string help;
+            Type type;
+            std::vector<Child> children;
+        };
+
+        Child& child(std::string_view name, std::string_view help, Type type, std::string_view labels);
+
+        mutable std::mutex mutex_;
+        std::deque<Family> families_;
+        std::deque<Counter> counters_;
+        std::deque<Gauge> gauges_;
+        std::deque<Histogram> histograms_;
+    };
+
+    [[nodiscard]] Registry& registry();
+
+    // Measures the time between construction and destruction into a histogram.
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram& histogram) noexcept
+            : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Histogram& histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Small HTTP endpoint serving GET /metrics from the vendored httplib.
+    class Server
+    {
+    public:
+        explicit Server(int port);
+        ~Server();
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        void start();
+        void stop();
+
+    private:
+        struct Impl;
+
+        int port_;
+        std::unique_ptr<Impl> impl_;
+        std::thread thread_;
+    };
+}
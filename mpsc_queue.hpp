@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+// Unbounded multi-producer, single-consumer queue: Vyukov's linked list
+// with a stub node. push() is wait-free from any number of threads, one
+// allocation, one exchange and one store, and never takes a lock.
+// pop() belongs to a single consumer thread.
+//
+// A push is only visible to pop() once its second step has landed, so a
+// consumer racing a producer can briefly see the queue as empty; it picks
+// the element up on its next pass.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : head_(new Node)
+        , tail_(head_.load(std::memory_order_relaxed))
+    {
+    }
+
+    ~MpscQueue()
+    {
+        while (pop())
+        {
+        }
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value)
+    {
+        Node* node = new Node;
+        node->value.emplace(std::move(value));
+        Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer thread only.
+    [[nodiscard]] std::optional<T> pop()
+    {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (!next)
+            return std::nullopt;
+
+        // `next` becomes the new stub once its value has been taken.
+        std::optional<T> value = std::move(next->value);
+        next->value.reset();
+        delete tail_;
+        tail_ = next;
+        return value;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        std::optional<T> value;
+    };
+
+    std::atomic<Node*> head_;  // last pushed; producers swap themselves in
+    Node* tail_;               // stub whose value was consumed
+};
@@ -0,0 +1,21 @@
+#include "probes.hpp"
+
+#ifdef OCU_HAVE_PROBES
+
+// Semaphores for the probes declared in probes.hpp. Tracers increment them
+// while attached; they keep the C linkage and section of the declaration.
+#define OCU_DEFINE_PROBE(name) \
+    __attribute__((section(".probes"))) volatile unsigned short OCU_PROBE_SEMAPHORE(name) = 0
+
+OCU_DEFINE_PROBE(request__start);
+OCU_DEFINE_PROBE(request__end);
+OCU_DEFINE_PROBE(sql__statement);
+OCU_DEFINE_PROBE(commit__start);
+OCU_DEFINE_PROBE(commit__done);
+OCU_DEFINE_PROBE(checkpoint__start);
+OCU_DEFINE_PROBE(checkpoint__done);
+OCU_DEFINE_PROBE(ticket__received);
+OCU_DEFINE_PROBE(ingest__start);
+OCU_DEFINE_PROBE(ingest__done);
+
+#endif
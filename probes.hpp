@@ -0,0 +1,70 @@
+#pragma once
+
+// USDT static probes (provider "ocu") for bpftrace, perf and SystemTap.
+//
+// Each probe compiles to a single nop plus an ELF note; nothing is evaluated
+// until a tracer attaches, at which point the nop becomes a breakpoint. The
+// probes need <sys/sdt.h> (systemtap-sdt-dev) at build time; without it, or
+// with OCU_NO_PROBES defined, they compile away entirely.
+//
+//   bpftrace -l 'usdt:./ocu_service:ocu:*'
+//   bpftrace -e 'usdt:./ocu_service:ocu:request__end { @us[arg0] = hist(arg2); }'
+//
+// Every probe needs a semaphore: add new ones to the list below and define
+// them in probes.cpp. OCU_PROBE_ENABLED(name) reads the semaphore, which is
+// non-zero only while a tracer is attached, for probes whose arguments or
+// hooks are not free.
+
+#if !defined(OCU_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define OCU_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef OCU_HAVE_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define OCU_PROBE_SEMAPHORE(name) ocu_##name##_semaphore
+#define OCU_DECLARE_PROBE(name) \
+    extern "C" __attribute__((section(".probes"))) volatile unsigned short OCU_PROBE_SEMAPHORE(name)
+
+#define OCU_PROBE(...) STAP_PROBEV(ocu, __VA_ARGS__)
+#define OCU_PROBE_ENABLED(name) __builtin_expect(OCU_PROBE_SEMAPHORE(name) != 0, 0)
+
+#else
+
+template<typename... Args>
+inline void ocu_probe_discard(const Args&...) noexcept {}
+
+// Arguments are never evaluated, but still count as used.
+#define OCU_DECLARE_PROBE(name) static_assert(true, "")
+#define OCU_PROBE(name, ...) do { if (false) ::ocu_probe_discard(__VA_ARGS__); } while (0)
+#define OCU_PROBE_ENABLED(name) false
+
+#endif
+
+// request__start(bytes)                  request read from a validator
+// request__end(command, result, latency_us)  reply written; command is a
+//                                        RequestKind, result a FlightRecorder::Result
+OCU_DECLARE_PROBE(request__start);
+OCU_DECLARE_PROBE(request__end);
+
+// sql__statement(sql, duration_ns)       every statement run on the server connection
+OCU_DECLARE_PROBE(sql__statement);
+
+// commit__start(), commit__done(rc)
+OCU_DECLARE_PROBE(commit__start);
+OCU_DECLARE_PROBE(commit__done);
+
+// checkpoint__start(mode), checkpoint__done(rc, log_frames, checkpointed_frames)
+OCU_DECLARE_PROBE(checkpoint__start);
+OCU_DECLARE_PROBE(checkpoint__done);
+
+// ticket__received(ticket_id, lag_s)     ticket pushed by the gRPC stream
+OCU_DECLARE_PROBE(ticket__received);
+
+// ingest__start(source), ingest__done(source, rows)   coupon/article batches
+OCU_DECLARE_PROBE(ingest__start);
+OCU_DECLARE_PROBE(ingest__done);
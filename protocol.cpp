@@ -0,0 +1,245 @@
+#include "protocol.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+
+namespace Protocol
+{
+    namespace
+    {
+        constexpr bool is_blank(char c) noexcept
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        constexpr bool is_alnum(char c) noexcept
+        {
+            return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+        }
+
+        // Splits the next blank-separated token off the front of `rest`.
+        std::string_view next_token(std::string_view& rest) noexcept
+        {
+            std::size_t begin = 0;
+            while (begin < rest.size() && is_blank(rest[begin]))
+                ++begin;
+
+            std::size_t end = begin;
+            while (end < rest.size() && !is_blank(rest[end]))
+                ++end;
+
+            std::string_view token = rest.substr(begin, end - begin);
+            rest.remove_prefix(end);
+            return token;
+        }
+
+        ParseResult parse_purchase(std::string_view args) noexcept
+        {
+            ParseResult result{Purchase{}, ParseError::None};
+            auto& purchase = std::get<Purchase>(result.command);
+
+            std::string_view article_id = next_token(args);
+            std::string_view card_number = next_token(args);
+            std::string_view quantity = next_token(args);
+
+            if (article_id.empty() || card_number.empty() || quantity.empty())
+                result.error = ParseError::MissingField;
+            else if (!parse_int(article_id, purchase.article_id))
+                result.error = ParseError::InvalidArticleId;
+            else if (!parse_int(quantity, purchase.quantity))
+                result.error = ParseError::InvalidQuantity;
+            else if (!next_token(args).empty())
+                result.error = ParseError::TrailingData;
+
+            purchase.card_number = card_number;
+            return result;
+        }
+
+        ParseResult parse_qr(std::string_view fields) noexcept
+        {
+            ParseResult result{QrScan{}, ParseError::None};
+            auto& scan = std::get<QrScan>(result.command);
+
+            // The hash is whatever follows the third '|'.
+            std::size_t bars[3];
+            if (Qr::find_delimiters(fields, bars, 3) != 3 || bars[2] + 1 == fields.size())
+            {
+                result.error = ParseError::MissingField;
+                return result;
+            }
+
+            scan.code = fields.substr(0, bars[0]);
+            scan.token = fields.substr(bars[0] + 1, bars[1] - bars[0] - 1);
+            scan.ticks = fields.substr(bars[1] + 1, bars[2] - bars[1] - 1);
+            scan.hash = fields.substr(bars[2] + 1);
+
+            const char* ticks_end = scan.ticks.data() + scan.ticks.size();
+            auto [ptr, ec] = std::from_chars(scan.ticks.data(), ticks_end, scan.issued_ticks);
+
+            if (!Qr::decode_uuid(scan.token, scan.token_id)
+                || ec != std::errc() || ptr != ticks_end || scan.ticks.empty()
+                || !Qr::decode_hex(scan.hash, scan.digest.data(), scan.digest.size()))
+                result.error = ParseError::InvalidQrField;
+            return result;
+        }
+
+        template<typename Command>
+        ParseResult no_arguments(std::string_view) noexcept
+        {
+            return {Command{}, ParseError::None};
+        }
+
+        enum class Syntax : std::uint8_t
+        {
+            Exact,      // the whole line is the keyword
+            Arguments,  // keyword, a space, then arguments
+            Prefix,     // keyword immediately followed by its payload
+        };
+
+        struct Keyword
+        {
+            std::string_view text;
+            Syntax syntax;
+            ParseResult (*parse)(std::string_view arguments) noexcept;
+        };
+
+        // Every command with a keyword. Card numbers have none and are
+        // recognised by what is left over.
+        constexpr std::array<Keyword, 4> keywords =
+        {{
+            {"FETCH_ARTICLES", Syntax::Exact, no_arguments<FetchArticles>},
+            {"DUMP_FLIGHT", Syntax::Exact, no_arguments<DumpFlight>},
+            {"PURCHASE", Syntax::Arguments, parse_purchase},
+            {"QR", Syntax::Prefix, parse_qr},
+        }};
+
+        // Keywords are told apart by their first two characters, hashed
+        // into a small table with a multiplier found at compile time so no
+        // two keywords share a slot. A lookup is one multiply and one compare
+        // however many commands there are.
+        constexpr std::size_t table_bits = 3;
+        constexpr std::size_t table_size = std::size_t{1} << table_bits;
+
+        constexpr std::uint32_t slot_key(std::string_view text) noexcept
+        {
+            auto byte = [&](std::size_t i) { return i < text.size() ? static_cast<unsigned char>(text[i]) : 0u; };
+            return (byte(0) << 8) | byte(1);
+        }
+
+        constexpr std::size_t slot(std::uint32_t key, std::uint32_t multiplier) noexcept
+        {
+            return static_cast<std::uint32_t>(key * multiplier) >> (32 - table_bits);
+        }
+
+        constexpr std::uint32_t find_multiplier() noexcept
+        {
+            for (std::uint32_t multiplier = 0x9E3779B1u; multiplier != 0x9E3779B1u + 2048; multiplier += 2)
+            {
+                std::array<bool, table_size> used{};
+                bool collision = false;
+                for (const auto& keyword : keywords)
+                {
+                    auto s = slot(slot_key(keyword.text), multiplier);
+                    collision = collision || used[s];
+                    used[s] = true;
+                }
+                if (!collision)
+                    return multiplier;
+            }
+            return 0;
+        }
+
+        constexpr std::uint32_t multiplier = find_multiplier();
+        static_assert(multiplier != 0,
+            "Keywords must differ in their first two characters; otherwise grow table_bits");
+
+        constexpr auto keyword_table = []
+        {
+            std::array<std::int8_t, table_size> table{};
+            table.fill(-1);
+            for (std::size_t i = 0; i < keywords.size(); ++i)
+                table[slot(slot_key(keywords[i].text), multiplier)] = static_cast<std::int8_t>(i);
+            return table;
+        }();
+
+        const Keyword* match_keyword(std::string_view line, std::string_view& arguments) noexcept
+        {
+            auto index = keyword_table[slot(slot_key(line), multiplier)];
+            if (index < 0)
+                return nullptr;
+
+            const Keyword& keyword = keywords[static_cast<std::size_t>(index)];
+            if (!line.starts_with(keyword.text))
+                return nullptr;
+
+            arguments = line.substr(keyword.text.size());
+            switch (keyword.syntax)
+            {
+                case Syntax::Exact:
+                    return arguments.empty() ? &keyword : nullptr;
+                case Syntax::Arguments:
+                    if (arguments.empty() || arguments.front() != ' ')
+                        return nullptr;
+                    arguments.remove_prefix(1);
+                    return &keyword;
+                case Syntax::Prefix:
+                    return &keyword;
+            }
+            return nullptr;
+        }
+    }
+
+    std::string_view describe(ParseError error) noexcept
+    {
+        switch (error)
+        {
+            case ParseError::None:             return "ok";
+            case ParseError::Empty:            return "empty request";
+            case ParseError::UnknownCommand:   return "unknown command";
+            case ParseError::MissingField:     return "missing field";
+            case ParseError::InvalidArticleId: return "invalid article_id";
+            case ParseError::InvalidQuantity:  return "invalid quantity";
+            case ParseError::TrailingData:     return "unexpected trailing data";
+            case ParseError::InvalidQrField:   return "invalid QR field";
+        }
+        return "?";
+    }
+
+    std::string_view trim(std::string_view text) noexcept
+    {
+        while (!text.empty() && is_blank(text.front()))
+            text.remove_prefix(1);
+        while (!text.empty() && is_blank(text.back()))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    bool parse_int(std::string_view text, int& value) noexcept
+    {
+        const char* end = text.data() + text.size();
+        auto [ptr, ec] = std::from_chars(text.data(), end, value);
+        return ec == std::errc() && ptr == end && !text.empty();
+    }
+
+    ParseResult parse(std::string_view line) noexcept
+    {
+        line = trim(line);
+
+        if (line.empty())
+            return {std::monostate{}, ParseError::Empty};
+
+        std::string_view arguments;
+        if (const Keyword* keyword = match_keyword(line, arguments))
+            return keyword->parse(arguments);
+
+        bool is_card = true;
+        for (char c : line)
+            is_card = is_card && is_alnum(c);
+
+        if (is_card)
+            return {CardTap{line}, ParseError::None};
+
+        return {std::monostate{}, ParseError::UnknownCommand};
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "qr_codec.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <variant>
+
+// Parser for the validator line protocol.
+//
+//   FETCH_ARTICLES
+//   DUMP_FLIGHT
+//   PURCHASE <article_id> <card_number> <quantity>
+//   QR<code>|<token uuid>|<ticks>|<sha256 hex>
+//   <card_number>                        (letters and digits only)
+//
+// parse() makes one pass over the receive buffer and returns views into it:
+// nothing is copied or allocated, so the buffer must outlive the result.
+//
+// Keywords are looked up in a perfect-hash table built at compile time
+// (protocol.cpp). A new command needs an argument struct added to Command,
+// a row in `keywords` and a Session::on_command overload for it.
+namespace Protocol
+{
+    enum class ParseError : std::uint8_t
+    {
+        None,
+        Empty,
+        UnknownCommand,
+        MissingField,       // a PURCHASE argument or a QR field is missing
+        InvalidArticleId,
+        InvalidQuantity,
+        TrailingData,       // more PURCHASE arguments than expected
+        InvalidQrField,     // QR token, ticks or hash does not decode
+    };
+
+    [[nodiscard]] std::string_view describe(ParseError error) noexcept;
+
+    struct FetchArticles {};
+    struct DumpFlight {};
+
+    struct Purchase
+    {
+        int article_id;
+        std::string_view card_number;
+        int quantity;
+    };
+
+    struct QrScan
+    {
+        std::string_view code;
+        std::string_view token;
+        std::string_view ticks;
+        std::string_view hash;
+
+        // Decoded with qr_codec, so later checks compare bytes, not text.
+        Qr::Uuid token_id;
+        std::uint64_t issued_ticks;
+        Qr::Digest digest;
+    };
+
+    struct CardTap
+    {
+        std::string_view card_number;
+    };
+
+    using Command = std::variant<std::monostate, FetchArticles, DumpFlight, Purchase, QrScan, CardTap>;
+
+    struct ParseResult
+    {
+        Command command;
+        ParseError error = ParseError::None;
+
+        [[nodiscard]] bool ok() const noexcept { return error == ParseError::None; }
+    };
+
+    // Strips spaces, tabs, CR and LF from both ends.
+    [[nodiscard]] std::string_view trim(std::string_view text) noexcept;
+
+    // Parses a decimal int; the whole of `text` must be the number.
+    [[nodiscard]] bool parse_int(std::string_view text, int& value) noexcept;
+
+    [[nodiscard]] ParseResult parse(std::string_view line) noexcept;
+}
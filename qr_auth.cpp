@@ -0,0 +1,80 @@
+#include "qr_auth.hpp"
+#include "qr_codec.hpp"
+#include "sha256.hpp"
+
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace QrAuth
+{
+    namespace
+    {
+        std::optional<Sha256::Hmac> hmac;
+
+        // In ticks, so the check needs no conversion of the scanned value.
+        std::int64_t max_age_ticks = 0;
+        std::int64_t max_skew_ticks = 0;
+    }
+
+    void load_key(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Cannot read QR key file: " + path);
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        auto begin = text.find_first_not_of(" \t\r\n");
+        auto end = text.find_last_not_of(" \t\r\n");
+        std::string_view hex = begin == std::string::npos
+            ? std::string_view{}
+            : std::string_view(text).substr(begin, end - begin + 1);
+
+        std::vector<std::uint8_t> key(hex.size() / 2);
+        if (key.empty() || !Qr::decode_hex(hex, key.data(), key.size()))
+            throw std::runtime_error("QR key file is not a hex-encoded key: " + path);
+
+        hmac.emplace(key);
+    }
+
+    bool enabled() noexcept
+    {
+        return hmac.has_value();
+    }
+
+    void set_freshness_window(std::chrono::seconds max_age, std::chrono::seconds max_clock_skew) noexcept
+    {
+        max_age_ticks = std::chrono::duration_cast<Qr::Ticks>(max_age).count();
+        max_skew_ticks = std::chrono::duration_cast<Qr::Ticks>(max_clock_skew).count();
+    }
+
+    Freshness check_freshness(const Protocol::QrScan& scan, std::chrono::system_clock::time_point now) noexcept
+    {
+        if (max_age_ticks <= 0)
+            return Freshness::Fresh;
+
+        auto now_ticks = static_cast<std::uint64_t>(Qr::to_ticks(now));
+        if (scan.issued_ticks > now_ticks + static_cast<std::uint64_t>(max_skew_ticks))
+            return Freshness::Future;
+        if (scan.issued_ticks + static_cast<std::uint64_t>(max_age_ticks) < now_ticks)
+            return Freshness::Expired;
+        return Freshness::Fresh;
+    }
+
+    std::string_view signed_text(const Protocol::QrScan& scan) noexcept
+    {
+        // The fields are views into one buffer, so code..ticks is contiguous.
+        const char* end = scan.ticks.data() + scan.ticks.size();
+        return std::string_view(scan.code.data(), static_cast<std::size_t>(end - scan.code.data()));
+    }
+
+    bool verify(const Protocol::QrScan& scan) noexcept
+    {
+        return hmac && hmac->verify(signed_text(scan), scan.digest);
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "protocol.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Local verification of QR signatures.
+//
+// The last QR field is HMAC-SHA256(key, "<code>|<token>|<ticks>") over the
+// payload text exactly as scanned. With a key provisioned (--qr-key-file),
+// forged or corrupted codes are rejected before any database lookup, and
+// a correctly signed ticket that has not arrived over gRPC yet can be
+// accepted offline. Without a key, every code goes to the database as before.
+//
+// The ticks field is when the app drew the code. Codes older than the
+// freshness window (screenshots, replays) or too far in the future are
+// rejected with two integer compares, before the signature or the database.
+namespace QrAuth
+{
+    enum class Freshness : std::uint8_t
+    {
+        Fresh,
+        Expired,
+        Future,
+    };
+
+    // Reads a hex-encoded key (surrounding whitespace ignored). Call before
+    // the validator server starts; throws std::runtime_error if the file
+    // cannot be read or is not hex.
+    void load_key(const std::string& path);
+
+    [[nodiscard]] bool enabled() noexcept;
+
+    // True if the scan's digest is the HMAC of its payload.
+    [[nodiscard]] bool verify(const Protocol::QrScan& scan) noexcept;
+
+    // max_age of zero accepts any age. Call before the validator server starts.
+    void set_freshness_window(std::chrono::seconds max_age, std::chrono::seconds max_clock_skew) noexcept;
+
+    [[nodiscard]] Freshness check_freshness(const Protocol::QrScan& scan,
+        std::chrono::system_clock::time_point now = std::chrono::system_clock::now()) noexcept;
+
+    // The payload text covered by the signature.
+    [[nodiscard]] std::string_view signed_text(const Protocol::QrScan& scan) noexcept;
+}
@@ -0,0 +1,285 @@
+#include "qr_codec.hpp"
+
+#include <cstring>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OCU_QR_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define OCU_QR_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OCU_QR_SSE2 1
+#endif
+
+namespace Qr
+{
+    namespace
+    {
+        constexpr auto hex_values = []
+        {
+            std::array<std::int8_t, 256> table{};
+            table.fill(-1);
+            for (int i = 0; i < 10; ++i)
+                table['0' + i] = static_cast<std::int8_t>(i);
+            for (int i = 0; i < 6; ++i)
+            {
+                table['a' + i] = static_cast<std::int8_t>(10 + i);
+                table['A' + i] = static_cast<std::int8_t>(10 + i);
+            }
+            return table;
+        }();
+
+        bool decode_hex_tail(const char* in, std::uint8_t* out, std::size_t size) noexcept
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                int hi = hex_values[static_cast<unsigned char>(in[2 * i])];
+                int lo = hex_values[static_cast<unsigned char>(in[2 * i + 1])];
+                if ((hi | lo) < 0)
+                    return false;
+                out[i] = static_cast<std::uint8_t>((hi << 4) | lo);
+            }
+            return true;
+        }
+
+        // Copies the 32 digits of an 8-4-4-4-12 UUID out from between the dashes.
+        bool gather_uuid_digits(std::string_view text, char* digits) noexcept
+        {
+            if (text.size() != uuid_text_size
+                || text[8] != '-' || text[13] != '-' || text[18] != '-' || text[23] != '-')
+                return false;
+
+            std::memcpy(digits, text.data(), 8);
+            std::memcpy(digits + 8, text.data() + 9, 4);
+            std::memcpy(digits + 12, text.data() + 14, 4);
+            std::memcpy(digits + 16, text.data() + 19, 4);
+            std::memcpy(digits + 20, text.data() + 24, 12);
+            return true;
+        }
+
+#if defined(OCU_QR_NEON)
+        constexpr std::size_t hex_block = 16;  // hex digits per vector step
+
+        bool decode_hex_block(const char* in, std::uint8_t* out) noexcept
+        {
+            uint8x16_t c = vld1q_u8(reinterpret_cast<const std::uint8_t*>(in));
+
+            // Digits map to 0-9 after subtracting '0'; letters of either case
+            // map to 0-5 after folding to lower case and subtracting 'a'.
+            uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+            uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+            uint8x16_t letter = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+            uint8x16_t is_letter = vcleq_u8(letter, vdupq_n_u8(5));
+
+            uint8x16_t valid = vorrq_u8(is_digit, is_letter);
+            uint8x8_t folded = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+            if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != ~std::uint64_t{0})
+                return false;
+
+            uint8x16_t value = vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+            uint8x16x2_t nibbles = vuzpq_u8(value, value);  // even digits, odd digits
+            uint8x8_t bytes = vorr_u8(vshl_n_u8(vget_low_u8(nibbles.val[0]), 4), vget_low_u8(nibbles.val[1]));
+            vst1_u8(out, bytes);
+            return true;
+        }
+
+        std::size_t find_delimiters_vector(const char* p, std::size_t n, std::size_t* offsets, std::size_t max) noexcept
+        {
+            std::size_t found = 0;
+            std::size_t i = 0;
+            const uint8x16_t bar = vdupq_n_u8('|');
+
+            for (; i + 16 <= n && found < max; i += 16)
+            {
+                uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const std::uint8_t*>(p + i)), bar);
+                // Narrow to four bits per byte: ARMv7 has no movemask.
+                std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+                while (mask && found < max)
+                {
+                    unsigned bit = static_cast<unsigned>(__builtin_ctzll(mask));
+                    offsets[found++] = i + bit / 4;
+                    mask &= ~(std::uint64_t{0xF} << (bit & ~3u));
+                }
+            }
+            for (; i < n && found < max; ++i)
+                if (p[i] == '|')
+                    offsets[found++] = i;
+            return found;
+        }
+
+        constexpr std::string_view implementation_name = "neon";
+
+#elif defined(OCU_QR_AVX2)
+        constexpr std::size_t hex_block = 32;
+
+        bool decode_hex_block(const char* in, std::uint8_t* out) noexcept
+        {
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+
+            __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+            __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+            __m256i letter = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+            __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+
+            if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1)
+                return false;
+
+            __m256i value = _mm256_blendv_epi8(_mm256_add_epi8(letter, _mm256_set1_epi8(10)), digit, is_digit);
+            // Each 16-bit lane holds (high nibble, low nibble) as (low byte, high byte).
+            __m256i hi = _mm256_slli_epi16(_mm256_and_si256(value, _mm256_set1_epi16(0x00FF)), 4);
+            __m256i lo = _mm256_srli_epi16(value, 8);
+            __m256i packed = _mm256_packus_epi16(_mm256_or_si256(hi, lo), _mm256_setzero_si256());
+            // packus works per 128-bit half; pull the two 8-byte results together.
+            packed = _mm256_permute4x64_epi64(packed, 0x08);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+            return true;
+        }
+
+        std::size_t find_delimiters_vector(const char* p, std::size_t n, std::size_t* offsets, std::size_t max) noexcept
+        {
+            std::size_t found = 0;
+            std::size_t i = 0;
+            const __m256i bar = _mm256_set1_epi8('|');
+
+            for (; i + 32 <= n && found < max; i += 32)
+            {
+                auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), bar)));
+                while (mask && found < max)
+                {
+                    offsets[found++] = i + static_cast<std::size_t>(__builtin_ctz(mask));
+                    mask &= mask - 1;
+                }
+            }
+            for (; i < n && found < max; ++i)
+                if (p[i] == '|')
+                    offsets[found++] = i;
+            return found;
+        }
+
+        constexpr std::string_view implementation_name = "avx2";
+
+#elif defined(OCU_QR_SSE2)
+        constexpr std::size_t hex_block = 16;
+
+        bool decode_hex_block(const char* in, std::uint8_t* out) noexcept
+        {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+            __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+            __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+            __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+            __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+            if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF)
+                return false;
+
+            __m128i value = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                                         _mm_andnot_si128(is_digit, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+            __m128i hi = _mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4);
+            __m128i lo = _mm_srli_epi16(value, 8);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                             _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128()));
+            return true;
+        }
+
+        std::size_t find_delimiters_vector(const char* p, std::size_t n, std::size_t* offsets, std::size_t max) noexcept
+        {
+            std::size_t found = 0;
+            std::size_t i = 0;
+            const __m128i bar = _mm_set1_epi8('|');
+
+            for (; i + 16 <= n && found < max; i += 16)
+            {
+                auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), bar)));
+                while (mask && found < max)
+                {
+                    offsets[found++] = i + static_cast<std::size_t>(__builtin_ctz(mask));
+                    mask &= mask - 1;
+                }
+            }
+            for (; i < n && found < max; ++i)
+                if (p[i] == '|')
+                    offsets[found++] = i;
+            return found;
+        }
+
+        constexpr std::string_view implementation_name = "sse2";
+#endif
+    }
+
+    namespace scalar
+    {
+        std::size_t find_delimiters(std::string_view text, std::size_t* offsets, std::size_t max) noexcept
+        {
+            std::size_t found = 0;
+            for (std::size_t i = 0; i < text.size() && found < max; ++i)
+                if (text[i] == '|')
+                    offsets[found++] = i;
+            return found;
+        }
+
+        bool decode_hex(std::string_view text, std::uint8_t* out, std::size_t size) noexcept
+        {
+            return text.size() == 2 * size && decode_hex_tail(text.data(), out, size);
+        }
+
+        bool decode_uuid(std::string_view text, Uuid& out) noexcept
+        {
+            char digits[32];
+            return gather_uuid_digits(text, digits)
+                && decode_hex(std::string_view(digits, sizeof(digits)), out.data(), out.size());
+        }
+    }
+
+#if defined(OCU_QR_NEON) || defined(OCU_QR_AVX2) || defined(OCU_QR_SSE2)
+    std::size_t find_delimiters(std::string_view text, std::size_t* offsets, std::size_t max) noexcept
+    {
+        return find_delimiters_vector(text.data(), text.size(), offsets, max);
+    }
+
+    bool decode_hex(std::string_view text, std::uint8_t* out, std::size_t size) noexcept
+    {
+        if (text.size() != 2 * size)
+            return false;
+
+        const char* in = text.data();
+        std::size_t done = 0;
+        for (; (size - done) * 2 >= hex_block; done += hex_block / 2)
+            if (!decode_hex_block(in + 2 * done, out + done))
+                return false;
+
+        return decode_hex_tail(in + 2 * done, out + done, size - done);
+    }
+
+    std::string_view implementation() noexcept
+    {
+        return implementation_name;
+    }
+#else
+    std::size_t find_delimiters(std::string_view text, std::size_t* offsets, std::size_t max) noexcept
+    {
+        return scalar::find_delimiters(text, offsets, max);
+    }
+
+    bool decode_hex(std::string_view text, std::uint8_t* out, std::size_t size) noexcept
+    {
+        return scalar::decode_hex(text, out, size);
+    }
+
+    std::string_view implementation() noexcept
+    {
+        return "scalar";
+    }
+#endif
+
+    bool decode_uuid(std::string_view text, Uuid& out) noexcept
+    {
+        char digits[32];
+        return gather_uuid_digits(text, digits)
+            && decode_hex(std::string_view(digits, sizeof(digits)), out.data(), out.size());
+    }
+}
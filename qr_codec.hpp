@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Field splitting and hex/UUID decoding for QR payloads
+// (<code>|<token uuid>|<ticks>|<sha256 hex>).
+//
+// The delimiter scan and hex decoding use NEON on ARM and AVX2 or SSE2 on
+// x86, picked at compile time from the target flags (-mfpu=neon, -mavx2).
+// The scalar versions cover other targets and serve as the reference for
+// `ocu_service bench qr`.
+namespace Qr
+{
+    using Uuid = std::array<std::uint8_t, 16>;
+    using Digest = std::array<std::uint8_t, 32>;
+
+    inline constexpr std::size_t uuid_text_size = 36;
+    inline constexpr std::size_t digest_hex_size = 64;
+
+    // The ticks field is a .NET DateTime: 100 ns units since 0001-01-01 UTC.
+    using Ticks = std::chrono::duration<std::int64_t, std::ratio<1, 10'000'000>>;
+    inline constexpr std::int64_t unix_epoch_ticks = 621'355'968'000'000'000;
+
+    [[nodiscard]] constexpr std::int64_t to_ticks(std::chrono::system_clock::time_point time) noexcept
+    {
+        return std::chrono::duration_cast<Ticks>(time.time_since_epoch()).count() + unix_epoch_ticks;
+    }
+
+    [[nodiscard]] constexpr std::chrono::sys_time<Ticks> from_ticks(std::int64_t ticks) noexcept
+    {
+        return std::chrono::sys_time<Ticks>(Ticks(ticks - unix_epoch_ticks));
+    }
+
+    // Stores the offsets of the first `max` '|' characters of `text`;
+    // returns how many were found.
+    std::size_t find_delimiters(std::string_view text, std::size_t* offsets, std::size_t max) noexcept;
+
+    // Decodes exactly 2 * size hex digits of either case.
+    [[nodiscard]] bool decode_hex(std::string_view text, std::uint8_t* out, std::size_t size) noexcept;
+
+    // Decodes the canonical 8-4-4-4-12 form.
+    [[nodiscard]] bool decode_uuid(std::string_view text, Uuid& out) noexcept;
+
+    // "neon", "avx2", "sse2" or "scalar".
+    [[nodiscard]] std::string_view implementation() noexcept;
+
+    namespace scalar
+    {
+        std::size_t find_delimiters(std::string_view text, std::size_t* offsets, std::size_t max) noexcept;
+        [[nodiscard]] bool decode_hex(std::string_view text, std::uint8_t* out, std::size_t size) noexcept;
+        [[nodiscard]] bool decode_uuid(std::string_view text, Uuid& out) noexcept;
+    }
+}
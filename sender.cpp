@@ -1,70 +1,127 @@
 #include "sender.hpp"
-#include <iostream>
-#include <algorithm>
-#include <sstream>
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "probes.hpp"
+#include "qr_auth.hpp"
+#include "card_index.hpp"
+#include "datetime.hpp"
+#include "token_filter.hpp"
+#include "tap_cache.hpp"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+namespace
+{
+    struct RequestMetrics
+    {
+        Metrics::Counter* requests;
+        Metrics::Histogram* latency;
+    };
+
+    // Indexed by RequestKind.
+    constexpr std::array<std::string_view, 6> request_kind_labels =
+    {
+        "command=\"unknown\"",
+        "command=\"fetch_articles\"",
+        "command=\"purchase\"",
+        "command=\"qr\"",
+        "command=\"card\"",
+        "command=\"dump_flight\"",
+    };
+
+    const auto request_metrics = []
+    {
+        std::array<RequestMetrics, request_kind_labels.size()> table{};
+        for (std::size_t i = 0; i < table.size(); ++i)
+        {
+            table[i].requests = &Metrics::registry().counter(
+                "ocu_requests_total", "Validator requests answered, by command", request_kind_labels[i]);
+            table[i].latency = &Metrics::registry().histogram(
+                "ocu_request_duration_seconds", "Time from request read to reply written", request_kind_labels[i]);
+        }
+        return table;
+    }();
+
+    auto& request_errors = Metrics::registry().counter(
+        "ocu_request_errors_total", "Socket read or write errors on validator connections");
+
+    auto& qr_bad_signatures = Metrics::registry().counter(
+        "ocu_qr_rejected_total", "QR codes rejected before the database lookup, by reason", "reason=\"signature\"");
+    auto& qr_stale = Metrics::registry().counter(
+        "ocu_qr_rejected_total", "QR codes rejected before the database lookup, by reason", "reason=\"stale\"");
+
+    auto& repeat_card_taps = Metrics::registry().counter(
+        "ocu_repeat_taps_total", "Taps answered as already validated from the tap cache", "kind=\"card\"");
+    auto& repeat_qr_scans = Metrics::registry().counter(
+        "ocu_repeat_taps_total", "Taps answered as already validated from the tap cache", "kind=\"qr\"");
+
+    // How long a ticket stays valid after its first scan.
+    constexpr auto ticket_activation_period = std::chrono::minutes(30);
+}
+
 
-Sender::Sender(Database& db, int port) 
+Sender::Sender(Database& db, AuditWriter& audit, int port) 
     : db_(db)
+    , audit_(audit)
     , io_context_()           
     , acceptor_(io_context_) 
     , running_(true)
 {
     try {
-        std::cout << "[DEBUG] Opening acceptor...\n";
+        LOG_DEBUG("Opening acceptor...");
         acceptor_.open(tcp::v4());
         
-        std::cout << "[DEBUG] Setting socket options...\n";
+        LOG_DEBUG("Setting socket options...");
         acceptor_.set_option(asio::socket_base::reuse_address(true));
         
-        std::cout << "[DEBUG] Binding to port " << port << "...\n";
+        LOG_DEBUG("Binding to port {}...", port);
         acceptor_.bind(tcp::endpoint(tcp::v4(), port));
         
-        std::cout << "[DEBUG] Starting to listen...\n";
+        LOG_DEBUG("Starting to listen...");
         acceptor_.listen();
         
-        std::cout << "Server listening on 0.0.0.0:" << port << std::endl;
+        LOG_INFO("Server listening on 0.0.0.0:{}", port);
         
     } catch (const std::exception& e) {
-        std::cerr << "Failed to start server: " << e.what() << std::endl;
+        LOG_ERROR("Failed to start server: {}", e.what());
         throw;
     }
 }
 
 void Sender::run()
 {
+    Tracing::name_thread("validators");
 
-    std::cout << "[DEBUG] Entering run() method...\n";
-    std::cout << "[DEBUG] Starting accept...\n";
+    LOG_DEBUG("Entering run() method...");
+    LOG_DEBUG("Starting accept...");
     start_accept();
     
-    std::cout << "[DEBUG] Starting io_context.run()...\n";
-    std::cout << "Server running... (Press Ctrl+C to stop)\n";
+    LOG_DEBUG("Starting io_context.run()...");
+    LOG_INFO("Server running... (Press Ctrl+C to stop)");
     
     io_context_.run();  
     
-    std::cout << "[DEBUG] io_context.run() finished\n";
+    LOG_DEBUG("io_context.run() finished");
 }
 
 void Sender::stop()
 {
-    std::cout << "[Sender] Stopping TCP server...\n";
+    LOG_INFO("[Sender] Stopping TCP server...");
     running_ = false;
     
     if (acceptor_.is_open()) {
         asio::error_code ec;
         acceptor_.close(ec);
         if (ec) {
-            std::cerr << "[Sender] Error closing acceptor: " << ec.message() << "\n";
+            LOG_ERROR("[Sender] Error closing acceptor: {}", ec.message());
         }
     }
     
     io_context_.stop();
     
-    std::cout << "[Sender] TCP server stopped\n";
+    LOG_INFO("[Sender] TCP server stopped");
 }
 
 void Sender::start_accept()
@@ -79,11 +136,11 @@ void Sender::start_accept()
         {
             if(!ec)
             {
-                std::cout << "New client connected\n";
-                std::make_shared<Session>(std::move(socket), db_)->start();
+                LOG_INFO("New client connected");
+                std::make_shared<Session>(std::move(socket), db_, audit_)->start();
             }
             else if (ec != asio::error::operation_aborted) {
-                std::cerr << "Accept error: " << ec.message() << std::endl;
+                LOG_ERROR("Accept error: {}", ec.message());
             }
             
             if (running_) {
@@ -93,10 +150,51 @@ void Sender::start_accept()
     );
 }
 
-Session::Session(tcp::socket socket, Database& db) : socket_(std::move(socket)), db_(db) {}
+Session::Session(tcp::socket socket, Database& db, AuditWriter& audit) 
+    : accepted_at_(std::chrono::steady_clock::now())
+    , socket_(std::move(socket))
+    , db_(db) 
+    , audit_(audit)
+{
+    flight_.wall_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::uint32_t Session::since_accept() const noexcept
+{
+    return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - accepted_at_).count());
+}
+
+void Session::begin_handling(RequestKind kind, std::string_view key)
+{
+    kind_ = kind;
+    flight_.command = static_cast<std::uint8_t>(kind);
+    flight_.key_hash = key.empty() ? 0 : FlightRecorder::hash_key(key);
+    flight_.parsed_us = since_accept();
+}
+
+void Session::set_outcome(FlightRecorder::Result result, int error) noexcept
+{
+    flight_.result = result;
+    flight_.error = static_cast<std::uint16_t>(error);
+}
+
+void Session::record_trace() const noexcept
+{
+    auto at = [this](std::uint32_t us) { return accepted_at_ + std::chrono::microseconds(us); };
+    auto parsed_us = flight_.parsed_us ? flight_.parsed_us : flight_.handled_us;
+
+    Tracing::record(trace_id_, "request", accepted_at_, at(flight_.written_us), true);
+    Tracing::record(trace_id_, "read", accepted_at_, at(flight_.read_us), true);
+    Tracing::record(trace_id_, "parse", at(flight_.read_us), at(parsed_us));
+    Tracing::record(trace_id_, "handle", at(parsed_us), at(flight_.handled_us));
+    Tracing::record(trace_id_, "write", at(flight_.handled_us), at(flight_.written_us), true);
+}
 
 void Session::start()
 {
+    Tracing::record(trace_id_, "accept", accepted_at_, std::chrono::steady_clock::now());
     do_read();
 }
 
@@ -111,17 +209,20 @@ void Session::do_read()
             if(!ec)
             {
                 request_start_time = std::chrono::steady_clock::now();
-                std::string request(buffer_.data(), bytes_transferred);
+                flight_.read_us = since_accept();
+                OCU_PROBE(request__start, bytes_transferred);
+                std::string_view request(buffer_.data(), bytes_transferred);
 
-                request.erase(
-                    std::remove_if(request.begin(), request.end(), [](char c) { return c == '\n' || c == '\r';}), request.end()
-                );
+                LOG_DEBUG("Received: {}", request);
 
-                std::cout << "Received: " << request << "\n";
+                Tracing::Activate trace(trace_id_);
                 process_request(request);
             }
             else if (ec != asio::error::eof)
-                std::cerr << "Read error: " << ec.message() << "\n";
+            {
+                request_errors.inc();
+                LOG_ERROR("Read error: {}", ec.message());
+            }
         }
     );
 }
@@ -130,6 +231,7 @@ void Session::do_write(std::string response)
 {
     auto self = shared_from_this();
     response += "\n";
+    flight_.handled_us = since_accept();
 
     asio::async_write(
         socket_,
@@ -140,10 +242,23 @@ void Session::do_write(std::string response)
                 auto end_time = std::chrono::steady_clock::now();
                 auto latency = std::chrono::duration_cast<std::chrono::microseconds>( end_time - request_start_time).count();
 
-                std::cout << "Request latency: " << latency << "μs (" << (latency / 1000.0) << " ms)\n";
+                const auto& metrics = request_metrics[static_cast<std::size_t>(kind_)];
+                metrics.requests->inc();
+                metrics.latency->observe(end_time - request_start_time);
+
+                LOG_INFO("Request latency: {}μs ({} ms)", latency, (latency / 1000.0));
+
+                flight_.written_us = since_accept();
+                FlightRecorder::recorder().record(flight_);
+                FlightRecorder::recorder().note_latency(std::chrono::microseconds(latency));
+                record_trace();
+                OCU_PROBE(request__end, static_cast<int>(kind_), static_cast<int>(flight_.result), latency);
             }
             if (ec) 
-                std::cerr << "Write error: " << ec.message() << "\n";
+            {
+                request_errors.inc();
+                LOG_ERROR("Write error: {}", ec.message());
+            }
     
             socket_.close();
         }
@@ -152,170 +267,143 @@ void Session::do_write(std::string response)
 
 void Session::process_request(std::string_view request)
 {
-    std::string trimmed(request);
-    
-    trimmed.erase(
-        std::remove_if(trimmed.begin(), trimmed.end(), 
-            [](unsigned char c) { return c == '\r' || c == '\n'; }),
-        trimmed.end()
-    );
-    
-    auto start = trimmed.find_first_not_of(" \t");
-    auto end = trimmed.find_last_not_of(" \t");
-    
-    if (start == std::string::npos) {
-        std::cout << "Empty request\n";
+    auto parsed = Protocol::parse(request);
+
+    if (parsed.error == Protocol::ParseError::Empty) {
+        LOG_INFO("Empty request");
+        set_outcome(FlightRecorder::Result::Rejected);
         do_write("FAIL Empty request");
         return;
     }
     
-    trimmed = trimmed.substr(start, end - start + 1);
-    
-    std::cout << "Received: \"" << trimmed << "\"\n";
-    
-    if (trimmed == "FETCH_ARTICLES") {
-        std::cout << "Command: Fetch articles\n";
-        handle_fetch_articles();
-        return;
-    }
-    
-    if (trimmed.starts_with("PURCHASE ")) {
-        auto args = trimmed.substr(9);  
-        
-        std::istringstream iss(args);
-        std::string article_id_str, card_number;
-        int quantity;
+    LOG_INFO("Received: \"{}\"", Protocol::trim(request));
 
-        if(!(iss >> article_id_str >> card_number >> quantity))
-        {
-            std::cout << "Invalid PURCHASE format \n";
-            do_write("FAIL Invalid format");
-            return;
-        }
+    std::visit([this, &parsed](const auto& command) { on_command(command, parsed.error); }, parsed.command);
+}
 
+void Session::on_command(std::monostate, Protocol::ParseError)
+{
+    LOG_INFO("Unknown command");
+    set_outcome(FlightRecorder::Result::Rejected);
+    do_write("FAIL Unknown command");
+}
 
+void Session::on_command(const Protocol::FetchArticles&, Protocol::ParseError)
+{
+    begin_handling(RequestKind::FetchArticles);
+    LOG_INFO("Command: Fetch articles");
+    handle_fetch_articles();
+}
 
-        /*
-        std::cout << "[DEBUG] Parsing args: \"" << args << "\"\n";
-        
-        auto space_pos = args.find(' ');
-        
-        if (space_pos == std::string::npos) {
-            std::cout << "Invalid PURCHASE format: no space between article_id and card_number or quantity\n";
-            std::cout << "   Expected: PURCHASE <article_id> <card_number> <quantity>\n";
-            std::cout << "   Received: PURCHASE " << args << "\n";
-            do_write("FAIL Invalid format");
-            return;
-        }
-        
-        std::string article_id_str = args.substr(0, space_pos);
-        std::string card_number = args.substr(space_pos + 1);
-        int quantity = std::stoi(args.substr(space_pos + 2));
-        */
-        
-        auto card_start = card_number.find_first_not_of(" \t");
-        if (card_start != std::string::npos) {
-            card_number = card_number.substr(card_start);
-        }
-        
-        std::cout << "[DEBUG] Article ID string: \"" << article_id_str << "\"\n";
-        std::cout << "[DEBUG] Card number: \"" << card_number << "\"\n";
-        std::cout << "[DEBUG] Quantity: \"" << quantity << "\"\n";
-        
-        try 
-        {
-            int article_id = std::stoi(article_id_str);
-            std::cout << "Command: Purchase article " << article_id 
-                     << " with card \"" << card_number << "\"\n";
-            handle_purchase(article_id, card_number, quantity);
-        } 
-        catch (const std::exception& e) 
-        {
-            std::cout << "Invalid article_id: \"" << article_id_str << "\" (" << e.what() << ")\n";
-            do_write("FAIL Invalid article_id");
-        }
+void Session::on_command(const Protocol::DumpFlight&, Protocol::ParseError)
+{
+    begin_handling(RequestKind::DumpFlight);
+    LOG_INFO("Command: Dump flight recorder");
+    FlightRecorder::recorder().request_dump();
+    set_outcome(FlightRecorder::Result::Accepted);
+    do_write("OK");
+}
+
+void Session::on_command(const Protocol::Purchase& purchase, Protocol::ParseError error)
+{
+    begin_handling(RequestKind::Purchase, purchase.card_number);
+
+    if (error == Protocol::ParseError::InvalidArticleId) {
+        LOG_INFO("Invalid article_id in PURCHASE");
+        set_outcome(FlightRecorder::Result::Rejected);
+        do_write("FAIL Invalid article_id");
+        return;
+    }
+    if (error != Protocol::ParseError::None) {
+        LOG_INFO("Invalid PURCHASE format: {}", Protocol::describe(error));
+        set_outcome(FlightRecorder::Result::Rejected);
+        do_write("FAIL Invalid format");
         return;
     }
     
-    if(trimmed.starts_with("QR"))
+    LOG_INFO("Command: Purchase article {} with card \"{}\" quantity {}", purchase.article_id, purchase.card_number, purchase.quantity);
+    handle_purchase(purchase.article_id, purchase.card_number, purchase.quantity);
+}
+
+void Session::on_command(const Protocol::QrScan& scan, Protocol::ParseError error)
+{
+    //KsF-Zet|
+    //1488bf99-9b7d-4c25-b00b-22065f12649b|
+    //638974309111354660|
+    //e279acf941396b65aec32aeca1c0e4bf4b2a9cddc500f99677a9ff7f800ebe75
+    begin_handling(RequestKind::QR, scan.token);
+    int validator_id = 1;
+
+    if (error != Protocol::ParseError::None)
     {
-        // 1. get QR string only
-
-        //KsF-Zet|
-        //1488bf99-9b7d-4c25-b00b-22065f12649b|
-        //638974309111354660|
-        //e279acf941396b65aec32aeca1c0e4bf4b2a9cddc500f99677a9ff7f800ebe75
-        auto args = trimmed.substr(2);
-        std::istringstream iss(args);
-        std::string token;
-        std::string uuid;
-        std::string timestamp;
-        std::string hash;
-        int validator_id = 1;
-
-        if (std::getline(iss, uuid, '|') && 
-            std::getline(iss, token, '|') && 
-            std::getline(iss, timestamp, '|') && 
-            std::getline(iss, hash)) 
-        {
-            
- 
-            std::cout << "Parsed QR: uuid" << uuid  
-                    << ", token: "<< token 
-                    << ", timestamp=" << timestamp
-                    << ", hash=" << hash 
-                    << ", validator_id=" << validator_id << "\n";
-            
-        } 
-        else 
-        {
-            std::cout << "Invalid QR format \n";
-            do_write("Invalid QR format");
-            return;
-        }
+        LOG_INFO("Invalid QR format: {}", Protocol::describe(error));
+        set_outcome(FlightRecorder::Result::Rejected);
+        do_write("Invalid QR format");
+        return;
+    }
 
-        try
-        {
-            std::cout << "Handling QR token \n";
-            validate_QR(token);
-            //handle_QR(token, validator_id);
-        }
-        catch(const std::exception& e)
-        {
-            std::cout << "Error in QR handling \n";
-            do_write("Error in QR handling");
-        }
+    LOG_INFO("Parsed QR: uuid{}, token: {}, timestamp={}, hash={}, validator_id={}", scan.code, scan.token, scan.ticks, scan.hash, validator_id);
 
+    if (auto freshness = QrAuth::check_freshness(scan); freshness != QrAuth::Freshness::Fresh)
+    {
+        auto age = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now() - Qr::from_ticks(static_cast<std::int64_t>(scan.issued_ticks)));
+        LOG_INFO("QR code {}: {} ({} s old)",
+                 freshness == QrAuth::Freshness::Expired ? "expired" : "from the future", scan.token, age.count());
+        qr_stale.inc();
+        set_outcome(FlightRecorder::Result::Rejected);
+        do_write(R"({"isValid":false})");
         return;
-
     }
 
+    bool signature_verified = false;
+    if (QrAuth::enabled())
+    {
+        if (!QrAuth::verify(scan))
+        {
+            LOG_INFO("QR signature mismatch: {}", scan.token);
+            qr_bad_signatures.inc();
+            set_outcome(FlightRecorder::Result::Rejected);
+            do_write(R"({"isValid":false})");
+            return;
+        }
+        signature_verified = true;
+    }
 
-    bool is_card = !trimmed.empty() && std::all_of(trimmed.begin(), trimmed.end(), 
-                       [](char c) { return std::isdigit(c) || std::isalpha(c); });
-
-    if (is_card) {
-        std::cout << "Legacy: Validate card \"" << trimmed << "\"\n";
-        handle_card_validation(trimmed);
-        return;
+    try
+    {
+        LOG_INFO("Handling QR token");
+        validate_QR(scan.token, signature_verified);
+        //handle_QR(scan.token, validator_id);
     }
-    
-    std::cout << "Unknown command: \"" << trimmed << "\"\n";
-    do_write("FAIL Unknown command");
+    catch(const std::exception& e)
+    {
+        LOG_INFO("Error in QR handling");
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write("Error in QR handling");
+    }
+}
+
+void Session::on_command(const Protocol::CardTap& tap, Protocol::ParseError)
+{
+    begin_handling(RequestKind::Card, tap.card_number);
+    LOG_INFO("Legacy: Validate card \"{}\"", tap.card_number);
+    handle_card_validation(tap.card_number);
 }
 
 std::optional<int> Session::find_coupon_by_card(std::string_view card_number) {
-    Coupons::CouponManager manager(db_.get());
-    
-    if (!manager.is_valid_card(card_number)) 
-        return std::nullopt;
-       
-    auto coupons = manager.get_coupons_by_card(card_number);
-    
-    if (coupons.empty()) 
-        return std::nullopt;
-    
-    return coupons[0].coupon_id;
+    if (auto index = Coupons::card_index()) {
+        auto match = index->find(card_number);
+        if (match.status == Coupons::CardIndex::Status::Inactive)
+            LOG_INFO("Card expired or not yet valid for: {}", card_number);
+        if (match.status != Coupons::CardIndex::Status::Valid)
+            return std::nullopt;
+        return match.coupon_id;
+    }
+
+    // Before the first index build: the same answer from the table.
+    Coupons::CouponManager manager(db_);
+    return manager.find_valid_coupon(card_number);
 }
 
 void Session::handle_fetch_articles()
@@ -336,28 +424,24 @@ void Session::handle_fetch_articles()
             "LIMIT 5;";
 
 
-        sqlite3_stmt* stmt;
-        if(sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+        Tracing::Span prepare_span("prepare");
+        auto statement = db_.read(sql, Database::Plan::Scan);
+        sqlite3_stmt* stmt = statement.get();
+        if(!stmt)
         {
-            std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db_.get()) << std::endl;
+            LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_.reader()));
+            set_outcome(FlightRecorder::Result::Failed, sqlite3_errcode(db_.reader()));
             do_write("[]");
             return;
         }
+        prepare_span.end();
         auto prepare_time = std::chrono::steady_clock::now();
         auto prepare_latency = std::chrono::duration_cast<std::chrono::microseconds>(prepare_time - query_start).count();
         
-        struct StmtDeleter
-        {
-            void operator()(sqlite3_stmt* s) const noexcept
-            {
-                if(s) sqlite3_finalize(s);
-            }
-        };
-        std::unique_ptr<sqlite3_stmt, StmtDeleter> stmt_guard(stmt);
-
         json articles_array = json::array();
         int count = 0;
 
+        Tracing::Span step_span("step");
         while(sqlite3_step(stmt) == SQLITE_ROW)
         {
             json article;
@@ -371,45 +455,68 @@ void Session::handle_fetch_articles()
             articles_array.push_back(article);
             count++;
         }
+        step_span.end();
         
         std::string response = articles_array.dump();
         
         if (count == 0) 
         {
-            std::cout << "No matching articles found in database\n";
-            std::cout << "  Run: ./OCU fetch article\n";
+            LOG_INFO("No matching articles found in database");
+            LOG_INFO("  Run: ./OCU fetch article");
         } 
         else 
         {
-            std::cout << "Found and sending " << count << " articles from database\n";
+            LOG_INFO("Found and sending {} articles from database", count);
         }
         
 
         auto query_end = std::chrono::steady_clock::now();
         auto total_query = std::chrono::duration_cast<std::chrono::microseconds>( query_end - query_start).count();
 
-        std::cout << "DB prepare: " << prepare_latency << " μs, "<< "Total query: " << total_query << " μs\n";
+        LOG_INFO("DB prepare: {} μs, Total query: {} μs", prepare_latency, total_query);
         
+        set_outcome(FlightRecorder::Result::Accepted);
         do_write(response);
     } 
     catch (const std::exception& e) 
     {
-        std::cerr << "Error fetching articles: " << e.what() << "\n";
+        LOG_ERROR("Error fetching articles: {}", e.what());
+        set_outcome(FlightRecorder::Result::Failed);
         do_write("[]");
     }
 }
 
 void Session::handle_card_validation(std::string_view card_number)
 {
+    // A second tap inside the window gets the same coupon again, which
+    // validators already show as accepted, and writes no second row.
+    if (auto repeat = Taps::tap_cache().find(Taps::Kind::Card, card_number)) {
+        LOG_INFO("Card already validated: {} Coupon ID: {}", card_number, *repeat);
+        repeat_card_taps.inc();
+        set_outcome(FlightRecorder::Result::Accepted);
+        do_write(std::to_string(*repeat));
+        return;
+    }
+
     auto coupon_id = find_coupon_by_card(card_number);
     
     if (coupon_id) {
-        std::cout << "Card valid: " << card_number 
-                 << " Coupon ID: " << *coupon_id << "\n";
-        do_write(std::to_string(*coupon_id));
-        handle_insert_validation(card_number, coupon_id);
+        LOG_INFO("Card valid: {} Coupon ID: {}", card_number, *coupon_id);
+        after_audit(AuditWriter::CardValidation{std::string(card_number), true},
+            [this, card = std::string(card_number), coupon = *coupon_id](bool stored) {
+                if (!stored) {
+                    LOG_ERROR("Card validation not stored, tap refused: {}", card);
+                    set_outcome(FlightRecorder::Result::Failed);
+                    do_write("0");
+                    return;
+                }
+                Taps::tap_cache().remember(Taps::Kind::Card, card, coupon);
+                set_outcome(FlightRecorder::Result::Accepted);
+                do_write(std::to_string(coupon));
+            });
     } else {
-        std::cout << "Card invalid: " << card_number << "\n";
+        LOG_INFO("Card invalid: {}", card_number);
+        set_outcome(FlightRecorder::Result::Rejected);
         do_write("0");
     }
 }
@@ -422,106 +529,73 @@ void Session::handle_purchase(int article_id, std::string_view card_number, int
 
         if(!coupon_id)
         {
-            std::cout << "Purchase failed: Invalid card\n";
+            LOG_INFO("Purchase failed: Invalid card");
             log_purchase(article_id, card_number, quantity, false);
+            set_outcome(FlightRecorder::Result::Rejected);
             do_write("FAIL Invalid card");
             return;
         }
 
-        const char* sql = "SELECT article_name, article_price FROM articles WHERE article_id = ?;";
-
-        sqlite3_stmt* stmt;
-        if(sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+        Tracing::Span lookup_span("lookup");
+        auto article = db_.lookup("articles", "article_id", "article_name, article_price", std::int64_t{article_id});
+        if(!article)
         {
-            std::cerr << "Failed to query article\n";
+            LOG_ERROR("Failed to query article");
+            set_outcome(FlightRecorder::Result::Failed, sqlite3_errcode(db_.reader()));
             log_purchase(article_id, card_number, quantity, false);
             do_write("FAIL Database error");
             return;
         }
+        lookup_span.end();
 
-        struct StmtDeleter
-        {
-            void operator()(sqlite3_stmt* s) const noexcept
-            {
-                if(s) sqlite3_finalize(s);
-            }
-        };
-
-        std::unique_ptr<sqlite3_stmt, StmtDeleter> stmt_guard(stmt);
-        sqlite3_bind_int(stmt, 1, article_id);
-
-        if(sqlite3_step(stmt) != SQLITE_ROW)
+        if(article->empty())
         {
-            std::cout << "Purchase failed: Article not found\n";
+            LOG_INFO("Purchase failed: Article not found");
             log_purchase(article_id, card_number, quantity, false);
+            set_outcome(FlightRecorder::Result::Rejected);
             do_write("FAIL Article not found");
             return;
         }
 
-        const char* article_name = reinterpret_cast<const char*>(sqlite3_column_text(stmt,0));
-        double article_price = sqlite3_column_double(stmt, 1);
+        std::string_view article_name = article->text(0, 0);
+        double article_price = article->real(0, 1);
 
-        std::cout << "Article: " << article_name << ", Article price: " << article_price;
-        if(log_purchase(article_id,card_number, quantity, true))
-        {
-            std::cout << "Purchase successful!\n";
-            std::cout << "  Card: " << card_number << "\n";
-            std::cout << "  Article: " << article_name << "\n";
-            std::cout << "  Coupon ID: " << *coupon_id << "\n";
-            std::cout << "  Quantity: " << quantity << "\n";
-            do_write("SUCCESS");
-        }
-        else
-        {
-            std::cout << "Failed to log purchase\n";
-            do_write("FAIL Logging error");
-        }
+        LOG_INFO("Article: {}, Article price: {}", article_name, article_price);
+        after_audit(AuditWriter::Purchase{article_id, std::string(card_number), quantity, true},
+            [this, card = std::string(card_number), article = std::string(article_name),
+             coupon = *coupon_id, quantity](bool stored)
+            {
+                if(!stored)
+                {
+                    LOG_INFO("Failed to log purchase");
+                    set_outcome(FlightRecorder::Result::Failed);
+                    do_write("FAIL Logging error");
+                    return;
+                }
+                LOG_INFO("Purchase successful!");
+                LOG_INFO("  Card: {}", card);
+                LOG_INFO("  Article: {}", article);
+                LOG_INFO("  Coupon ID: {}", coupon);
+                LOG_INFO("  Quantity: {}", quantity);
+                set_outcome(FlightRecorder::Result::Accepted);
+                do_write("SUCCESS");
+            });
     }
     catch(const std::exception& e)
     {
-        std::cerr << "Purchase error: " << e.what() << std::endl;
+        LOG_ERROR("Purchase error: {}", e.what());
         log_purchase(article_id, card_number, quantity, false);
+        set_outcome(FlightRecorder::Result::Failed);
         do_write("FAIL Internal error");
     }
 }
 
-bool Session::log_purchase(int article_id, std::string_view card_number, int quantity, bool success)
+void Session::log_purchase(int article_id, std::string_view card_number, int quantity, bool success)
 {
-    const char* sql = 
-        "INSERT INTO purchases (article_id, card_number, quantity, success, timestamp) "
-        "VALUES (?, ?, ?, ?, datetime('now', 'localtime'));";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        std::cerr << "Failed to prepare purchase log: " << sqlite3_errmsg(db_.get()) << "\n";
-        return false;
-    }
-    
-    struct StmtDeleter 
-    {
-        void operator()(sqlite3_stmt* s) const noexcept 
-        {
-            if (s) sqlite3_finalize(s);
-        }
-    };
-    std::unique_ptr<sqlite3_stmt, StmtDeleter> stmt_guard(stmt);
-    
-    sqlite3_bind_int(stmt, 1, article_id);
-    sqlite3_bind_text(stmt, 2, card_number.data(), card_number.size(), SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 3, quantity);
-    sqlite3_bind_int(stmt, 4, success ? 1 : 0);
-    
-    if (sqlite3_step(stmt) != SQLITE_DONE) 
-    {
-        std::cerr << "Failed to log purchase: " << sqlite3_errmsg(db_.get()) << "\n";
-        return false;
-    }
-    
-    return true;
-}   
+    audit_.write(AuditWriter::Purchase{article_id, std::string(card_number), quantity, success});
+}
 
-void Session::handle_QR(std::string token, int validator_id)
+void Session::handle_QR(std::string_view token, int validator_id)
 {
     bool success = validate_QR(token);
     if(!success) 
@@ -530,180 +604,160 @@ void Session::handle_QR(std::string token, int validator_id)
         return;
     }
 
-    const char* sql =
-        "INSERT INTO qr_validated(qr_code, validator_id, valid) "
-        "VALUES (?, ?, ?);";
+    audit_.write(AuditWriter::QrValidation{std::string(token), validator_id, success});
+}
 
-    sqlite3_stmt* stmt;
-    if(sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+bool Session::validate_QR(std::string_view token, bool signature_verified)
+{
+    if(Taps::tap_cache().find(Taps::Kind::Token, token))
     {
-        std::cerr << "Failed to prepare QR_validate\n", sqlite3_errmsg(db_.get());
-        return;
+        LOG_INFO("Ticket already validated: {}", token);
+        repeat_qr_scans.inc();
+        set_outcome(FlightRecorder::Result::Accepted);
+        do_write(R"({"isValid":true,"alreadyValidated":true})");
+        return true;
     }
 
-    struct StmtDeleter
+    if(!Tickets::token_filter().may_contain(token))
     {
-        void operator()(sqlite3_stmt* s) const noexcept
-        {
-            if(s) sqlite3_finalize(s);
-        }
-    };
-    std::unique_ptr<sqlite3_stmt, StmtDeleter> stmt_guard(stmt);
+        if(signature_verified)
+            return accept_offline(token);
 
-    sqlite3_bind_text(stmt, 1, token.data(), token.size(), SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 2, validator_id);
-    sqlite3_bind_int(stmt, 3, success);
-
-    if(sqlite3_step(stmt) != SQLITE_DONE)
-    {
-        std::cerr << "Failed to log qr validation: " << sqlite3_errmsg(db_.get()) << "\n";
-        return;
+        LOG_INFO("Ticket unknown (token filter): {}", token);
+        set_outcome(FlightRecorder::Result::Rejected);
+        do_write(R"({"isValid":false})");
+        return false;
     }
 
-    return;
-}
-
-bool Session::validate_QR(std::string token)
-{
-    const char* sql = 
-        "SELECT token, valid_from, valid_to from tickets where token = ?;";
-
-    sqlite3_stmt* stmt;
-
-    if(sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    // Columns: activated (times set), start and end of the validity window
+    // as Unix seconds. Cached until a write touches the ticket's row.
+    Tracing::Span lookup_span("lookup");
+    auto ticket = db_.lookup("tickets", "token",
+        "valid_from IS NOT NULL AND valid_to IS NOT NULL, valid_from_epoch, valid_to_epoch",
+        std::string(token));
+    if(!ticket)
     {
-        std::cerr << "Failed to prepare query for validate_QR: " << sqlite3_errmsg(db_.get()) << "\n";
+        LOG_ERROR("Failed to query ticket for validate_QR: {}", sqlite3_errmsg(db_.reader()));
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write(R"({"isValid":false})");
         return false;
     }
+    lookup_span.end();
 
-    sqlite3_bind_text(stmt, 1, token.c_str(), -1, SQLITE_TRANSIENT);
-
+    std::int64_t now_epoch = std::time(nullptr);
     bool is_valid = false;
 
-    if(sqlite3_step(stmt) == SQLITE_ROW)
+    if(!ticket->empty())
     {
-        const char* valid_from_str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        const char* valid_to_str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-
-        if(valid_from_str && valid_to_str)
+        if(ticket->integer(0, 0))
         {
-            std::string valid_from_copy(valid_from_str);
-            std::string valid_to_copy(valid_to_str);
-
-            auto time_from = parse_iso8601(valid_from_copy);
-            auto time_to = parse_iso8601(valid_to_copy);
-            auto now = std::chrono::system_clock::now();
-
-            if(time_from && time_to)
+            if(!ticket->is_null(0, 1) && !ticket->is_null(0, 2))
             {
-                is_valid = (now >= *time_from && now <= *time_to);
+                std::int64_t valid_to = ticket->integer(0, 2);
+                is_valid = ticket->integer(0, 1) <= now_epoch && now_epoch <= valid_to;
                 if(is_valid) 
                 {
-                    std::cout << "Ticket is VALID (within time range)\n";
+                    LOG_INFO("Ticket is VALID (within time range)");
+                    Taps::tap_cache().remember(Taps::Kind::Token, token, 1, Taps::TapCache::Clock::now(),
+                        std::chrono::seconds(valid_to - now_epoch));
                 }
                 else 
                 {
-                    std::cout << "Ticket EXPIRED or not yet valid\n";
+                    LOG_INFO("Ticket EXPIRED or not yet valid");
                 }
             }
             else
             {
-                std::cout << "Failed to parse times\n";
+                LOG_INFO("Ticket times did not parse");
             }
         }
         else
         {
-            std::cout << "Ticket times are NULL - activating ticket\n";
-            
-            sqlite3_finalize(stmt);
+            LOG_INFO("Ticket times are NULL - activating ticket");
             
-            char* err_msg = nullptr;
-            if (sqlite3_exec(db_.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, &err_msg) != SQLITE_OK) {
-                std::cerr << "Failed to begin transaction: " << err_msg << '\n';
-                sqlite3_free(err_msg);
+            Database::Transaction transaction(db_);
+            if (!transaction) {
+                LOG_ERROR("Failed to begin transaction: {}", sqlite3_errmsg(db_.get()));
+                set_outcome(FlightRecorder::Result::Failed);
+                do_write(R"({"isValid":false})");
                 return false;
             }
             
-            const char* update_sql = "UPDATE tickets SET valid_from = ?, valid_to = ? WHERE token = ?;";
-            sqlite3_stmt* stmt_update;
-            
-            if(sqlite3_prepare_v2(db_.get(), update_sql, -1, &stmt_update, nullptr) != SQLITE_OK)
+            const char* update_sql =
+                "UPDATE tickets SET valid_from = ?, valid_to = ?, valid_from_epoch = ?, valid_to_epoch = ? "
+                "WHERE token = ?;";
+            auto update_statement = db_.prepare(update_sql);
+            sqlite3_stmt* stmt_update = update_statement.get();
+            if(!stmt_update)
             {
-                std::cout << "Failed to prepare activating ticket: " << sqlite3_errmsg(db_.get()) << '\n';
-                sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+                LOG_INFO("Failed to prepare activating ticket: {}", sqlite3_errmsg(db_.get()));
+                set_outcome(FlightRecorder::Result::Failed);
+                do_write(R"({"isValid":false})");
                 return false;
             }
 
-            struct StmtDeleter
-            {
-                void operator()(sqlite3_stmt* s) const noexcept
-                {
-                    if(s) sqlite3_finalize(s);
-                }
-            };
-            std::unique_ptr<sqlite3_stmt, StmtDeleter> stmt_guard(stmt_update);
-            
             auto now = std::chrono::system_clock::now();
-            auto expires = now + std::chrono::minutes(30);
+            auto expires = now + ticket_activation_period;
                 
-            std::string valid_from_new = format_iso8601(now);
-            std::string valid_to_new = format_iso8601(expires);
+            std::string valid_from_new = DateTime::format_local(now);
+            std::string valid_to_new = DateTime::format_local(expires);
                 
             sqlite3_bind_text(stmt_update, 1, valid_from_new.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt_update, 2, valid_to_new.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_text(stmt_update, 3, token.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt_update, 3, std::chrono::system_clock::to_time_t(now));
+            sqlite3_bind_int64(stmt_update, 4, std::chrono::system_clock::to_time_t(expires));
+            sqlite3_bind_text(stmt_update, 5, token.data(), static_cast<int>(token.size()), SQLITE_TRANSIENT);
 
+            Tracing::Span update_span("step");
             if(sqlite3_step(stmt_update) != SQLITE_DONE)
             {
-                std::cout << "Failed to activate ticket: " << sqlite3_errmsg(db_.get()) << '\n';
-                sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+                LOG_INFO("Failed to activate ticket: {}", sqlite3_errmsg(db_.get()));
+                set_outcome(FlightRecorder::Result::Failed);
+                do_write(R"({"isValid":false})");
                 return false;
             }
+            update_span.end();
             
             // Commit transaction
-            if (sqlite3_exec(db_.get(), "COMMIT;", nullptr, nullptr, &err_msg) != SQLITE_OK) {
-                std::cerr << "Failed to commit transaction: " << err_msg << '\n';
-                sqlite3_free(err_msg);
+            Tracing::Span commit_span("commit");
+            OCU_PROBE(commit__start);
+            int commit_rc = transaction.commit();
+            OCU_PROBE(commit__done, commit_rc);
+            if (commit_rc != SQLITE_OK) {
+                LOG_ERROR("Failed to commit transaction: {}", sqlite3_errstr(commit_rc));
+                set_outcome(FlightRecorder::Result::Failed);
+                do_write(R"({"isValid":false})");
                 return false;
             }
+            commit_span.end();
             
-            int log_size, checkpointed;
-            int rc = sqlite3_wal_checkpoint_v2(
-                db_.get(),
-                nullptr,
-                SQLITE_CHECKPOINT_FULL,
-                &log_size,
-                &checkpointed
-            );
-            
-            if (rc != SQLITE_OK) {
-                std::cerr << "Warning: WAL checkpoint failed: " 
-                         << sqlite3_errmsg(db_.get()) << '\n';
-            } else {
-                std::cout << "WAL checkpoint: " << checkpointed 
-                         << "/" << log_size << " frames checkpointed\n";
-            }
-            
-            std::cout << "Ticket ACTIVATED\n";
+            LOG_INFO("Ticket ACTIVATED");
+            Taps::tap_cache().remember(Taps::Kind::Token, token, 1);
+            set_outcome(FlightRecorder::Result::Accepted);
             do_write(R"({"status":"TICKET_ACTIVATED","isValid":true})");
             return true;
         }
     }
+    else if(signature_verified)
+    {
+        return accept_offline(token);
+    }
     else
     {
-        std::cout << "Ticket NOT FOUND in database\n";
+        LOG_INFO("Ticket NOT FOUND in database");
+        Tickets::token_filter().note_false_positive();
     }
     
-    sqlite3_finalize(stmt);
-    
     if(is_valid) 
     {
-        std::cout << "Valid QR token: " << token << "\n";
+        LOG_INFO("Valid QR token: {}", token);
+        set_outcome(FlightRecorder::Result::Accepted);
         do_write(R"({"isValid":true})");
     }
     else
     {
-        std::cout << "Invalid QR token: " << token << "\n";
+        LOG_INFO("Invalid QR token: {}", token);
+        set_outcome(FlightRecorder::Result::Rejected);
         do_write(R"({"isValid":false})");
     }
     
@@ -712,109 +766,113 @@ bool Session::validate_QR(std::string token)
 
 
 
-std::optional<std::chrono::system_clock::time_point>
-    Session::parse_iso8601(std::string_view datetime_str)
+bool Session::accept_offline(std::string_view token)
+{
+    // A correctly signed code for a ticket the gRPC stream has not delivered
+    // yet. Store it already activated so later scans see the same window;
+    // a row that arrived for the token meanwhile is activated instead, and
+    // the stream later fills in this row (see TicketManager::InsertTicket).
+    const char* sql =
+        "INSERT INTO tickets (token, active, valid_from, valid_to, valid_from_epoch, valid_to_epoch) "
+        "VALUES (?, 1, ?, ?, ?, ?) "
+        "ON CONFLICT(token) WHERE token IS NOT NULL AND token != '' DO UPDATE SET "
+        "valid_from = coalesce(valid_from, excluded.valid_from), "
+        "valid_to = coalesce(valid_to, excluded.valid_to), "
+        "valid_from_epoch = coalesce(valid_from_epoch, excluded.valid_from_epoch), "
+        "valid_to_epoch = coalesce(valid_to_epoch, excluded.valid_to_epoch);";
+
+    // Its own transaction: on the shared writer connection, a bare step
+    // would join whichever transaction another thread has open, and be
+    // lost with it on a rollback.
+    Database::Transaction transaction(db_);
+    if(!transaction)
     {
-        std::tm tm = {};
-        
-        int year, month, day, hour, min, sec;
-        int parsed = std::sscanf(datetime_str.data(), "%d-%d-%dT%d:%d:%d",
-                                &year, &month, &day, &hour, &min, &sec);
-        
-        if (parsed != 6) {
-            return std::nullopt;
-        }
-        
-        tm.tm_year = year - 1900;
-        tm.tm_mon = month - 1;
-        tm.tm_mday = day;
-        tm.tm_hour = hour;
-        tm.tm_min = min;
-        tm.tm_sec = sec;
-        tm.tm_isdst = -1;  
-        
-        std::time_t time = std::mktime(&tm);
-        if (time == -1) {
-            return std::nullopt;
-        }
-        
-        return std::chrono::system_clock::from_time_t(time);
-
+        LOG_ERROR("Failed to begin transaction: {}", sqlite3_errmsg(db_.get()));
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write(R"({"isValid":false})");
+        return false;
     }
-std::string Session::format_iso8601(const std::chrono::system_clock::time_point& tp)
-{
-    std::time_t time = std::chrono::system_clock::to_time_t(tp);
-    std::tm tm = *std::localtime(&time);
-    
-    char buffer[20];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
-    
-    return std::string(buffer);
-}
-
-void Session::handle_insert_validation(std::string_view card_number,std::optional<int> coupon_id)
-{
-    std::string card_num(card_number);
 
-    char* err_msg = nullptr;
-    if(sqlite3_exec(db_.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, &err_msg) != SQLITE_OK)
+    // The stream may have stored the ticket since the lookup; its token is
+    // then in the filter already unless swept, and is not added twice.
+    bool token_in_filter = false;
     {
-        std::cerr << "[handle_insert_validation] Failed to begin transaction: " << err_msg << '\n';
-        sqlite3_free(err_msg);
-        return;
+        auto stored = db_.prepare("SELECT valid_to_epoch FROM tickets WHERE token = ?;");
+        if(stored)
+        {
+            sqlite3_bind_text(stored.get(), 1, token.data(), static_cast<int>(token.size()), SQLITE_TRANSIENT);
+            if(sqlite3_step(stored.get()) == SQLITE_ROW)
+            {
+                std::optional<std::int64_t> stored_valid_to;
+                if(sqlite3_column_type(stored.get(), 0) != SQLITE_NULL)
+                    stored_valid_to = sqlite3_column_int64(stored.get(), 0);
+                token_in_filter = Tickets::token_filter().holds_stored(stored_valid_to);
+            }
+        }
     }
 
-
-    const char* sql = "INSERT INTO card_validated (card_id, valid) values (?,?);";
-
-    sqlite3_stmt* stmt;
-
-    if(sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    auto statement = db_.prepare(sql);
+    sqlite3_stmt* stmt = statement.get();
+    if(!stmt)
     {
-        std::cerr << "[handle_insert_validation] Failed to prepare statement: " << sqlite3_errmsg(db_.get());
-        sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
-        return;
+        LOG_ERROR("Failed to prepare offline ticket: {}", sqlite3_errmsg(db_.get()));
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write(R"({"isValid":false})");
+        return false;
     }
 
-    sqlite3_bind_text(stmt, 1, card_num.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 2, 1);
+    auto now = std::chrono::system_clock::now();
+    auto expires = now + ticket_activation_period;
+    std::string valid_from = DateTime::format_local(now);
+    std::string valid_to = DateTime::format_local(expires);
+    std::int64_t valid_to_epoch = std::chrono::system_clock::to_time_t(expires);
+
+    sqlite3_bind_text(stmt, 1, token.data(), static_cast<int>(token.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, valid_from.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, valid_to.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, std::chrono::system_clock::to_time_t(now));
+    sqlite3_bind_int64(stmt, 5, valid_to_epoch);
 
+    Tracing::Span step_span("step");
     if(sqlite3_step(stmt) != SQLITE_DONE)
     {
-        std::cerr << "[handle_insert_validation] Failed to insert card validation: " 
-            << sqlite3_errmsg(db_.get()) << '\n';
-        sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
-        return;
+        LOG_ERROR("Failed to store offline ticket: {}", sqlite3_errmsg(db_.get()));
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write(R"({"isValid":false})");
+        return false;
     }
-
-    if (sqlite3_exec(db_.get(), "COMMIT;", nullptr, nullptr, &err_msg) != SQLITE_OK) 
+    step_span.end();
+    statement.reset();
+
+    Tracing::Span commit_span("commit");
+    OCU_PROBE(commit__start);
+    int commit_rc = transaction.commit();
+    OCU_PROBE(commit__done, commit_rc);
+    if(commit_rc != SQLITE_OK)
     {
-        std::cerr << "[handle_insert_validation] Failed to commit card validation: " << err_msg << '\n';
-        sqlite3_free(err_msg);
-        return;
+        LOG_ERROR("Failed to commit offline ticket: {}", sqlite3_errstr(commit_rc));
+        set_outcome(FlightRecorder::Result::Failed);
+        do_write(R"({"isValid":false})");
+        return false;
     }
+    commit_span.end();
+
+    if(!token_in_filter)
+        Tickets::token_filter().add(token, valid_to_epoch);
+    LOG_INFO("Ticket not delivered yet, signature valid - ACTIVATED offline: {}", token);
+    Taps::tap_cache().remember(Taps::Kind::Token, token, 1);
+    set_outcome(FlightRecorder::Result::Accepted);
+    do_write(R"({"status":"TICKET_ACTIVATED","isValid":true,"offline":true})");
+    return true;
+}
 
-    int log_size, checkpointed;
-    int rc = sqlite3_wal_checkpoint_v2(
-        db_.get(),
-        nullptr,  // All databases
-        SQLITE_CHECKPOINT_FULL,  
-        &log_size,
-        &checkpointed
-    );
-
-    if (rc != SQLITE_OK) 
-    {
-        std::cerr << "[handle_insert_validation] Warning: WAL checkpoint failed: " 
-                    << sqlite3_errmsg(db_.get()) << '\n';
-    } 
-    else 
+void Session::after_audit(AuditWriter::Row row, std::function<void(bool stored)> reply)
+{
+    // Strict durability calls back from the audit writer thread; the
+    // reply is then posted back to this session's executor.
+    auto self = shared_from_this();
+    audit_.write(std::move(row), [this, self, reply = std::move(reply)](bool stored)
     {
-        std::cout << "[handle_insert_validation] WAL checkpoint: " << checkpointed 
-                    << "/" << log_size << " frames checkpointed\n";
-    }
-
-    std::cout << "[DEBUG] Inserted card validation for " << card_num << '\n';
-    return;
-
+        asio::dispatch(socket_.get_executor(), [self, stored, reply] { reply(stored); });
+    });
 }
\ No newline at end of file
@@ -1,21 +1,37 @@
 #pragma once
 
 #include "database.hpp"
+#include "audit_writer.hpp"
 #include "coupons.hpp"
+#include "flight_recorder.hpp"
+#include "tracing.hpp"
+#include "protocol.hpp"
 #include "include/asio.hpp"
 #include <memory>
+#include <functional>
 #include <array>
 #include <string>
 #include <chrono>
+#include <cstdint>
 
 using asio::ip::tcp;
 
+enum class RequestKind : std::uint8_t
+{
+    Unknown,
+    FetchArticles,
+    Purchase,
+    QR,
+    Card,
+    DumpFlight,
+};
+
 class Session;
 
 class Sender
 {
 public:
-    explicit Sender(Database& db, int port = 8888);
+    Sender(Database& db, AuditWriter& audit, int port = 8888);
 
     void run();
     void stop();
@@ -23,6 +39,7 @@ public:
 private:
 
     Database& db_;
+    AuditWriter& audit_;
     asio::io_context io_context_; 
     tcp::acceptor acceptor_;       
     std::atomic<bool> running_;
@@ -33,30 +50,55 @@ private:
 class Session : public std::enable_shared_from_this<Session>
 {
 public:
-    Session(tcp::socket socket, Database& db);
+    Session(tcp::socket socket, Database& db, AuditWriter& audit);
     void start();
     void handle_fetch_articles();
 
 private:
+    std::chrono::steady_clock::time_point accepted_at_;
     std::chrono::steady_clock::time_point request_start_time;
+    RequestKind kind_ = RequestKind::Unknown;
+    FlightRecorder::Entry flight_{};
+    std::uint64_t trace_id_ = Tracing::sample();  // 0 unless sampled for tracing
 
     tcp::socket socket_;
     Database& db_;
+    AuditWriter& audit_;  // validation and purchase rows
     std::array<char, 1024> buffer_;
     
     void do_read();
     void do_write(std::string response);
     void process_request(std::string_view request);
 
+    // One handler per Protocol::Command alternative; process_request
+    // dispatches with std::visit. `error` is set when the command was
+    // recognised but its arguments are malformed.
+    void on_command(std::monostate, Protocol::ParseError error);
+    void on_command(const Protocol::FetchArticles& command, Protocol::ParseError error);
+    void on_command(const Protocol::DumpFlight& command, Protocol::ParseError error);
+    void on_command(const Protocol::Purchase& command, Protocol::ParseError error);
+    void on_command(const Protocol::QrScan& command, Protocol::ParseError error);
+    void on_command(const Protocol::CardTap& command, Protocol::ParseError error);
+
+    // Records the command and its key (card number or QR token) once the
+    // request has been recognised.
+    void begin_handling(RequestKind kind, std::string_view key = {});
+    void set_outcome(FlightRecorder::Result result, int error = 0) noexcept;
+    [[nodiscard]] std::uint32_t since_accept() const noexcept;
+    void record_trace() const noexcept;
+
     void handle_card_validation(std::string_view card_number);
-    void handle_insert_validation(std::string_view card_number,std::optional<int> coupon_id);
+    // Stores an audit row and calls `reply` on this session's executor once
+    // it is as durable as the configured mode requires.
+    void after_audit(AuditWriter::Row row, std::function<void(bool stored)> reply);
     void handle_purchase(int article_id, std::string_view card_number, int quantity);
-    void handle_QR(std::string token, int validator_id);
-    [[nodiscard]] bool validate_QR(std::string token);
-    [[nodiscard]] static std::optional<std::chrono::system_clock::time_point> parse_iso8601(std::string_view datetime_str);
-    [[nodiscard]] std::string format_iso8601(const std::chrono::system_clock::time_point& tp);
+    void handle_QR(std::string_view token, int validator_id);
+    // A verified signature lets a ticket unknown to the database be
+    // accepted offline (accept_offline) instead of rejected.
+    [[nodiscard]] bool validate_QR(std::string_view token, bool signature_verified = false);
+    bool accept_offline(std::string_view token);
     [[nodiscard]] std::optional<int> find_coupon_by_card(std::string_view card_number);
-    [[nodiscard]] bool log_purchase(int article_id, std::string_view card_number, int quantity, bool success);
+    void log_purchase(int article_id, std::string_view card_number, int quantity, bool success);
 };
 
 
@@ -0,0 +1,274 @@
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define OCU_SHA256_X86 1
+#endif
+
+namespace Sha256
+{
+    namespace
+    {
+        constexpr std::array<std::uint32_t, 64> K =
+        {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        constexpr std::array<std::uint32_t, 8> initial_state =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+
+        constexpr std::uint32_t rotr(std::uint32_t x, int n) noexcept
+        {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        std::uint32_t load_be32(const std::uint8_t* p) noexcept
+        {
+            return (std::uint32_t{p[0]} << 24) | (std::uint32_t{p[1]} << 16) | (std::uint32_t{p[2]} << 8) | p[3];
+        }
+
+        void compress_portable(std::uint32_t* state, const std::uint8_t* data, std::size_t blocks) noexcept
+        {
+            for (; blocks > 0; --blocks, data += block_size)
+            {
+                std::uint32_t w[64];
+                for (int i = 0; i < 16; ++i)
+                    w[i] = load_be32(data + 4 * i);
+                for (int i = 16; i < 64; ++i)
+                {
+                    std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+
+                std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+                std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+                for (int i = 0; i < 64; ++i)
+                {
+                    std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+                    std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                    h = g; g = f; f = e; e = d + t1;
+                    d = c; c = b; b = a; a = t1 + t2;
+                }
+
+                state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+                state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            }
+        }
+
+#if defined(OCU_SHA256_X86)
+        bool cpu_has_sha() noexcept
+        {
+            unsigned eax, ebx, ecx, edx;
+            if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+                return false;
+            bool sha = ebx & (1u << 29);
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return false;
+            bool ssse3 = ecx & (1u << 9);
+            bool sse41 = ecx & (1u << 19);
+            return sha && ssse3 && sse41;
+        }
+
+        // The SHA extensions keep the state as ABEF/CDGH and run two rounds
+        // per sha256rnds2; sha256msg1/msg2 extend the schedule four words
+        // at a time, so w[g % 4] holds words 4g..4g+3 of the current group.
+        __attribute__((target("sha,ssse3,sse4.1")))
+        void compress_sha_ni(std::uint32_t* state, const std::uint8_t* data, std::size_t blocks) noexcept
+        {
+            const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+            __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+            __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+            __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+            state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+            for (; blocks > 0; --blocks, data += block_size)
+            {
+                const __m128i abef = state0;
+                const __m128i cdgh = state1;
+                __m128i w[4];
+
+                #pragma GCC unroll 16
+                for (int g = 0; g < 16; ++g)
+                {
+                    __m128i& current = w[g % 4];
+                    if (g < 4)
+                        current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * g)), byte_swap);
+
+                    __m128i msg = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(K.data() + 4 * g)));
+                    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+                    if (g >= 3 && g < 15)
+                    {
+                        __m128i& next = w[(g + 1) % 4];
+                        next = _mm_add_epi32(next, _mm_alignr_epi8(current, w[(g + 3) % 4], 4));
+                        next = _mm_sha256msg2_epu32(next, current);
+                    }
+
+                    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+
+                    if (g >= 1 && g < 13)
+                        w[(g + 3) % 4] = _mm_sha256msg1_epu32(w[(g + 3) % 4], current);
+                }
+
+                state0 = _mm_add_epi32(state0, abef);
+                state1 = _mm_add_epi32(state1, cdgh);
+            }
+
+            tmp = _mm_shuffle_epi32(state0, 0x1B);
+            state1 = _mm_shuffle_epi32(state1, 0xB1);
+            state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+            state1 = _mm_alignr_epi8(state1, tmp, 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+        }
+#endif
+
+        using CompressFn = void (*)(std::uint32_t* state, const std::uint8_t* data, std::size_t blocks) noexcept;
+
+        struct Backend
+        {
+            CompressFn compress;
+            std::string_view name;
+        };
+
+        const Backend backend = []
+        {
+#if defined(OCU_SHA256_X86)
+            if (cpu_has_sha())
+                return Backend{compress_sha_ni, "sha-ni"};
+#endif
+            return Backend{compress_portable, "portable"};
+        }();
+    }
+
+    Hasher::Hasher() noexcept
+        : state_(initial_state)
+    {
+    }
+
+    void Hasher::update(std::span<const std::uint8_t> data) noexcept
+    {
+        std::size_t used = static_cast<std::size_t>(length_ % block_size);
+        length_ += data.size();
+
+        if (used > 0)
+        {
+            std::size_t take = std::min(block_size - used, data.size());
+            std::memcpy(buffer_.data() + used, data.data(), take);
+            data = data.subspan(take);
+            if (used + take < block_size)
+                return;
+            backend.compress(state_.data(), buffer_.data(), 1);
+        }
+
+        std::size_t blocks = data.size() / block_size;
+        if (blocks > 0)
+            backend.compress(state_.data(), data.data(), blocks);
+
+        std::size_t rest = data.size() % block_size;
+        std::memcpy(buffer_.data(), data.data() + blocks * block_size, rest);
+    }
+
+    void Hasher::update(std::string_view text) noexcept
+    {
+        update(std::span(reinterpret_cast<const std::uint8_t*>(text.data()), text.size()));
+    }
+
+    Digest Hasher::finish() noexcept
+    {
+        std::uint64_t bits = length_ * 8;
+        std::size_t used = static_cast<std::size_t>(length_ % block_size);
+
+        // 0x80, zeros up to 56 mod 64, then the bit length big-endian.
+        std::uint8_t tail[2 * block_size] = {0x80};
+        std::size_t pad = (used < 56 ? 56 : 120) - used;
+        for (int i = 0; i < 8; ++i)
+            tail[pad + i] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+        update(std::span<const std::uint8_t>(tail, pad + 8));
+
+        Digest digest;
+        for (std::size_t i = 0; i < state_.size(); ++i)
+        {
+            digest[4 * i] = static_cast<std::uint8_t>(state_[i] >> 24);
+            digest[4 * i + 1] = static_cast<std::uint8_t>(state_[i] >> 16);
+            digest[4 * i + 2] = static_cast<std::uint8_t>(state_[i] >> 8);
+            digest[4 * i + 3] = static_cast<std::uint8_t>(state_[i]);
+        }
+        return digest;
+    }
+
+    Digest hash(std::string_view text) noexcept
+    {
+        Hasher hasher;
+        hasher.update(text);
+        return hasher.finish();
+    }
+
+    Hmac::Hmac(std::span<const std::uint8_t> key) noexcept
+    {
+        std::array<std::uint8_t, block_size> pad{};
+        if (key.size() > block_size)
+        {
+            Hasher key_hash;
+            key_hash.update(key);
+            Digest digest = key_hash.finish();
+            std::memcpy(pad.data(), digest.data(), digest.size());
+        }
+        else
+        {
+            std::memcpy(pad.data(), key.data(), key.size());
+        }
+
+        for (auto& byte : pad)
+            byte ^= 0x36;
+        inner_.update(pad);
+
+        for (auto& byte : pad)
+            byte ^= 0x36 ^ 0x5c;
+        outer_.update(pad);
+    }
+
+    Digest Hmac::sign(std::string_view message) const noexcept
+    {
+        Hasher inner = inner_;
+        inner.update(message);
+        Digest inner_digest = inner.finish();
+
+        Hasher outer = outer_;
+        outer.update(inner_digest);
+        return outer.finish();
+    }
+
+    bool Hmac::verify(std::string_view message, const Digest& expected) const noexcept
+    {
+        return equal(sign(message), expected);
+    }
+
+    bool equal(const Digest& a, const Digest& b) noexcept
+    {
+        std::uint8_t diff = 0;
+        for (std::size_t i = 0; i < a.size(); ++i)
+            diff |= a[i] ^ b[i];
+        return diff == 0;
+    }
+
+    std::string_view implementation() noexcept
+    {
+        return backend.name;
+    }
+}
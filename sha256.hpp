@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// SHA-256 and HMAC-SHA256.
+//
+// On x86 the block function uses the SHA extensions when CPUID reports
+// them, checked once at startup. The portable version is used everywhere
+// else, including ARMv7, which has no SHA instructions.
+namespace Sha256
+{
+    using Digest = std::array<std::uint8_t, 32>;
+
+    inline constexpr std::size_t block_size = 64;
+
+    class Hasher
+    {
+    public:
+        Hasher() noexcept;
+
+        void update(std::span<const std::uint8_t> data) noexcept;
+        void update(std::string_view text) noexcept;
+        [[nodiscard]] Digest finish() noexcept;
+
+    private:
+        std::array<std::uint32_t, 8> state_;
+        std::array<std::uint8_t, block_size> buffer_{};
+        std::uint64_t length_ = 0;
+    };
+
+    [[nodiscard]] Digest hash(std::string_view text) noexcept;
+
+    // Keeps the key's inner and outer pad states, so each message costs
+    // only its own blocks plus one for the outer hash.
+    class Hmac
+    {
+    public:
+        explicit Hmac(std::span<const std::uint8_t> key) noexcept;
+
+        [[nodiscard]] Digest sign(std::string_view message) const noexcept;
+        [[nodiscard]] bool verify(std::string_view message, const Digest& expected) const noexcept;
+
+    private:
+        Hasher inner_;
+        Hasher outer_;
+    };
+
+    // Constant time, so a forged MAC learns nothing from the reply latency.
+    [[nodiscard]] bool equal(const Digest& a, const Digest& b) noexcept;
+
+    // "sha-ni" or "portable".
+    [[nodiscard]] std::string_view implementation() noexcept;
+}
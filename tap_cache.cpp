@@ -0,0 +1,128 @@
+#include "tap_cache.hpp"
+#include "config.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace Taps
+{
+    namespace
+    {
+        std::uint64_t hash_key(Kind kind, std::string_view key) noexcept
+        {
+            std::uint64_t hash = 14695981039346656037ull ^ static_cast<std::uint8_t>(kind);
+            for (char c : key)
+            {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ull;
+            }
+            // The set comes from the low bits, which FNV-1a mixes poorly.
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdull;
+            hash ^= hash >> 33;
+            return hash;
+        }
+    }
+
+    TapCache::TapCache(std::size_t capacity, Clock::duration window)
+        : window_(window)
+    {
+        std::size_t sets = std::bit_ceil(std::max<std::size_t>(1, (capacity + ways - 1) / ways));
+        entries_.assign(sets * ways, Entry{});
+        set_mask_ = sets - 1;
+    }
+
+    TapCache::Entry* TapCache::lookup(Kind kind, std::string_view key, std::uint64_t hash) noexcept
+    {
+        Entry* set = &entries_[(hash & set_mask_) * ways];
+        for (std::size_t way = 0; way < ways; ++way)
+        {
+            Entry& entry = set[way];
+            if (entry.expires && entry.hash == hash && entry.kind == kind && entry.key_size == key.size()
+                && std::memcmp(entry.key.data(), key.data(), key.size()) == 0)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    std::optional<std::int32_t> TapCache::find(Kind kind, std::string_view key, Clock::time_point now)
+    {
+        if (window_ <= Clock::duration::zero() || key.size() > max_key_size)
+            return std::nullopt;
+
+        std::uint64_t hash = hash_key(kind, key);
+        std::lock_guard lock(mutex_);
+        Entry* entry = lookup(kind, key, hash);
+        if (!entry || entry->expires <= now.time_since_epoch().count())
+            return std::nullopt;
+        return entry->value;
+    }
+
+    void TapCache::remember(Kind kind, std::string_view key, std::int32_t value,
+                            Clock::time_point now, Clock::duration lifetime)
+    {
+        if (window_ <= Clock::duration::zero() || key.size() > max_key_size || lifetime <= Clock::duration::zero())
+            return;
+
+        std::uint64_t hash = hash_key(kind, key);
+        Clock::rep expires = (now + std::min(window_, lifetime)).time_since_epoch().count();
+
+        std::lock_guard lock(mutex_);
+        Entry* entry = lookup(kind, key, hash);
+        if (!entry)
+        {
+            // Empty and expired entries have the smallest expiry, so they
+            // are taken before any live one is evicted.
+            Entry* set = &entries_[(hash & set_mask_) * ways];
+            entry = std::min_element(set, set + ways, [](const Entry& a, const Entry& b)
+            {
+                return a.expires < b.expires;
+            });
+        }
+
+        entry->hash = hash;
+        entry->expires = expires;
+        entry->value = value;
+        entry->kind = kind;
+        entry->key_size = static_cast<std::uint8_t>(key.size());
+        std::memcpy(entry->key.data(), key.data(), key.size());
+    }
+
+    void TapCache::forget(Kind kind, std::string_view key)
+    {
+        if (key.size() > max_key_size)
+            return;
+
+        std::uint64_t hash = hash_key(kind, key);
+        std::lock_guard lock(mutex_);
+        if (Entry* entry = lookup(kind, key, hash))
+            entry->expires = 0;
+    }
+
+    std::size_t TapCache::live(Clock::time_point now) const
+    {
+        Clock::rep at = now.time_since_epoch().count();
+        std::lock_guard lock(mutex_);
+        return static_cast<std::size_t>(std::count_if(entries_.begin(), entries_.end(),
+            [at](const Entry& entry) { return entry.expires > at; }));
+    }
+
+    TapCache& tap_cache()
+    {
+        static TapCache cache(config::TAP_CACHE_CAPACITY, config::TAP_REPEAT_WINDOW);
+        static const bool metrics_registered = []
+        {
+            Metrics::registry().gauge_callback(
+                "ocu_tap_cache_entries", "Accepted taps still inside the repeat window",
+                [] { return static_cast<double>(cache.live()); });
+            Metrics::registry().gauge_callback(
+                "ocu_tap_cache_bytes", "Memory used by the repeat tap cache",
+                [] { return static_cast<double>(cache.memory_bytes()); });
+            return true;
+        }();
+        (void)metrics_registered;
+        return cache;
+    }
+}
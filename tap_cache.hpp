@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Taps
+{
+    enum class Kind : std::uint8_t
+    {
+        Card,
+        Token,
+    };
+
+    // Recently accepted card taps and QR scans, so a passenger tapping twice
+    // gets the first answer again without another lookup or validation row.
+    //
+    // A fixed number of 64-byte entries in sets of four, allocated once:
+    // memory never grows. Each entry carries its own expiry and is simply
+    // overwritten once expired, so there is nothing to sweep. When a set
+    // is full, the entry closest to expiring makes room. Keys are compared
+    // in full; ones longer than max_key_size are never cached.
+    class TapCache
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr std::size_t max_key_size = 42;
+
+        // Room for at least `capacity` taps; a zero window disables caching.
+        TapCache(std::size_t capacity, Clock::duration window);
+
+        // The value remembered for an accepted tap still inside its window.
+        [[nodiscard]] std::optional<std::int32_t> find(Kind kind, std::string_view key,
+                                                       Clock::time_point now = Clock::now());
+
+        // Remembers an accepted tap for the window, or for `lifetime` if
+        // that is shorter (a ticket that expires first).
+        void remember(Kind kind, std::string_view key, std::int32_t value,
+                      Clock::time_point now = Clock::now(),
+                      Clock::duration lifetime = Clock::duration::max());
+
+        void forget(Kind kind, std::string_view key);
+
+        [[nodiscard]] std::size_t capacity() const noexcept { return entries_.size(); }
+        [[nodiscard]] std::size_t memory_bytes() const noexcept { return entries_.size() * sizeof(Entry); }
+        [[nodiscard]] std::size_t live(Clock::time_point now = Clock::now()) const;
+        [[nodiscard]] Clock::duration window() const noexcept { return window_; }
+
+    private:
+        static constexpr std::size_t ways = 4;
+
+        struct alignas(64) Entry
+        {
+            std::uint64_t hash;
+            Clock::rep expires;  // 0 when empty
+            std::int32_t value;
+            Kind kind;
+            std::uint8_t key_size;
+            std::array<char, max_key_size> key;
+        };
+        static_assert(sizeof(Entry) == 64);
+
+        Clock::duration window_;
+        std::size_t set_mask_ = 0;
+        std::vector<Entry> entries_;
+        mutable std::mutex mutex_;
+
+        [[nodiscard]] Entry* lookup(Kind kind, std::string_view key, std::uint64_t hash) noexcept;
+    };
+
+    // Sized and timed from config; every validator session shares it.
+    [[nodiscard]] TapCache& tap_cache();
+}
@@ -1,26 +1,38 @@
 #include "ticket_manager.hpp"
-#include <iostream>
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+#include "probes.hpp"
+#include "datetime.hpp"
+#include "token_filter.hpp"
 #include <sstream>
 #include <iomanip>
 #include <ctime>
 
 namespace Tickets 
 {
+    namespace
+    {
+        auto& stream_reconnects = Metrics::registry().counter(
+            "ocu_ticket_stream_reconnects_total", "Ticket stream (re)connection attempts after the first");
+        auto& stream_connected = Metrics::registry().gauge(
+            "ocu_ticket_stream_connected", "1 while the ticket stream is established");
+        auto& stream_lag = Metrics::registry().gauge(
+            "ocu_ticket_stream_lag_seconds", "Delay between ticket creation and its receipt on the stream");
+        auto& ingested_tickets = Metrics::registry().counter(
+            "ocu_ingest_rows_total", "Rows stored by ingest, by source", "source=\"tickets\"");
+        auto& ticket_insert_duration = Metrics::registry().histogram(
+            "ocu_ingest_duration_seconds", "Duration of ingest batches, by source", "source=\"tickets\"");
+    }
+
     TicketManager::TicketManager(Database& db, const std::string& grpc_server_address)
         : db_(db)
         , server_address_(grpc_server_address)
         , running_(false)
     {
-        std::cout << "=== Ticket Manager (gRPC Client) ===\n";
-        std::cout << "Server: " << server_address_ << "\n";
-        std::cout << "=====================================\n\n";
-        
-        // Enable WAL checkpoint on every transaction for immediate persistence
-        char* err_msg = nullptr;
-        if (sqlite3_exec(db_.get(), "PRAGMA synchronous = NORMAL;", nullptr, nullptr, &err_msg) != SQLITE_OK) {
-            std::cerr << "[TicketManager] Warning: Could not set synchronous mode: " << err_msg << '\n';
-            sqlite3_free(err_msg);
-        }
+        LOG_INFO("=== Ticket Manager (gRPC Client) ===");
+        LOG_INFO("Server: {}", server_address_);
+        LOG_INFO("=====================================");
     }
 
     TicketManager::~TicketManager()
@@ -35,7 +47,7 @@ namespace Tickets
         }
         
         streaming_thread_ = std::thread(&TicketManager::StreamingThread, this);
-        std::cout << "[TicketManager] Started streaming thread\n";
+        LOG_INFO("[TicketManager] Started streaming thread");
     }
 
     void TicketManager::Stop()
@@ -44,12 +56,12 @@ namespace Tickets
             return;
         }
         
-        std::cout << "[TicketManager] Stopping...\n";
+        LOG_INFO("[TicketManager] Stopping...");
         
         {
             std::lock_guard<std::mutex> lock(context_mutex_);
             if (current_context_) {
-                std::cout << "[TicketManager] Cancelling gRPC stream...\n";
+                LOG_INFO("[TicketManager] Cancelling gRPC stream...");
                 current_context_->TryCancel();
             }
         }
@@ -58,14 +70,21 @@ namespace Tickets
             streaming_thread_.join();
         }
         
-        std::cout << "[TicketManager] Stopped\n";
+        LOG_INFO("[TicketManager] Stopped");
     }
 
     void TicketManager::StreamingThread()
     {
+        Tracing::name_thread("tickets");
+        bool first_attempt = true;
         while (running_) {
+            if (!first_attempt) {
+                stream_reconnects.inc();
+            }
+            first_attempt = false;
+
             try {
-                std::cout << "[TicketManager] Connecting to gRPC server at " << server_address_ << "...\n";
+                LOG_INFO("[TicketManager] Connecting to gRPC server at {}...", server_address_);
                 
                 
                 channel_ = grpc::CreateChannel(
@@ -75,7 +94,7 @@ namespace Tickets
                 
                 auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(5);
                 if (!channel_->WaitForConnected(deadline)) {
-                    std::cerr << "[TicketManager] Failed to connect to server. Retrying in 5 seconds...\n";
+                    LOG_ERROR("[TicketManager] Failed to connect to server. Retrying in 5 seconds...");
                     std::this_thread::sleep_for(std::chrono::seconds(5));
                     continue;
                 }
@@ -84,7 +103,8 @@ namespace Tickets
                 
                 vehicle::SubscribeForNewTicketsRequest request;
                 
-                std::cout << "[TicketManager] Connected. Waiting for new tickets...\n";
+                LOG_INFO("[TicketManager] Connected. Waiting for new tickets...");
+                stream_connected.set(1);
                 
                 grpc::ClientContext context;
                 {
@@ -100,21 +120,38 @@ namespace Tickets
                 vehicle::SubscribeForNewTicketsResponse response;
                 while (running_ && reader->Read(&response)) {
                     if (response.has_new_ticket_created()) {
-                        std::cout << "[TicketManager] New ticket received\n";
+                        LOG_INFO("[TicketManager] New ticket received");
+
+                        const auto& proto_ticket = response.new_ticket_created();
+                        std::int64_t lag_s = -1;
+                        if (proto_ticket.has_date_created()) {
+                            auto now = std::chrono::system_clock::now().time_since_epoch();
+                            auto created = std::chrono::seconds(proto_ticket.date_created().seconds());
+                            stream_lag.set(std::chrono::duration<double>(now - created).count());
+                            lag_s = std::chrono::duration_cast<std::chrono::seconds>(now - created).count();
+                        }
+                        OCU_PROBE(ticket__received, proto_ticket.id(), lag_s);
                         
                         // Convert and insert ticket
-                        Ticket ticket = ConvertFromProto(response.new_ticket_created());
+                        Ticket ticket = ConvertFromProto(proto_ticket);
                         
-                        if (InsertTicket(ticket)) {
-                            std::cout << "[TicketManager] Successfully stored ticket ID: " 
-                                     << ticket.ticket_id << "\n";
+                        bool stored;
+                        {
+                            Metrics::ScopedTimer timer(ticket_insert_duration);
+                            stored = InsertTicket(ticket);
+                        }
+
+                        if (stored) {
+                            ingested_tickets.inc();
+                            LOG_INFO("[TicketManager] Successfully stored ticket ID: {}", ticket.ticket_id);
                         } else {
-                            std::cerr << "[TicketManager] Failed to store ticket ID: " 
-                                     << ticket.ticket_id << "\n";
+                            LOG_ERROR("[TicketManager] Failed to store ticket ID: {}", ticket.ticket_id);
                         }
                     }
                 }
                 
+                stream_connected.set(0);
+
                 // Clear context pointer
                 {
                     std::lock_guard<std::mutex> lock(context_mutex_);
@@ -124,21 +161,21 @@ namespace Tickets
                 // Check status
                 grpc::Status status = reader->Finish();
                 if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
-                    std::cerr << "[TicketManager] Stream ended: " << status.error_code() 
-                            << " - " << status.error_message() << "\n";
+                    LOG_ERROR("[TicketManager] Stream ended: {} - {}", status.error_code(), status.error_message());
                     
                     if (running_) {
-                        std::cout << "[TicketManager] Reconnecting in 5 seconds...\n";
+                        LOG_INFO("[TicketManager] Reconnecting in 5 seconds...");
                         std::this_thread::sleep_for(std::chrono::seconds(5));
                     }
                 } else if (status.error_code() == grpc::StatusCode::CANCELLED) {
-                    std::cout << "[TicketManager] Stream cancelled (shutdown requested)\n";
+                    LOG_INFO("[TicketManager] Stream cancelled (shutdown requested)");
                 }
                 
             } catch (const std::exception& e) {
-                std::cerr << "[TicketManager] Error: " << e.what() << "\n";
+                stream_connected.set(0);
+                LOG_ERROR("[TicketManager] Error: {}", e.what());
                 if (running_) {
-                    std::cout << "[TicketManager] Retrying in 5 seconds...\n";
+                    LOG_INFO("[TicketManager] Retrying in 5 seconds...");
                     std::this_thread::sleep_for(std::chrono::seconds(5));
                 }
             }
@@ -164,10 +201,12 @@ namespace Tickets
         
         if (proto_ticket.has_valid_from()) {
             ticket.valid_from = TimestampToString(proto_ticket.valid_from());
+            ticket.valid_from_epoch = proto_ticket.valid_from().seconds();
         }
         
         if (proto_ticket.has_valid_to()) {
             ticket.valid_to = TimestampToString(proto_ticket.valid_to());
+            ticket.valid_to_epoch = proto_ticket.valid_to().seconds();
         }
         
         if (proto_ticket.has_traffic_zone()) {
@@ -192,26 +231,77 @@ namespace Tickets
 
     bool TicketManager::InsertTicket(const Ticket& ticket)
     {
-        char* err_msg = nullptr;
-        if (sqlite3_exec(db_.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, &err_msg) != SQLITE_OK) {
-            std::cerr << "[TicketManager] Failed to begin transaction: " << err_msg << '\n';
-            sqlite3_free(err_msg);
+        Tracing::Trace trace("ticket_insert");
+
+        Database::Transaction transaction(db_);
+        if (!transaction) {
+            LOG_ERROR("[TicketManager] Failed to begin transaction: {}", sqlite3_errmsg(db_.get()));
             return false;
         }
 
+        // A token already stored (a re-send, or a ticket accepted offline)
+        // is in the token filter unless it has been swept.
+        bool token_in_filter = false;
+        if (!ticket.token.empty()) {
+            auto stored = db_.prepare("SELECT valid_to_epoch FROM tickets WHERE token = ?;");
+            if (!stored) {
+                LOG_ERROR("[TicketManager] Failed to prepare statement: {}", sqlite3_errmsg(db_.get()));
+                return false;
+            }
+            sqlite3_bind_text(stored.get(), 1, ticket.token.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stored.get()) == SQLITE_ROW) {
+                std::optional<std::int64_t> valid_to;
+                if (sqlite3_column_type(stored.get(), 0) != SQLITE_NULL) {
+                    valid_to = sqlite3_column_int64(stored.get(), 0);
+                }
+                token_in_filter = token_filter().holds_stored(valid_to);
+            }
+        }
+
+        // A row a signed QR code created offline, before the ticket was
+        // streamed, becomes this ticket's row, so a token has one row.
+        if (!ticket.token.empty()) {
+            auto adopt = db_.prepare(
+                "UPDATE tickets SET ticket_id = ?1 WHERE ticket_id IS NULL AND token = ?2 "
+                "AND NOT EXISTS (SELECT 1 FROM tickets WHERE ticket_id = ?1);");
+            if (!adopt) {
+                LOG_ERROR("[TicketManager] Failed to prepare statement: {}", sqlite3_errmsg(db_.get()));
+                return false;
+            }
+            sqlite3_bind_int64(adopt.get(), 1, ticket.ticket_id);
+            sqlite3_bind_text(adopt.get(), 2, ticket.token.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(adopt.get()) != SQLITE_DONE) {
+                LOG_ERROR("[TicketManager] Failed to adopt offline ticket: {}", sqlite3_errmsg(db_.get()));
+                return false;
+            }
+        }
+
+        // A ticket sent again updates its row; a validity window set here
+        // when the ticket was first scanned is kept if the server has none.
         const char* sql = 
-            "INSERT OR REPLACE INTO tickets (ticket_id, active, date_created, account_id, "
+            "INSERT INTO tickets (ticket_id, active, date_created, account_id, "
             "caption, valid_from, valid_to, traffic_area, traffic_zone, "
-            "article_id, invoice_item_id, token) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-
-        sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(db_.get(), sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cerr << "[TicketManager] Failed to prepare statement: " 
-                     << sqlite3_errmsg(db_.get()) << '\n';
-            sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+            "article_id, invoice_item_id, token, valid_from_epoch, valid_to_epoch) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?) "
+            "ON CONFLICT(ticket_id) DO UPDATE SET "
+            "active = excluded.active, date_created = excluded.date_created, "
+            "account_id = excluded.account_id, caption = excluded.caption, "
+            "valid_from = coalesce(excluded.valid_from, valid_from), "
+            "valid_to = coalesce(excluded.valid_to, valid_to), "
+            "traffic_area = excluded.traffic_area, traffic_zone = excluded.traffic_zone, "
+            "article_id = excluded.article_id, invoice_item_id = excluded.invoice_item_id, "
+            "token = excluded.token, "
+            "valid_from_epoch = coalesce(excluded.valid_from_epoch, valid_from_epoch), "
+            "valid_to_epoch = coalesce(excluded.valid_to_epoch, valid_to_epoch);";
+
+        Tracing::Span prepare_span("prepare");
+        auto statement = db_.prepare(sql);
+        sqlite3_stmt* stmt = statement.get();
+        if (!stmt) {
+            LOG_ERROR("[TicketManager] Failed to prepare statement: {}", sqlite3_errmsg(db_.get()));
             return false;
         }
+        prepare_span.end();
 
         // Bind parameters
         sqlite3_bind_int64(stmt, 1, ticket.ticket_id);
@@ -260,39 +350,42 @@ namespace Tickets
 
         sqlite3_bind_text(stmt, 12, ticket.token.c_str(), -1, SQLITE_TRANSIENT);
 
+        if (ticket.valid_from_epoch) {
+            sqlite3_bind_int64(stmt, 13, *ticket.valid_from_epoch);
+        } else {
+            sqlite3_bind_null(stmt, 13);
+        }
+
+        if (ticket.valid_to_epoch) {
+            sqlite3_bind_int64(stmt, 14, *ticket.valid_to_epoch);
+        } else {
+            sqlite3_bind_null(stmt, 14);
+        }
+
+        Tracing::Span step_span("step");
         bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+        step_span.end();
 
-        sqlite3_finalize(stmt);
+        statement.reset();
 
         if (!success) {
-            std::cerr << "[TicketManager] Failed to insert ticket: " 
-                     << sqlite3_errmsg(db_.get()) << '\n';
-            sqlite3_exec(db_.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+            LOG_ERROR("[TicketManager] Failed to insert ticket: {}", sqlite3_errmsg(db_.get()));
             return false;
         }
 
-        if (sqlite3_exec(db_.get(), "COMMIT;", nullptr, nullptr, &err_msg) != SQLITE_OK) {
-            std::cerr << "[TicketManager] Failed to commit transaction: " << err_msg << '\n';
-            sqlite3_free(err_msg);
+        Tracing::Span commit_span("commit");
+        OCU_PROBE(commit__start);
+        int commit_rc = transaction.commit();
+        OCU_PROBE(commit__done, commit_rc);
+        if (commit_rc != SQLITE_OK) {
+            LOG_ERROR("[TicketManager] Failed to commit transaction: {}", sqlite3_errstr(commit_rc));
             return false;
         }
+        commit_span.end();
 
-
-        int log_size, checkpointed;
-        int rc = sqlite3_wal_checkpoint_v2(
-            db_.get(),
-            nullptr,  // All databases
-            SQLITE_CHECKPOINT_FULL,  
-            &log_size,
-            &checkpointed
-        );
-
-        if (rc != SQLITE_OK) {
-            std::cerr << "[TicketManager] Warning: WAL checkpoint failed: " 
-                     << sqlite3_errmsg(db_.get()) << '\n';
-        } else {
-            std::cout << "[TicketManager] WAL checkpoint: " << checkpointed 
-                     << "/" << log_size << " frames checkpointed\n";
+        // A ticket without a token is not in the filter, as in rebuild().
+        if (!ticket.token.empty() && !token_in_filter) {
+            token_filter().add(ticket.token, ticket.valid_to_epoch);
         }
 
         return true;
@@ -301,10 +394,6 @@ namespace Tickets
 
     std::string TicketManager::TimestampToString(const google::protobuf::Timestamp& ts)
     {
-        time_t seconds = ts.seconds();
-        struct tm* tm_info = localtime(&seconds);
-        char buffer[26];
-        strftime(buffer, 26, "%Y-%m-%dT%H:%M:%S", tm_info);
-        return std::string(buffer);
+        return DateTime::format_local(ts.seconds());
     }
 }
\ No newline at end of file
@@ -26,6 +26,8 @@ namespace Tickets
         std::optional<int> article_id;
         std::optional<int> invoice_item_id;
         std::string token;
+        std::optional<int64_t> valid_from_epoch;
+        std::optional<int64_t> valid_to_epoch;
     };
 
     class TicketManager 
@@ -0,0 +1,200 @@
+#include "token_filter.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "include/sqlite3.h"
+
+#include <algorithm>
+#include <ctime>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+namespace Tickets
+{
+    namespace
+    {
+        auto& filtered_tokens = Metrics::registry().counter(
+            "ocu_token_filter_rejections_total", "QR tokens the filter reported unknown, answered without SQLite");
+        auto& false_positives = Metrics::registry().counter(
+            "ocu_token_filter_false_positives_total", "QR tokens the filter passed that were not in the database");
+
+        std::uint64_t hash_token(std::string_view token) noexcept
+        {
+            std::uint64_t hash = 14695981039346656037ull;
+            for (char c : token)
+            {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ull;
+            }
+            // FNV-1a mixes the high bits poorly; the fingerprint comes from them.
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdull;
+            hash ^= hash >> 33;
+            return hash;
+        }
+
+        bool query_hashes(sqlite3* db, const char* sql, std::initializer_list<std::int64_t> params,
+                          std::vector<std::uint64_t>& hashes)
+        {
+            sqlite3_stmt* stmt;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                LOG_ERROR("[TokenFilter] Failed to prepare query: {}", sqlite3_errmsg(db));
+                return false;
+            }
+
+            int index = 1;
+            for (auto param : params)
+                sqlite3_bind_int64(stmt, index++, param);
+
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                auto text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+                hashes.push_back(hash_token(std::string_view(text, static_cast<std::size_t>(sqlite3_column_bytes(stmt, 0)))));
+            }
+            sqlite3_finalize(stmt);
+
+            if (rc != SQLITE_DONE)
+            {
+                LOG_ERROR("[TokenFilter] Query failed: {}", sqlite3_errmsg(db));
+                return false;
+            }
+            return true;
+        }
+    }
+
+    bool TokenFilter::rebuild(sqlite3* db)
+    {
+        std::int64_t cutoff = std::time(nullptr);
+        std::vector<std::uint64_t> hashes;
+        {
+            std::unique_lock lock(mutex_);
+            rebuilding_ = true;
+            pending_.clear();
+        }
+
+        bool ok = query_hashes(db,
+            "SELECT token FROM tickets WHERE token IS NOT NULL AND token != '' "
+            "AND (valid_to_epoch IS NULL OR valid_to_epoch > ?);", {cutoff}, hashes);
+
+        CuckooFilter filter(std::max<std::size_t>(1024, 2 * hashes.size()));
+        bool full = false;
+        for (auto hash : hashes)
+            full = !filter.insert(hash) || full;
+
+        std::unique_lock lock(mutex_);
+        rebuilding_ = false;
+        if (!ok)
+            return false;
+
+        // Tickets stored while the query ran.
+        for (auto hash : pending_)
+            full = !filter.insert(hash) || full;
+        pending_.clear();
+
+        filter_ = std::move(filter);
+        swept_until_ = cutoff;
+        loaded_ = true;
+        full_ = full;
+
+        LOG_INFO("[TokenFilter] Loaded {} tokens, {} KiB, expected false positives {}%",
+                 filter_.size(), filter_.memory_bytes() / 1024, filter_.false_positive_rate() * 100.0);
+        return true;
+    }
+
+    int TokenFilter::sweep(sqlite3* db)
+    {
+        std::int64_t swept_until;
+        {
+            std::shared_lock lock(mutex_);
+            if (!loaded_)
+                return 0;
+            swept_until = swept_until_;
+        }
+
+        std::int64_t cutoff = std::time(nullptr);
+        std::vector<std::uint64_t> hashes;
+        if (!query_hashes(db,
+                "SELECT token FROM tickets WHERE token IS NOT NULL AND token != '' "
+                "AND valid_to_epoch > ? AND valid_to_epoch <= ?;", {swept_until, cutoff}, hashes))
+            return -1;
+
+        std::unique_lock lock(mutex_);
+        for (auto hash : hashes)
+            filter_.erase(hash);
+        swept_until_ = cutoff;
+        return static_cast<int>(hashes.size());
+    }
+
+    void TokenFilter::add(std::string_view token, std::optional<std::int64_t> valid_to)
+    {
+        std::uint64_t hash = hash_token(token);
+
+        std::unique_lock lock(mutex_);
+        // Already expired: sweep() would never see it, and the ticket is
+        // not valid anyway.
+        if (valid_to && *valid_to <= swept_until_)
+            return;
+
+        if (!filter_.insert(hash))
+            full_ = true;
+        if (rebuilding_)
+            pending_.push_back(hash);
+    }
+
+    bool TokenFilter::holds_stored(std::optional<std::int64_t> valid_to) const
+    {
+        std::shared_lock lock(mutex_);
+        return !valid_to || *valid_to > swept_until_;
+    }
+
+    bool TokenFilter::may_contain(std::string_view token) const
+    {
+        std::uint64_t hash = hash_token(token);
+
+        std::shared_lock lock(mutex_);
+        if (!loaded_ || full_ || filter_.contains(hash))
+            return true;
+
+        filtered_tokens.inc();
+        return false;
+    }
+
+    void TokenFilter::note_false_positive() noexcept
+    {
+        false_positives.inc();
+    }
+
+    bool TokenFilter::needs_rebuild() const
+    {
+        std::shared_lock lock(mutex_);
+        return full_;
+    }
+
+    TokenFilter::Stats TokenFilter::stats() const
+    {
+        std::shared_lock lock(mutex_);
+        return {filter_.size(), filter_.memory_bytes(), filter_.false_positive_rate()};
+    }
+
+    TokenFilter& token_filter()
+    {
+        static TokenFilter filter;
+        static const bool metrics_registered = []
+        {
+            Metrics::registry().gauge_callback(
+                "ocu_token_filter_tokens", "Tokens in the QR token filter",
+                [] { return static_cast<double>(filter.stats().tokens); });
+            Metrics::registry().gauge_callback(
+                "ocu_token_filter_bytes", "Memory used by the QR token filter",
+                [] { return static_cast<double>(filter.stats().memory_bytes); });
+            Metrics::registry().gauge_callback(
+                "ocu_token_filter_false_positive_rate", "Expected false-positive rate of the QR token filter at its load",
+                [] { return filter.stats().false_positive_rate; });
+            return true;
+        }();
+        (void)metrics_registered;
+        return filter;
+    }
+}
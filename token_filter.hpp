@@ -0,0 +1,73 @@
+#pragma once
+
+#include "cuckoo_filter.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+struct sqlite3;
+
+namespace Tickets
+{
+    // Cuckoo filter over the tokens of tickets that can still be valid, in
+    // front of the QR lookup: a token it does not contain is definitely
+    // unknown and is rejected without touching SQLite.
+    //
+    // Tokens are added when a ticket is stored (stream or offline accept)
+    // and removed by sweep() once the ticket's valid_to has passed. Until
+    // the first rebuild, and while the filter is full and awaiting a larger
+    // rebuild, every token passes through to the database.
+    class TokenFilter
+    {
+    public:
+        // Reloads from the tickets table, sized for twice the current count.
+        bool rebuild(sqlite3* db);
+
+        // Removes the tokens of tickets that expired since the last sweep;
+        // returns how many were removed, or -1 on a query error.
+        int sweep(sqlite3* db);
+
+        // Call once the ticket row is committed: rebuild() reads on its own
+        // connection and only sees committed rows, and a token added
+        // while it runs is carried into the new filter. `valid_to` in Unix
+        // seconds, empty for a ticket not activated yet.
+        void add(std::string_view token, std::optional<std::int64_t> valid_to = std::nullopt);
+
+        // Whether the token of a ticket row already stored with `valid_to`
+        // is still in the filter: not swept yet, or never to be. Such a
+        // token must not be added again; the filter keeps duplicates, and
+        // sweep() removes only one copy.
+        [[nodiscard]] bool holds_stored(std::optional<std::int64_t> valid_to) const;
+
+        [[nodiscard]] bool may_contain(std::string_view token) const;
+
+        // A token the filter passed was not in the database after all.
+        void note_false_positive() noexcept;
+
+        [[nodiscard]] bool needs_rebuild() const;
+
+        struct Stats
+        {
+            std::size_t tokens;
+            std::size_t memory_bytes;
+            double false_positive_rate;  // expected at the current load
+        };
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        mutable std::shared_mutex mutex_;
+        CuckooFilter filter_;
+        std::int64_t swept_until_ = 0;  // valid_to_epoch already swept
+        bool loaded_ = false;
+        bool full_ = false;
+        bool rebuilding_ = false;
+        std::vector<std::uint64_t> pending_;  // added while a rebuild queried
+    };
+
+    [[nodiscard]] TokenFilter& token_filter();
+}
@@ -0,0 +1,225 @@
+#include "tracing.hpp"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace Tracing
+{
+    namespace
+    {
+        // Spans kept in memory; must be a power of two. 16384 spans is about
+        // 640 KiB and holds the last few thousand sampled requests.
+        constexpr std::size_t ring_capacity = 16384;
+
+        struct Slot
+        {
+            std::atomic<std::uint64_t> version{0};  // odd while being written
+            const char* name = nullptr;
+            std::uint64_t trace = 0;
+            std::int64_t start_us = 0;
+            std::int64_t duration_us = 0;
+            std::uint32_t thread = 0;
+            bool async = false;
+        };
+
+        struct State
+        {
+            std::atomic<std::uint64_t> sample_threshold{0};
+            std::atomic<std::uint64_t> next_trace{0};
+
+            std::atomic<Slot*> slots{nullptr};
+            std::atomic<std::uint64_t> next_slot{0};
+
+            std::atomic<std::uint32_t> next_thread{0};
+
+            std::mutex mutex;  // allocation and thread names
+            std::unique_ptr<Slot[]> storage;
+            std::vector<std::pair<std::uint32_t, std::string>> thread_names;
+
+            const Clock::time_point epoch = Clock::now();
+        };
+
+        State& state()
+        {
+            static State instance;
+            return instance;
+        }
+
+        std::uint32_t thread_number()
+        {
+            thread_local std::uint32_t number = state().next_thread.fetch_add(1, std::memory_order_relaxed) + 1;
+            return number;
+        }
+
+        std::uint64_t next_random() noexcept
+        {
+            // xorshift64*; sampling only needs to be cheap and roughly uniform.
+            thread_local std::uint64_t x = 0x9E3779B97F4A7C15ull
+                ^ static_cast<std::uint64_t>(Clock::now().time_since_epoch().count())
+                ^ (static_cast<std::uint64_t>(thread_number()) << 32);
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            return x * 2685821657736338717ull;
+        }
+
+        std::int64_t micros_since_epoch(Clock::time_point t)
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(t - state().epoch).count();
+        }
+    }
+
+    void set_sample_rate(double rate)
+    {
+        rate = std::clamp(rate, 0.0, 1.0);
+
+        if (rate > 0.0)
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            if (!state().storage)
+            {
+                state().storage = std::make_unique<Slot[]>(ring_capacity);
+                state().slots.store(state().storage.get(), std::memory_order_release);
+            }
+        }
+
+        constexpr auto max = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t threshold = rate >= 1.0 ? max : static_cast<std::uint64_t>(rate * static_cast<double>(max));
+        state().sample_threshold.store(threshold, std::memory_order_relaxed);
+    }
+
+    std::uint64_t sample() noexcept
+    {
+        auto threshold = state().sample_threshold.load(std::memory_order_relaxed);
+        if (threshold == 0 || next_random() > threshold)
+            return 0;
+        return state().next_trace.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    void name_thread(const char* name)
+    {
+        auto number = thread_number();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        state().thread_names.emplace_back(number, name);
+    }
+
+    void record(std::uint64_t trace_id, const char* name, Clock::time_point start,
+                Clock::time_point end, bool async) noexcept
+    {
+        Slot* slots = state().slots.load(std::memory_order_acquire);
+        if (!trace_id || !slots)
+            return;
+
+        auto sequence = state().next_slot.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots[sequence & (ring_capacity - 1)];
+
+        slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.name = name;
+        slot.trace = trace_id;
+        slot.start_us = micros_since_epoch(start);
+        slot.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        slot.thread = thread_number();
+        slot.async = async;
+
+        slot.version.store(2 * sequence + 2, std::memory_order_release);
+    }
+
+    std::string chrome_json()
+    {
+        struct Event
+        {
+            const char* name;
+            std::uint64_t trace;
+            std::int64_t start_us;
+            std::int64_t duration_us;
+            std::uint32_t thread;
+            bool async;
+        };
+
+        std::vector<Event> events;
+        Slot* slots = state().slots.load(std::memory_order_acquire);
+
+        if (slots)
+        {
+            events.reserve(ring_capacity);
+            for (std::size_t i = 0; i < ring_capacity; ++i)
+            {
+                const Slot& slot = slots[i];
+                auto before = slot.version.load(std::memory_order_acquire);
+                if (before == 0 || (before & 1))
+                    continue;
+
+                Event event{slot.name, slot.trace, slot.start_us, slot.duration_us, slot.thread, slot.async};
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.version.load(std::memory_order_relaxed) == before)
+                    events.push_back(event);
+            }
+        }
+
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b)
+        {
+            return a.start_us < b.start_us;
+        });
+
+        json trace_events = json::array();
+
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            for (const auto& [number, name] : state().thread_names)
+            {
+                trace_events.push_back({
+                    {"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", number},
+                    {"args", {{"name", name}}},
+                });
+            }
+        }
+
+        for (const Event& event : events)
+        {
+            if (event.async)
+            {
+                json begin = {
+                    {"name", event.name}, {"cat", "request"}, {"ph", "b"}, {"id", event.trace},
+                    {"ts", event.start_us}, {"pid", 1}, {"tid", event.thread},
+                };
+                json end = begin;
+                end["ph"] = "e";
+                end["ts"] = event.start_us + event.duration_us;
+
+                trace_events.push_back(std::move(begin));
+                trace_events.push_back(std::move(end));
+            }
+            else
+            {
+                trace_events.push_back({
+                    {"name", event.name}, {"cat", "ocu"}, {"ph", "X"},
+                    {"ts", event.start_us}, {"dur", event.duration_us}, {"pid", 1}, {"tid", event.thread},
+                    {"args", {{"trace", event.trace}}},
+                });
+            }
+        }
+
+        return json{{"traceEvents", std::move(trace_events)}, {"displayTimeUnit", "ms"}}.dump();
+    }
+
+    bool write_chrome_json(const std::string& path)
+    {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file)
+            return false;
+        file << chrome_json();
+        return static_cast<bool>(file);
+    }
+}
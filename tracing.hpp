@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Sampled span tracing, exported in Chrome trace-event format.
+//
+// A trace is started per validator request (Session) or per ingest batch
+// (Tracing::Trace). While a sampled trace is current on a thread, every
+// Tracing::Span on that thread is recorded into a fixed-size in-memory ring;
+// with sampling off (the default) a Span is a single thread_local test.
+//
+// The ring is served as JSON at /trace on the metrics endpoint and written to
+// --trace-file on shutdown; both load in chrome://tracing and Perfetto.
+namespace Tracing
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Fraction of traces recorded: 0 disables tracing, 1 records everything.
+    // The span ring is allocated on the first non-zero rate.
+    void set_sample_rate(double rate);
+
+    // Returns a new trace id, or 0 if this trace is not sampled.
+    [[nodiscard]] std::uint64_t sample() noexcept;
+
+    // Names the calling thread in exported traces.
+    void name_thread(const char* name);
+
+    // Records a finished span of `trace_id` on the calling thread. `name` must
+    // be a string literal. Async spans (waits that may interleave with other
+    // requests on the same thread) are exported as begin/end pairs keyed by
+    // the trace id instead of as nested slices.
+    void record(std::uint64_t trace_id, const char* name, Clock::time_point start,
+                Clock::time_point end, bool async = false) noexcept;
+
+    namespace detail
+    {
+        inline thread_local std::uint64_t current_trace = 0;
+    }
+
+    [[nodiscard]] inline std::uint64_t current() noexcept { return detail::current_trace; }
+
+    // Makes `trace_id` current on this thread until destroyed.
+    class Activate
+    {
+    public:
+        explicit Activate(std::uint64_t trace_id) noexcept
+            : previous_(detail::current_trace)
+        {
+            detail::current_trace = trace_id;
+        }
+        ~Activate() { detail::current_trace = previous_; }
+
+        Activate(const Activate&) = delete;
+        Activate& operator=(const Activate&) = delete;
+
+    private:
+        std::uint64_t previous_;
+    };
+
+    // Times a block of the current trace. end() closes the span early.
+    class Span
+    {
+    public:
+        explicit Span(const char* name) noexcept
+            : name_(name)
+            , trace_(detail::current_trace)
+        {
+            if (trace_)
+                start_ = Clock::now();
+        }
+        ~Span() { end(); }
+
+        void end() noexcept
+        {
+            if (trace_)
+                record(trace_, name_, start_, Clock::now());
+            trace_ = 0;
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name_;
+        std::uint64_t trace_;
+        Clock::time_point start_{};
+    };
+
+    // Root of a trace that starts and ends on one thread (ticket insert,
+    // coupon or article ingest): samples, activates and spans the scope.
+    class Trace
+    {
+    public:
+        explicit Trace(const char* name) noexcept
+            : activate_(sample())
+            , span_(name)
+        {
+        }
+
+    private:
+        Activate activate_;
+        Span span_;
+    };
+
+    // Chrome trace-event JSON of every span still in the ring.
+    [[nodiscard]] std::string chrome_json();
+    bool write_chrome_json(const std::string& path);
+}
@@ -0,0 +1,333 @@
+#include "validation_journal.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    auto& journal_records = Metrics::registry().counter(
+        "ocu_audit_journal_records_total", "Audit records appended to the memory-mapped journal");
+    auto& journal_segments = Metrics::registry().counter(
+        "ocu_audit_journal_segments_total", "Journal segments sealed for compaction");
+    auto& journal_sync_duration = Metrics::registry().histogram(
+        "ocu_audit_journal_sync_duration_seconds", "Duration of msync calls on journal segments");
+
+    constexpr std::array<char, 8> magic{'O', 'C', 'U', 'J', 'R', 'N', 'L', '1'};
+    constexpr std::uint32_t format_version = 1;
+
+    // Occupies the first record slot of every segment.
+    struct Header
+    {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t record_size;
+        std::uint64_t sequence;
+        std::uint64_t capacity;
+        std::uint8_t sealed;
+    };
+    static_assert(sizeof(Header) <= sizeof(ValidationJournal::Record));
+
+    constexpr std::array<std::uint32_t, 256> crc_table = []
+    {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320u : 0);
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    std::uint32_t record_crc(const ValidationJournal::Record& record) noexcept
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(&record) + sizeof(record.crc);
+        std::uint32_t crc = 0xFFFFFFFFu;
+        for (std::size_t i = 0; i < sizeof(record) - sizeof(record.crc); ++i)
+            crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    std::string segment_name(std::uint64_t sequence)
+    {
+        char name[40];
+        std::snprintf(name, sizeof(name), "audit-%016llu.journal", static_cast<unsigned long long>(sequence));
+        return name;
+    }
+
+    Header* header_of(void* base) noexcept
+    {
+        return static_cast<Header*>(base);
+    }
+
+    std::size_t page_size() noexcept
+    {
+        static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+}
+
+ValidationJournal::Segment::~Segment()
+{
+    if (base_)
+        munmap(base_, bytes_);
+}
+
+std::span<const ValidationJournal::Record> ValidationJournal::Segment::records() const noexcept
+{
+    const Record* slot = slots();
+    std::size_t count = 0;
+    while (count < capacity_)
+    {
+        const Record& record = slot[count];
+        if (record.kind == Kind::None || record.kind > Kind::Purchase || record.key_size > max_key_size
+            || record.crc != record_crc(record))
+            break;
+        ++count;
+    }
+    return {slot, count};
+}
+
+bool ValidationJournal::Segment::remove()
+{
+    std::error_code ec;
+    std::filesystem::remove(path_, ec);
+    if (ec)
+    {
+        LOG_ERROR("[Journal] Cannot remove {}: {}", path_.string(), ec.message());
+        return false;
+    }
+    return true;
+}
+
+void ValidationJournal::Segment::sync(std::size_t used) noexcept
+{
+    // From the page holding the first unsynced record; slot 0 is the header.
+    std::size_t start = (synced_ + 1) * sizeof(Record);
+    start -= start % page_size();
+    std::size_t end = std::min(bytes_, (used + 1) * sizeof(Record));
+    if (end <= start)
+        return;
+
+    Metrics::ScopedTimer timer(journal_sync_duration);
+    if (msync(static_cast<char*>(base_) + start, end - start, MS_SYNC) != 0)
+    {
+        LOG_WARN("[Journal] msync of {} failed: {}", path_.string(), std::strerror(errno));
+        return;
+    }
+    synced_ = used;
+}
+
+ValidationJournal::ValidationJournal(Policy policy, std::uint64_t next_sequence)
+    : policy_(std::move(policy))
+    , next_sequence_(std::max<std::uint64_t>(next_sequence, 1))
+    , last_sync_(Clock::now())
+{
+    policy_.segment_records = std::max<std::size_t>(policy_.segment_records, 1);
+
+    std::error_code ec;
+    std::filesystem::create_directories(policy_.directory, ec);
+    if (ec)
+        throw std::runtime_error("Cannot create journal directory " + policy_.directory.string() + ": " + ec.message());
+
+    std::vector<std::filesystem::path> found;
+    for (const auto& entry : std::filesystem::directory_iterator(policy_.directory, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (entry.is_regular_file() && name.starts_with("audit-") && name.ends_with(".journal"))
+            found.push_back(entry.path());
+    }
+    if (ec)
+        throw std::runtime_error("Cannot read journal directory " + policy_.directory.string() + ": " + ec.message());
+    std::sort(found.begin(), found.end());
+
+    for (const auto& path : found)
+    {
+        auto segment = open(path);
+        if (!segment)
+            continue;
+
+        std::size_t records = segment->records().size();
+        segment->used_ = segment->synced_ = records;
+        if (!header_of(segment->base_)->sealed)
+            LOG_WARN("[Journal] Replaying {} records from unsealed segment {}", records, path.filename().string());
+        next_sequence_ = std::max(next_sequence_, segment->sequence_ + 1);
+        sealed_.push_back(std::move(segment));
+    }
+    LOG_INFO("[Journal] {} records per segment in {}: {} segments to compact, next is {}",
+             policy_.segment_records, policy_.directory.string(), sealed_.size(), next_sequence_);
+}
+
+std::shared_ptr<ValidationJournal::Segment> ValidationJournal::create(std::uint64_t sequence) const
+{
+    auto path = policy_.directory / segment_name(sequence);
+    std::size_t bytes = (policy_.segment_records + 1) * sizeof(Record);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR("[Journal] Cannot create {}: {}", path.string(), std::strerror(errno));
+        return nullptr;
+    }
+
+    // Reserve the blocks now: a full disk then fails here, not with
+    // SIGBUS on a store into the mapping.
+    int rc = posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+    void* base = rc == 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (base == MAP_FAILED)
+    {
+        LOG_ERROR("[Journal] Cannot map {}: {}", path.string(), std::strerror(rc ? rc : errno));
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return nullptr;
+    }
+
+    std::shared_ptr<Segment> segment(new Segment);
+    segment->path_ = std::move(path);
+    segment->sequence_ = sequence;
+    segment->base_ = base;
+    segment->bytes_ = bytes;
+    segment->capacity_ = policy_.segment_records;
+
+    Header* header = header_of(base);
+    header->magic = magic;
+    header->version = format_version;
+    header->record_size = sizeof(Record);
+    header->sequence = sequence;
+    header->capacity = policy_.segment_records;
+    header->sealed = 0;
+    return segment;
+}
+
+std::shared_ptr<ValidationJournal::Segment> ValidationJournal::open(const std::filesystem::path& path) const
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    off_t size = fd >= 0 ? lseek(fd, 0, SEEK_END) : -1;
+    if (size < static_cast<off_t>(sizeof(Record)))
+    {
+        LOG_WARN("[Journal] Ignoring {}: cannot read a segment header", path.string());
+        if (fd >= 0)
+            ::close(fd);
+        return nullptr;
+    }
+
+    std::size_t bytes = static_cast<std::size_t>(size);
+    void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+    {
+        LOG_WARN("[Journal] Ignoring {}: {}", path.string(), std::strerror(errno));
+        return nullptr;
+    }
+
+    std::shared_ptr<Segment> segment(new Segment);
+    segment->path_ = path;
+    segment->base_ = base;
+    segment->bytes_ = bytes;
+
+    const Header* header = header_of(base);
+    if (header->magic != magic || header->version != format_version || header->record_size != sizeof(Record))
+    {
+        LOG_WARN("[Journal] Ignoring {}: not a version {} segment", path.string(), format_version);
+        return nullptr;
+    }
+    segment->sequence_ = header->sequence;
+    segment->capacity_ = std::min<std::size_t>(header->capacity, bytes / sizeof(Record) - 1);
+    return segment;
+}
+
+bool ValidationJournal::append(Record record)
+{
+    if (record.key_size > max_key_size)
+        return false;
+    record.crc = record_crc(record);
+
+    std::lock_guard lock(mutex_);
+    if (!active_ || active_->used_ == active_->capacity_)
+    {
+        if (active_)
+            seal(std::move(active_));
+        active_ = spare_ ? std::move(spare_) : create(next_sequence_++);
+        if (!active_)
+            return false;
+    }
+
+    if (active_->used_ == 0)
+        active_->first_append_ = Clock::now();
+    std::memcpy(&active_->slots()[active_->used_], &record, sizeof(Record));
+    ++active_->used_;
+    journal_records.inc();
+    return true;
+}
+
+void ValidationJournal::seal(std::shared_ptr<Segment> segment)
+{
+    header_of(segment->base_)->sealed = 1;
+    sealed_.push_back(std::move(segment));
+    journal_segments.inc();
+}
+
+void ValidationJournal::maintain(Clock::time_point now, bool all)
+{
+    std::vector<std::pair<std::shared_ptr<Segment>, std::size_t>> unsynced;
+    std::shared_ptr<Segment> unused;
+    bool need_spare;
+    std::uint64_t spare_sequence = 0;
+    {
+        std::lock_guard lock(mutex_);
+        if (active_ && active_->used_ > 0 && (all || now - active_->first_append_ >= policy_.seal_after))
+            seal(std::move(active_));
+
+        bool sync_due = policy_.sync_interval.count() > 0 && now - last_sync_ >= policy_.sync_interval;
+        if (sync_due || all)
+        {
+            last_sync_ = now;
+            for (const auto& segment : sealed_)
+                if (segment->synced_ < segment->used_)
+                    unsynced.emplace_back(segment, segment->used_);
+            if (active_ && active_->synced_ < active_->used_)
+                unsynced.emplace_back(active_, active_->used_);
+        }
+
+        if (all)
+            unused = std::move(spare_);
+        need_spare = !all && !spare_ && now >= retry_spare_;
+        if (need_spare)
+            spare_sequence = next_sequence_++;
+    }
+
+    // Records appended meanwhile are left for the next pass.
+    for (const auto& [segment, used] : unsynced)
+        segment->sync(used);
+
+    if (unused)
+        unused->remove();
+
+    if (need_spare)
+    {
+        auto spare = create(spare_sequence);
+        std::lock_guard lock(mutex_);
+        if (!spare)
+            retry_spare_ = now + std::chrono::seconds(1);
+        spare_ = std::move(spare);
+    }
+}
+
+std::vector<std::shared_ptr<ValidationJournal::Segment>> ValidationJournal::take_sealed()
+{
+    std::lock_guard lock(mutex_);
+    return std::exchange(sealed_, {});
+}
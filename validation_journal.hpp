@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Append-only journal of fixed-size audit records in memory-mapped
+// segment files, so recording a tap costs one copy into the page cache.
+//
+// A segment is preallocated for `segment_records` records and starts
+// with a header slot. Each record carries a CRC-32 of its contents; the
+// first empty or damaged slot ends the segment, so a tail torn by a
+// crash is cut off cleanly. A segment is sealed once full, or once its
+// first record is `seal_after` old, and then handed out by take_sealed()
+// to be compacted into SQLite and removed. Segments found on disk at
+// startup, sealed or not, are handed out the same way: that is crash
+// recovery. Written records reach the disk through msync every
+// `sync_interval` (0 leaves it to the kernel, which still survives a
+// crash of the process but not a power cut).
+class ValidationJournal
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Kind : std::uint8_t
+    {
+        None = 0,  // slot never written
+        Card,
+        Qr,
+        Purchase,
+    };
+
+    static constexpr std::size_t max_key_size = 104;
+
+    struct Record
+    {
+        std::uint32_t crc;     // CRC-32 of the bytes after it
+        Kind kind;
+        std::uint8_t valid;    // validation result, or purchase success
+        std::uint8_t key_size;
+        std::uint8_t reserved;
+        std::int64_t at;       // Unix seconds
+        std::int32_t number;   // validator id or article id
+        std::int32_t quantity;
+        std::array<char, max_key_size> key;  // card number or QR token
+
+        [[nodiscard]] std::string_view key_view() const noexcept { return {key.data(), key_size}; }
+    };
+    static_assert(sizeof(Record) == 128);
+
+    struct Policy
+    {
+        std::filesystem::path directory;
+        std::size_t segment_records;
+        std::chrono::milliseconds sync_interval;
+        std::chrono::milliseconds seal_after;
+    };
+
+    class Segment
+    {
+    public:
+        ~Segment();
+
+        Segment(const Segment&) = delete;
+        Segment& operator=(const Segment&) = delete;
+
+        [[nodiscard]] std::uint64_t sequence() const noexcept { return sequence_; }
+        [[nodiscard]] const std::filesystem::path& path() const noexcept { return path_; }
+
+        // The records before the first empty or damaged slot.
+        [[nodiscard]] std::span<const Record> records() const noexcept;
+
+        // Deletes the file once its records are safely elsewhere.
+        bool remove();
+
+    private:
+        friend class ValidationJournal;
+        Segment() = default;
+
+        [[nodiscard]] Record* slots() const noexcept { return static_cast<Record*>(base_) + 1; }
+        void sync(std::size_t used) noexcept;  // writes records before `used`
+
+        std::filesystem::path path_;
+        std::uint64_t sequence_ = 0;
+        void* base_ = nullptr;
+        std::size_t bytes_ = 0;
+        std::size_t capacity_ = 0;
+        std::size_t used_ = 0;      // journal mutex held
+        std::size_t synced_ = 0;    // maintain() only
+        Clock::time_point first_append_;
+    };
+
+    // Creates `directory` if needed and queues the segments an earlier run
+    // left there as sealed. Segment numbers continue from `next_sequence`
+    // or past the highest found, whichever is greater. Throws
+    // std::runtime_error when the directory cannot be used.
+    ValidationJournal(Policy policy, std::uint64_t next_sequence);
+
+    ValidationJournal(const ValidationJournal&) = delete;
+    ValidationJournal& operator=(const ValidationJournal&) = delete;
+
+    // Checks and copies a record into the active segment. False when no
+    // segment could be created or the key does not fit; the caller then
+    // writes the row some other way.
+    [[nodiscard]] bool append(Record record);
+
+    // Housekeeping for one background thread: msync when due, seal an
+    // active segment that has waited long enough (every one if `all`),
+    // and create the next segment before a writer needs it.
+    void maintain(Clock::time_point now = Clock::now(), bool all = false);
+
+    // Sealed segments not taken yet, oldest first.
+    [[nodiscard]] std::vector<std::shared_ptr<Segment>> take_sealed();
+
+private:
+    [[nodiscard]] std::shared_ptr<Segment> create(std::uint64_t sequence) const;
+    [[nodiscard]] std::shared_ptr<Segment> open(const std::filesystem::path& path) const;
+    void seal(std::shared_ptr<Segment> segment);  // mutex_ held
+
+    Policy policy_;
+
+    std::mutex mutex_;  // held for the copy, not for file operations
+    std::shared_ptr<Segment> active_;
+    std::shared_ptr<Segment> spare_;
+    std::vector<std::shared_ptr<Segment>> sealed_;
+    std::uint64_t next_sequence_;
+
+    Clock::time_point last_sync_;
+    Clock::time_point retry_spare_;  // after a failed create()
+};